@@ -7,22 +7,25 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include <cstddef>
+#include <cstring>
 #include <vector>
 #include <list>
 #include <string>
 #include <memory>
 #include <map>
+#include <algorithm>
 #include <fstream>
 #include <stdexcept>
 #include <stdio.h> 
 #include <stdlib.h>
 #include <sstream> 
 #include <string>
-
-#if __GNUG__
-#   include <tr1/memory>
+#include <mutex>
+#ifdef __linux__
+#   include <unistd.h>
 #endif
 
+
 #ifdef __MAC__
 #   include <OpenGL/gl3.h>
 #   include <GLUT/glut.h>
@@ -47,12 +50,27 @@
 #include "asstcommon.h"
 #include "drawer.h"
 #include "picker.h"
+#include "framesnapshot.h"
+#include "updatethread.h"
+#include "frametimer.h"
+#include "jobsystem.h"
+#include "profiler.h"
+#include "gputimer.h"
+#include "snowcover.h"
+#include "particles.h"
+#include "impostor.h"
+#include "flatscene.h"
+#include "decimator.h"
+#include "streamingbuffer.h"
+#include "textureloader.h"
+#include "texturecache.h"
+#include "mipchain.h"
+#include "changetracker.h"
 
 #define EMBED_SOLUTION_GLSL 1
 #define PI 3.14159265
 
 using namespace std;
-using namespace tr1;
 
 // G L O B A L S ///////////////////////////////////////////////////
 
@@ -102,10 +120,23 @@ static double g_arcballScreenRadius = 100; // number of pixels
 static double g_arcballScale = 1;
 
 static bool g_pickingMode = false;
+static bool g_pickDragging = false;    // left button held down in picking mode
+static int g_pickStartX, g_pickStartY; // where the drag started, in GL window coordinates
+static bool g_pickingBox = false;      // whether the pick being read back is a box
+static shared_ptr<PickBuffer> g_pickBuffer;
+
+// Nodes under the last box selected in picking mode, most pixels first
+static vector<shared_ptr<SgRbtNode> > g_selectedRbtNodes;
 
 static bool g_playingAnimation = false;
 
-static bool g_shellNeedsUpdate = false;
+static bool g_shellNeedsUpdate = true; // the first frame builds the shells
+
+// Hair tips moving less than this in a simulation tick count as settled,
+// and leave the shells alone
+static const double g_furSettleDistance = 1e-5;
+
+static bool g_useJobSystem = true; // spread simulation work over the job system
 
 // Global variables for used physical simulation
 static const Cvec3 g_gravity(0, -0.5, 0);  // gavity vector
@@ -117,15 +148,15 @@ static int g_simulationsPerSecond = 60;
 
 static std::vector<Cvec3> g_tipPos,        // should be hair tip pos in world-space coordinates
 g_tipVelocity;   // should be hair tip velocity in world-space coordinates
-static vector<vector<Cvec3> > g_prevshells;
 
 // New Geometry
 static const int g_numShells = 24; // constants defining how many layers of shells
 static double g_furHeight = 0.21;
 static double g_hairyness = 0.7;
 
-static shared_ptr<SimpleGeometryPNX> g_bunnyGeometry;
-static vector<shared_ptr<SimpleGeometryPNX> > g_bunnyShellGeometries;
+static shared_ptr<Geometry> g_bunnyGeometry;
+static shared_ptr<StreamedGeometry> g_bunnyShellGeometry; // all layers, instanced
+static shared_ptr<StreamingBuffer> g_shellStream; // the shell vertices of the last few updates
 static Mesh g_bunnyMesh;
 
 
@@ -144,7 +175,7 @@ g_stormMat,
 g_lightMat;
 
 static shared_ptr<Material> g_bunnyMat; // for the bunny
-static vector<shared_ptr<Material> > g_bunnyShellMats; // for bunny shells
+static shared_ptr<Material> g_bunnyShellMat; // for bunny shells
 shared_ptr<Material> g_overridingMaterial;
 
 
@@ -159,11 +190,24 @@ static shared_ptr<Geometry> g_ground, g_cube, g_sphere;
 static shared_ptr<SgRootNode> g_world;
 static shared_ptr<SgRbtNode> g_skyNode, g_groundNode, g_robot1Node, g_robot2Node, g_light1, g_sun;
 static shared_ptr<SgRbtNode> g_bunnyNode;
+static shared_ptr<MyShapeNode> g_bunnyShellNode;
 
 
 static shared_ptr<SgRbtNode> g_currentCameraNode;
 static shared_ptr<SgRbtNode> g_currentPickedRbtNode;
 
+// ---------- Jobs
+
+// Runs body(b, e) over [begin, end) on the job system, or serially on this
+// thread if the job system has been switched off
+template<typename Body>
+static void parallelFor(int begin, int end, int grainSize, const Body& body) {
+	if (g_useJobSystem)
+		getJobSystem().parallelFor(begin, end, grainSize, body);
+	else if (begin < end)
+		body(begin, end);
+}
+
 // ---------- Animation
 
 class Animator {
@@ -177,6 +221,18 @@ private:
 	SgRbtNodes nodes_;
 	KeyFrames keyFrames_;
 
+	// Sets the rbts of nodes [begin, end) from the four surrounding key frames
+	struct Interpolate {
+		const SgRbtNodes& nodes;
+		const KeyFrame &f0, &f1, &f2, &f3;
+		double fraction;
+
+		void operator()(int begin, int end) const {
+			for (int i = begin; i < end; ++i)
+				nodes[i]->setRbt(interpolateCatmullRom(f0[i], f1[i], f2[i], f3[i], fraction));
+		}
+	};
+
 public:
 	void attachSceneGraph(shared_ptr<SgNode> root) {
 		nodes_.clear();
@@ -249,9 +305,8 @@ public:
 		if (f3 == keyFrames_.end()) // this might be true when t is exactly keyFrames_.size()-3.
 			f3 = f2; // in which case we step back
 
-		for (int i = 0, n = nodes_.size(); i < n; ++i) {
-			nodes_[i]->setRbt(interpolateCatmullRom((*f0)[i], (*f1)[i], (*f2)[i], (*f3)[i], fraction));
-		}
+		const Interpolate body = { nodes_, *f0, *f1, *f2, *f3, fraction };
+		parallelFor(0, nodes_.size(), 16, body);
 	}
 
 	KeyFrameIter keyFramesBegin() {
@@ -325,23 +380,124 @@ typedef struct {
 	float z;  
 
 	float v; // velocity 
-	shared_ptr<MyShapeNode> ball1;
-	shared_ptr<MyShapeNode> ball2;
-	shared_ptr<MyShapeNode> ball3;
-	shared_ptr<MyShapeNode> ball4;
+
+	// Persistent nodes, moved in place every frame. Only one of the balls
+	// and the impostor is attached to g_world at any time.
+	shared_ptr<MyShapeNode> balls[4];
+	shared_ptr<MyShapeNode> impostor;
+	bool usingImpostor;
 } clouds;
 
 
 #define PARTICLES 1000
-#define CLOUDS 20 
 
 particles particle_system[PARTICLES];
-clouds cloud_system[CLOUDS];
+vector<clouds> cloud_system;
+static int g_numClouds = 20; // --clouds <n>
+
+// Clouds farther from the eye than this are drawn as impostors
+static double g_cloudImpostorDistance = 25;
+static bool g_useCloudImpostors = true;
+
+// Cloud impostors: the atlas holds views of a cloud from CLOUD_VIEWS
+// directions (columns) at CLOUD_BLOATS bloat levels (rows)
+static const int CLOUD_VIEWS = 8, CLOUD_BLOATS = 4;
+static const double CLOUD_IMPOSTOR_SIZE = 3.6; // half the side length of the impostor quad
+static shared_ptr<ImpostorAtlas> g_cloudAtlas;
+static shared_ptr<Geometry> g_impostorQuad;
+static shared_ptr<Material> g_cloudImpostorMats[2][CLOUD_VIEWS * CLOUD_BLOATS]; // [clear, storm][tile]
 
 int neg = 1;
 
 shared_ptr<MyShapeNode> sun;
 
+// ---------- Frame pipeline
+
+// The update thread advances the weather and builds snapshots of the scene
+// graph while the GLUT thread draws the previous snapshot. Code on the GLUT
+// thread that touches the scene graph must hold g_sceneMutex via SceneLock.
+static std::recursive_mutex g_sceneMutex;
+
+struct SceneLock : Noncopyable {
+	SceneLock() { g_sceneMutex.lock(); }
+	~SceneLock() { g_sceneMutex.unlock(); }
+};
+
+static TripleBuffer<FrameSnapshot> g_snapshots;
+static FrameStats g_frameStats;
+static FlatSceneGraph g_flatScene; // g_world compiled for updateFrame
+static bool g_useLod = true; // pick sphere tessellations by size on screen
+
+// Levels of detail for whatever is drawn with g_sphere, as (slices, stacks,
+// minimum radius in pixels), and for the bunny body, as minimum radius in
+// pixels of the full mesh and of two decimations to a quarter each
+static const int NUM_SPHERE_LODS = 4, NUM_BUNNY_LODS = 3;
+static const int g_sphereLods[NUM_SPHERE_LODS][3] = { { 48, 24, 80 }, { 20, 10, 20 }, { 10, 5, 6 }, { 6, 3, 0 } };
+static const double g_bunnyLods[NUM_BUNNY_LODS] = { 150, 50, 0 };
+static Stopwatch g_frameStopwatch;
+static bool g_printFrameStats = false;
+
+// On demand rendering: a frame is only drawn when something changed since
+// the last one (see changetracker.h), and the update thread only runs while
+// the scene is still moving. A skipped frame turns the idle callback off;
+// the input callbacks turn it back on through redraw(), and timers do for
+// changes made on other threads: a short one while the update thread has a
+// snapshot on the way, a slow one otherwise.
+static bool g_renderOnDemand = true;
+static unsigned g_drawnChangeCount = ~0u; // getChangeCount() at the last drawn frame
+static bool g_lastFrameSkipped = false;
+static bool g_updateRequested = false; // display() asked the update thread for a snapshot
+static bool g_idleArmed = true; // whether idle() is the GLUT idle callback
+static const int g_snapshotPollMs = 2, g_changePollMs = 100;
+
+static void idle();
+
+// Draws the next frame, and keeps drawing while the scene changes
+static void redraw() {
+	if (!g_idleArmed) {
+		glutIdleFunc(idle);
+		g_idleArmed = true;
+	}
+	glutPostRedisplay();
+}
+
+// Stops the time of day and the cloud drift, so that a scene left alone
+// settles and stops being redrawn
+static bool g_dayPaused = false;
+
+// GPU time of the render passes, shown next to the clock
+enum GpuPass { GPU_MAIN = 0, GPU_SHELLS, GPU_GROUND, GPU_PARTICLES, GPU_PICK, NUM_GPU_PASSES };
+static shared_ptr<GpuTimer> g_gpuTimer; // NULL if timer queries are not supported
+static bool g_showGpuTimes = true;
+
+// Textures are decoded in the background and uploaded by display() within
+// a time budget per frame. g_startupStopwatch runs from program start
+// until the last of the textures asked for at startup is in.
+static shared_ptr<TextureLoader> g_textureLoader;
+static shared_ptr<TextureCache> g_textureCache; // materials get their textures here
+static const long long g_textureBudgetBytes = 64 << 20;
+static double g_textureUploadBudgetMs = 2;
+static Stopwatch g_startupStopwatch;
+static bool g_startupTexturesReported = false;
+
+// Snow lying on the ground, sampled by g_bumpFloorMat
+static shared_ptr<SnowCover> g_snowCover;
+
+// Rain and snow simulated on the GPU. NULL if transform feedback is not
+// available, in which case the CPU particles in particle_system are used.
+static shared_ptr<ParticleSystem> g_gpuParticles;
+static int g_numGpuParticles = 200000; // --particles <n>
+static shared_ptr<Material> g_rainParticleMat, g_snowParticleMat;
+
+// Soak test (--soak <minutes>): report memory and frame time every minute,
+// then exit
+static double g_soakMinutes = 0;
+static Stopwatch g_soakStopwatch;
+static int g_soakReports = 0;
+
+// declared last so that it is stopped before any of the above is destroyed
+static UpdateThread g_updateThread;
+
 ///////////////// END OF G L O B A L S //////////////////////////////////////////////////
 
 
@@ -383,6 +539,25 @@ void initParticles(void) {
 }
 
 void drawRain(void) {
+	PROFILE_ZONE("drawRain");
+	if (g_gpuParticles) {
+		// The GPU flakes are far too many to each leave a mark, and their
+		// landing spots are uniformly random anyway. Deposit snow at random
+		// spots at about the rate the CPU flakes used to.
+		static Stopwatch stopwatch;
+		static double pendingSplats = 0;
+		const double dt = min(stopwatch.elapsedMs() / 1000, .1);
+		stopwatch.reset();
+		if (weather == SNOW) {
+			for (pendingSplats += dt * 15 * (1 + 20 * velocity); pendingSplats >= 1; pendingSplats -= 1) {
+				const float x = (rand() / float(RAND_MAX) * 2 - 1) * g_groundSize;
+				const float z = (rand() / float(RAND_MAX) * 2 - 1) * g_groundSize;
+				g_snowCover->splat(x, z, .3, .02);
+			}
+		}
+		return;
+	}
+
 	if (weather != CLEAR) {
 		for (int i = 0; i < PARTICLES; i += 10) {
 			if (particle_system[i].splashing) {
@@ -430,14 +605,8 @@ void drawRain(void) {
 			if (particle_system[i].y <= stop) {
 				g_world->removeChild(particle_system[i].node);
 				if (weather == SNOW) {
-					shared_ptr<MyShapeNode> shape(
-							new MyShapeNode(g_sphere,
-								g_lightMat,
-								Cvec3(particle_system[i].x, g_groundY + .01, particle_system[i].z),
-								Cvec3(0, 0, 0),
-								Cvec3(.1, .001, .1)));
-
-					g_world->addChild(shape);
+					// the flake settles into the ground's snow map instead of becoming a node
+					g_snowCover->splat(particle_system[i].x, particle_system[i].z, .3, .02);
 					initParticle(i);
 				}
 
@@ -462,8 +631,14 @@ void drawRain(void) {
 
 float cloud_speed[3] = {.03, .02, .01};
 
+// Offsets and sizes of the four balls making up a cloud, in cloud coordinates
+static const double g_cloudBallX[4] = { 0, 1, -1, 2 };
+static const double g_cloudBallScale[4] = { 1, 1.5, 1, 1 };
+static const double g_cloudCenterX = .5; // the impostor is centered here
+
 void initClouds(void) {
-	for (int i = 0; i < CLOUDS; i++) {
+	cloud_system.resize(g_numClouds);
+	for (int i = 0; i < g_numClouds; i++) {
 		if (neg) {
 			cloud_system[i].x = - static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/(g_groundSize))) ;
 			cloud_system[i].v = cloud_speed[i%3]; 
@@ -479,135 +654,95 @@ void initClouds(void) {
 
 		cloud_system[i].z = - 2 * static_cast <float> (rand()) / (static_cast <float> (RAND_MAX/(g_groundSize)))  + g_groundSize;
 
-
-
-		shared_ptr<MyShapeNode> cloud1(
+		for (int j = 0; j < 4; ++j) {
+			cloud_system[i].balls[j].reset(
 						new MyShapeNode(g_sphere,
 							g_lightMat,
-							Cvec3(cloud_system[i].x, 20, cloud_system[i].z),
+							Cvec3(cloud_system[i].x + g_cloudBallX[j], 20, cloud_system[i].z),
 							Cvec3(0, 0, 0),
-							Cvec3(1, 1, 1)));
-
-		shared_ptr<MyShapeNode> cloud2(
-								new MyShapeNode(g_sphere,
-									g_lightMat,
-									Cvec3(cloud_system[i].x + 1, 20, cloud_system[i].z),
-									Cvec3(0, 0, 0),
-									Cvec3(1.5, 1.5, 1.5)));
-
-		shared_ptr<MyShapeNode> cloud3(
-								new MyShapeNode(g_sphere,
-									g_lightMat,
-									Cvec3(cloud_system[i].x -1, 20, cloud_system[i].z),
-									Cvec3(0, 0, 0),
-									Cvec3(1, 1, 1)));
-
-		shared_ptr<MyShapeNode> cloud4(
-								new MyShapeNode(g_sphere,
-									g_lightMat,
-									Cvec3(cloud_system[i].x + 2, 20, cloud_system[i].z),
-									Cvec3(0, 0, 0),
-									Cvec3(1, 1, 1)));
-
-		cloud_system[i].ball1 = cloud1; 
-		cloud_system[i].ball2 = cloud2; 
-		cloud_system[i].ball3 = cloud3; 
-		cloud_system[i].ball4 = cloud4; 
-
-		g_world->addChild(cloud1);
-		g_world->addChild(cloud2);
-		g_world->addChild(cloud3);
-		g_world->addChild(cloud4);
-
+							Cvec3(g_cloudBallScale[j], g_cloudBallScale[j], g_cloudBallScale[j])));
+			g_world->addChild(cloud_system[i].balls[j]);
+		}
+		cloud_system[i].impostor.reset(new MyShapeNode(g_impostorQuad, g_cloudImpostorMats[0][0]));
+		cloud_system[i].usingImpostor = false;
 	}
 }
 
 float bloat = 1.0; 
 
 void drawClouds(void) {
+	PROFILE_ZONE("drawClouds");
 	if (weather != CLEAR && bloat <= 2.0)
 		bloat += .01;
 	else if (weather == CLEAR && bloat >= 1.0)
 		bloat -= .01; 
 
-	for (int i = 0; i < CLOUDS; i ++) {
-		g_world->removeChild(cloud_system[i].ball1);
-		g_world->removeChild(cloud_system[i].ball2);
-		g_world->removeChild(cloud_system[i].ball3);
-		g_world->removeChild(cloud_system[i].ball4);
-
-		cloud_system[i].x += cloud_system[i].v;
-
-		if (cloud_system[i].x > 20 || cloud_system[i].x < -20)
-			cloud_system[i].v = -1 * cloud_system[i].v;
-
-		shared_ptr<Material> mat;
-
-		if (weather == CLEAR) 
-			mat = g_lightMat;
-		else 
-			mat = g_stormMat;
-
-		shared_ptr<MyShapeNode> cloud1(
-								new MyShapeNode(g_sphere,
-									mat,
-									Cvec3(cloud_system[i].x, 20, cloud_system[i].z),
-									Cvec3(0, 0, 0),
-									Cvec3(1*bloat, 1*bloat, 1*bloat)));
-
-		shared_ptr<MyShapeNode> cloud2(
-								new MyShapeNode(g_sphere,
-									mat,
-									Cvec3(cloud_system[i].x + 1, 20, cloud_system[i].z),
-									Cvec3(0, 0, 0),
-									Cvec3(1.5*bloat, 1.5*bloat, 1.5*bloat)));
-
-		shared_ptr<MyShapeNode> cloud3(
-								new MyShapeNode(g_sphere,
-									mat,
-									Cvec3(cloud_system[i].x -1, 20, cloud_system[i].z),
-									Cvec3(0, 0, 0),
-									Cvec3(1*bloat, 1*bloat, 1*bloat)));
-
-		shared_ptr<MyShapeNode> cloud4(
-								new MyShapeNode(g_sphere,
-									mat,
-									Cvec3(cloud_system[i].x + 2, 20, cloud_system[i].z),
-									Cvec3(0, 0, 0),
-									Cvec3(1*bloat, 1*bloat, 1*bloat)));
-
-		cloud_system[i].ball1 = cloud1; 
-		cloud_system[i].ball2 = cloud2; 
-		cloud_system[i].ball3 = cloud3; 
-		cloud_system[i].ball4 = cloud4; 
+	const Cvec3 eye = getPathAccumRbt(g_world, g_currentCameraNode).getTranslation();
+	const int bloatLevel = max(0, min(CLOUD_BLOATS - 1, int((bloat - 1) * (CLOUD_BLOATS - 1) + .5)));
+	const shared_ptr<Material> mat = weather == CLEAR ? g_lightMat : g_stormMat;
+
+	for (int i = 0; i < g_numClouds; i ++) {
+		clouds& cloud = cloud_system[i];
+		if (!g_dayPaused)
+			cloud.x += cloud.v;
+
+		if (cloud.x > 20 || cloud.x < -20)
+			cloud.v = -1 * cloud.v;
+
+		const Cvec3 center(cloud.x + g_cloudCenterX, 20, cloud.z);
+		const Cvec3 toEye = eye - center;
+
+		// switch level of detail, with a little hysteresis against flicker
+		const double dist = norm(toEye);
+		const bool useImpostor = g_useCloudImpostors &&
+			dist > g_cloudImpostorDistance + (cloud.usingImpostor ? -1 : 1);
+		if (useImpostor != cloud.usingImpostor) {
+			for (int j = 0; j < 4; ++j) {
+				if (useImpostor)
+					g_world->removeChild(cloud.balls[j]);
+				else
+					g_world->addChild(cloud.balls[j]);
+			}
+			if (useImpostor)
+				g_world->addChild(cloud.impostor);
+			else
+				g_world->removeChild(cloud.impostor);
+			cloud.usingImpostor = useImpostor;
+		}
 
-		g_world->addChild(cloud1);
-		g_world->addChild(cloud2);
-		g_world->addChild(cloud3);
-		g_world->addChild(cloud4);
-		
+		if (useImpostor) {
+			// turn the quad about y to face the eye, and pick the view closest
+			// to the direction we look at the cloud from
+			const double angle = atan2(toEye[0], toEye[2]) * 180 / CS175_PI;
+			const int view = (int(floor(angle / (360.0 / CLOUD_VIEWS) + .5)) % CLOUD_VIEWS + CLOUD_VIEWS) % CLOUD_VIEWS;
+			cloud.impostor->material = g_cloudImpostorMats[weather == CLEAR ? 0 : 1][bloatLevel * CLOUD_VIEWS + view];
+			cloud.impostor->setAffineMatrix(center, Cvec3(0, angle, 0), Cvec3(CLOUD_IMPOSTOR_SIZE, CLOUD_IMPOSTOR_SIZE, 1));
+		}
+		else {
+			for (int j = 0; j < 4; ++j) {
+				const double scale = g_cloudBallScale[j] * bloat;
+				cloud.balls[j]->material = mat;
+				cloud.balls[j]->setAffineMatrix(Cvec3(cloud.x + g_cloudBallX[j], 20, cloud.z), Cvec3(0, 0, 0), Cvec3(scale, scale, scale));
+			}
+		}
 	}
 
 }
 
 
 double tick = 0.0; 
-void drawSun(void) {
+Cvec3 skyColor(128. / 255., 200. / 255., 1.);
 
-	g_world->removeChild(g_sun);
-	g_sun->removeChild(sun);
+void drawSun(void) {
+	PROFILE_ZONE("drawSun");
+	if (g_dayPaused)
+		return;
 
 	Cvec3 newPos = Cvec3((g_groundSize + 5) * sin(- tick) - g_groundSize, (g_groundSize + 5) * cos(tick), -4.0);
-	
-	g_sun.reset(new SgRbtNode(RigTForm(newPos)));
 
-	shared_ptr<MyShapeNode> shape(
-		new MyShapeNode(g_sphere, g_sunMat, newPos, Cvec3(0.0), Cvec3(2.0)));
-
-	sun = shape;
-
-	g_sun->addChild(sun);
-	g_world->addChild(g_sun);
+	// move the sun in place, so the shape of the scene graph stays the same
+	g_sun->setRbt(RigTForm(newPos));
+	sun->setAffineMatrix(newPos, Cvec3(0.0), Cvec3(2.0));
 	tick += 0.001;
 
 	float modified = fmod(tick, 6.28);
@@ -616,80 +751,113 @@ void drawSun(void) {
 	float g = (200 + 8*newPos[1] > 255) ? 255. : (200. + 8*newPos[1] > 255.);
 	float b = 255.;
 
-	glClearColor(r / 255., g / 255., b / 255., 0.);
-
+	skyColor = Cvec3(r / 255., g / 255., b / 255.);
 }
 
 
-static VertexPN findvertex(Mesh::Vertex v, int layer) {
-	RigTForm bunny = inv(getPathAccumRbt(g_world, g_bunnyNode));
-	
-	const Cvec3 n = v.getNormal() * (g_furHeight / g_numShells);
-	const Cvec3 d = ((bunny * g_tipPos[v.getIndex()] - v.getPosition() - n * g_numShells) / (g_numShells * g_numShells - g_numShells)) * 2;
-	//const Cvec3 d = v.getNormal();
-
+// One corner of a bunny triangle, carrying everything needed to place it
+// on every shell layer. The vertex shader puts layer l (gl_InstanceID) at
+//
+//   p + (l + 1) s n + d l (l + 1) / 2
+//
+// with s = g_furHeight / g_numShells, so the hair bends quadratically from
+// the root towards its simulated tip, and takes n + d l / s as its normal.
+struct ShellVertex {
+	HalfVec<4> p;  // root, w = 1
+	HalfVec<4> n;  // unit normal, w = 0; half rather than 2_10_10_10 so it needs no GL 3.3
+	HalfVec<4> d;  // bend, in bunny object coordinates
+	HalfVec<2> x;
+
+	static const VertexFormat FORMAT;
+};
 
-	if (layer == 0) {
-		g_prevshells[v.getIndex()][layer] = v.getPosition() + n + d * layer;
-		return VertexPN(g_prevshells[v.getIndex()][layer], v.getNormal());  // like normal
-	
+const VertexFormat ShellVertex::FORMAT = VertexFormat(sizeof(ShellVertex), "shell")
+	.put("aPosition", 4, GL_HALF_FLOAT, GL_FALSE, offsetof(ShellVertex, p))
+	.put("aNormal", 4, GL_HALF_FLOAT, GL_FALSE, offsetof(ShellVertex, n))
+	.put("aBend", 4, GL_HALF_FLOAT, GL_FALSE, offsetof(ShellVertex, d))
+	.put("aTexCoord", 2, GL_HALF_FLOAT, GL_FALSE, offsetof(ShellVertex, x));
+
+// Packs the root, normal and bend of bunny vertices [begin, end), the bend
+// chosen so that the top layer reaches the hair tip. invBunnyRbt takes world
+// coordinates to bunny object coordinates.
+struct ShellVertexJob {
+	RigTForm invBunnyRbt;
+	vector<ShellVertex> *shellVerts;
+
+	void operator()(int begin, int end) const {
+		for (int i = begin; i < end; ++i) {
+			const Mesh::Vertex v = g_bunnyMesh.getVertex(i);
+			const Cvec3 n = v.getNormal() * (g_furHeight / g_numShells);
+			const Cvec3 d = ((invBunnyRbt * g_tipPos[i] - v.getPosition() - n * g_numShells) / (g_numShells * g_numShells - g_numShells)) * 2;
+			const Cvec3 p = v.getPosition(), normal = v.getNormal();
+			ShellVertex& sv = (*shellVerts)[i];
+			sv.p = HalfVec<4>(Cvec3f(p[0], p[1], p[2]));
+			sv.n = HalfVec<4>(Cvec3f(normal[0], normal[1], normal[2]), 0);
+			sv.d = HalfVec<4>(Cvec3f(d[0], d[1], d[2]), 0);
+		}
 	}
-	else {
-		g_prevshells[v.getIndex()][layer] = g_prevshells[v.getIndex()][layer - 1] + n + d * layer;
-		return VertexPN(g_prevshells[v.getIndex()][layer],
-			g_prevshells[v.getIndex()][layer] - g_prevshells[v.getIndex()][layer - 1]);
+};
+
+// Copies the packed vertices to the corners of bunny faces [begin, end),
+// written in order to `corners' (possibly mapped GL memory).
+struct ShellCornerJob {
+	const vector<ShellVertex> *shellVerts;
+	ShellVertex* corners;
+
+	void operator()(int begin, int end) const {
+		const HalfVec<2> texCoords[3] = {
+			HalfVec<2>(Cvec2f(0, 0)), HalfVec<2>(Cvec2f(g_hairyness, 0)), HalfVec<2>(Cvec2f(0, g_hairyness))
+		};
+		ShellVertex* corner = corners + begin * 3;
+		for (int j = begin; j < end; j++) {
+			Mesh::Face f = g_bunnyMesh.getFace(j);
+			for (int k = 0; k < 3; ++k) {
+				*corner = (*shellVerts)[f.getVertex(k).getIndex()];
+				corner->x = texCoords[k];
+				++corner;
+			}
+		}
 	}
-}
+};
 
 // Specifying shell geometries based on g_tipPos, g_furHeight, and g_numShells.
 // You need to call this function whenver the shell needs to be updated
+//
+// Only one layer goes to the GPU; g_bunnyShellGeometry draws it once per
+// shell layer.
 static void updateShellGeometry() {
+	PROFILE_ZONE("updateShellGeometry");
+	// scratch space, kept around between calls
+	static vector<ShellVertex> shellVerts;
 
-	RigTForm bunny = (getPathAccumRbt(g_world, g_bunnyNode));
+	const int numVertices = g_bunnyMesh.getNumVertices();
 	int facenum = g_bunnyMesh.getNumFaces(); 
+	shellVerts.resize(numVertices);
 
-	g_prevshells.resize(g_bunnyMesh.getNumVertices());
-
-	for (int i = 0; i < g_bunnyMesh.getNumVertices(); i++)
-		g_prevshells[i].resize(g_numShells);
-
-	for (int i = 0; i < g_numShells; i++) {
-		vector<VertexPN> verts;
-		for (int n = 0; n < g_bunnyMesh.getNumVertices(); n++)
-		{
-			verts.push_back(findvertex(g_bunnyMesh.getVertex(n), i));
-		}
+	// the bunny does not move while we hold the scene lock, so look it up once
+	ShellVertexJob vertexJob = { inv(getPathAccumRbt(g_world, g_bunnyNode)), &shellVerts };
+	parallelFor(0, numVertices, 256, vertexJob);
 
-		vector<VertexPNX> shell;
-		for (int j = 0; j < g_bunnyMesh.getNumFaces(); j++) {
-			Mesh::Face f = g_bunnyMesh.getFace(j);
-			VertexPN v1 = verts[f.getVertex(0).getIndex()];
-			VertexPN v2 = verts[f.getVertex(1).getIndex()];
-			VertexPN v3 = verts[f.getVertex(2).getIndex()];
+	const int numLayerVertices = facenum * 3;
+	shared_ptr<StreamingBuffer::Span> span = g_shellStream->allocate(
+		numLayerVertices * sizeof(ShellVertex), sizeof(ShellVertex));
+	ShellCornerJob cornerJob = { &shellVerts, static_cast<ShellVertex*>(span->data) };
+	parallelFor(0, facenum, 1024, cornerJob);
+	g_shellStream->unmap();
 
-			shell.push_back(VertexPNX(Cvec3(v1.p[0], v1.p[1], v1.p[2]), Cvec3(v1.n[0], v1.n[1], v1.n[2]), Cvec2(0, 0)));
-			shell.push_back(VertexPNX(Cvec3(v2.p[0], v2.p[1], v2.p[2]), Cvec3(v2.n[0], v2.n[1], v2.n[2]), Cvec2(g_hairyness, 0)));
-			shell.push_back(VertexPNX(Cvec3(v3.p[0], v3.p[1], v3.p[2]), Cvec3(v3.n[0], v3.n[1], v3.n[2]), Cvec2(0, g_hairyness)));
+	g_bunnyShellGeometry->setVertices(span, 0, numLayerVertices);
 
-		}
-		
-		g_bunnyShellGeometries[i]->upload(&shell[0], facenum * 3);
-	}
 	g_shellNeedsUpdate = false;
 	cout << "Tip position [" << g_tipPos[10][0] << "]" << endl;
 
 }
 
+// One simulation step for the hair tips of bunny vertices [begin, end)
+struct HairStepJob {
+	RigTForm bunny;
 
-// New glut timer call back that perform dynamics simulation
-// every g_simulationsPerSecond times per second
-static void hairsSimulationCallback(int dontCare) {
-	// TASK 2 TODO: wrte dynamics simulation code here as part of TASK2
-	for (int i = 0; i < g_numStepsPerFrame; i++) {
-		for (int j = 0; j < g_bunnyMesh.getNumVertices(); j++) {
-
-			RigTForm bunny = (getPathAccumRbt(g_world, g_bunnyNode));
-			
+	void operator()(int begin, int end) const {
+		for (int j = begin; j < end; j++) {
 			Cvec3 temp = g_bunnyMesh.getVertex(j).getPosition() + g_bunnyMesh.getVertex(j).getNormal() * g_furHeight;
 			Cvec3 s = bunny * temp;
 			Cvec3 t = g_tipPos[j];
@@ -709,12 +877,37 @@ static void hairsSimulationCallback(int dontCare) {
 			g_tipVelocity[j] = ((v + force * g_timeStep) * g_damping);
 		}
 	}
+};
+
+// New glut timer call back that perform dynamics simulation
+// every g_simulationsPerSecond times per second
+static void hairsSimulationCallback(int dontCare) {
+	PROFILE_ZONE("hairsSimulation");
+	SceneLock lock;
+
+	// TASK 2 TODO: wrte dynamics simulation code here as part of TASK2
+	// the bunny cannot move during the steps, so its rbt is looked up only once
+	HairStepJob step = { getPathAccumRbt(g_world, g_bunnyNode) };
+	static vector<Cvec3> prevTipPos;
+	prevTipPos.assign(g_tipPos.begin(), g_tipPos.begin() + g_bunnyMesh.getNumVertices());
+	Stopwatch stopwatch;
+	for (int i = 0; i < g_numStepsPerFrame; i++)
+		parallelFor(0, g_bunnyMesh.getNumVertices(), 256, step);
+	g_frameStats.record(FrameStats::SIMULATE, stopwatch.elapsedMs());
 
 	// schedule this to get called again
 	glutTimerFunc(1000 / g_simulationsPerSecond, hairsSimulationCallback, 0);
 	//updateShellGeometry();
-	g_shellNeedsUpdate = true;
-	glutPostRedisplay(); // signal redisplaying
+
+	// once the fur has come to rest, the shells need not be rebuilt
+	double maxMove2 = 0;
+	for (size_t i = 0; i < prevTipPos.size(); ++i)
+		maxMove2 = max(maxMove2, norm2(g_tipPos[i] - prevTipPos[i]));
+	if (maxMove2 > g_furSettleDistance * g_furSettleDistance) {
+		g_shellNeedsUpdate = true;
+		markDirty();
+		redraw(); // signal redisplaying
+	}
 }
 
 static void initSimulation() {
@@ -736,11 +929,12 @@ static void initSimulation() {
 		}
 	}
 
-	g_bunnyGeometry.reset(new SimpleGeometryPNX());// upload(&verts[0], vertnum);
+	shared_ptr<SimpleGeometryPNX> bunnyGeometry(new SimpleGeometryPNX());// upload(&verts[0], vertnum);
 												  //g_bunnyGeometry->upload(&verts[0], vertnum);
 												  // Now allocate array of SimpleGeometryPNX to for shells, one per layer
 
-	g_bunnyGeometry->upload(&verts[0], facenum * 3);
+	bunnyGeometry->upload(&verts[0], facenum * 3);
+	g_bunnyGeometry = bunnyGeometry;
 	// TASK 1 TODO: initialize g_tipPos to "at-rest" hair tips in world coordinates
 
 	for (int z = 0; z < g_bunnyMesh.getNumVertices(); ++z)
@@ -754,69 +948,203 @@ static void initSimulation() {
 	hairsSimulationCallback(0);
 }
 
-static void initBunnyMeshes() {
-	g_bunnyMesh.load("bunny.mesh");
-	int facenum = g_bunnyMesh.getNumFaces();
-
-	vector<VertexPNX> verts;
-	verts.reserve(facenum * 3);
-
-	// TODO: Init the per vertex normal of g_bunnyMesh; see "calculating normals"
-	// section of spec
-	// ...
-
+// Sets the normal of every vertex to the average of the adjacent face normals
+static void computeVertexNormals(Mesh& mesh) {
 	// set all vertices to zero for the entire geometry
-	for (int i = 0; i < g_bunnyMesh.getNumVertices(); i++)
-		g_bunnyMesh.getVertex(i).setNormal(Cvec3(0));
+	for (int i = 0; i < mesh.getNumVertices(); i++)
+		mesh.getVertex(i).setNormal(Cvec3(0));
 
 	// for each face - add the face norm to all the vertices 
-	for (int z = 0; z < g_bunnyMesh.getNumFaces(); ++z)
+	for (int z = 0; z < mesh.getNumFaces(); ++z)
 	{
-		Mesh::Face temp = g_bunnyMesh.getFace(z);
+		Mesh::Face temp = mesh.getFace(z);
 		Cvec3 facenorm = temp.getNormal();
 
 		for (int n = 0; n < temp.getNumVertices(); ++n)
-		{
-			Mesh::Vertex oldvertex = temp.getVertex(n);
-			oldvertex.setNormal(oldvertex.getNormal() + facenorm);
-			temp.getVertex(n).setNormal((temp.getVertex(n).getNormal() + facenorm));
-		}
+			temp.getVertex(n).setNormal(temp.getVertex(n).getNormal() + facenorm);
 	}
 
-	for (int j = 0; j < g_bunnyMesh.getNumVertices(); j++) {
-		Mesh::Vertex vertex = g_bunnyMesh.getVertex(j);
+	for (int j = 0; j < mesh.getNumVertices(); j++) {
+		Mesh::Vertex vertex = mesh.getVertex(j);
 		Cvec3 n = vertex.getNormal();
 		vertex.setNormal(n.normalize());
-		g_tipPos.push_back(g_bunnyMesh.getVertex(j).getPosition() + g_bunnyMesh.getVertex(j).getNormal() * g_furHeight);
-		g_tipVelocity.push_back(Cvec3(0));
 	}
+}
 
-	// TODO: Initialize g_bunnyGeometry from g_bunnyMesh; see "mesh preparation"
-	// section of spec
+// Prints the memory held by vertex buffers, by vertex format
+static void printVertexMemory() {
+	const vector<VertexMemoryUsage> usage = getVertexMemoryUsage();
+	long long totalBytes = 0;
+	cerr << "Vertex memory:\n";
+	for (size_t i = 0; i < usage.size(); ++i) {
+		const long long bytes = usage[i].numVertices * usage[i].vertexSize;
+		totalBytes += bytes;
+		cerr << "  " << usage[i].formatName << " (" << usage[i].vertexSize << " bytes): "
+			<< usage[i].numVertices << " vertices in " << usage[i].numBuffers << " buffers, "
+			<< (bytes + 512) / 1024 << " KB\n";
+	}
+	cerr << "  total " << (totalBytes + 512) / 1024 << " KB, not counting the "
+		<< g_shellStream->getSize() / 1024 << " KB shell stream (" << g_shellStream->getNumStalls() << " stalls so far)" << endl;
+}
+
+// Prints the texture cache, with the materials that could use its textures
+static void printTextureResidency() {
+	TextureCache::NamedMaterials materials;
+	materials.push_back(make_pair(string("bumpFloor"), g_bumpFloorMat));
+	materials.push_back(make_pair(string("bunny"), g_bunnyMat));
+	materials.push_back(make_pair("bunnyShell", g_bunnyShellMat));
+	g_textureCache->printResidency(cerr, materials);
+}
 
+// Totals over the indexed geometries built so far, see reportVertexCache()
+static VertexCacheReport g_vertexCacheTotals;
 
-	for (int z = 0; z < g_bunnyMesh.getNumFaces(); ++z)
+// Adds what reordering an indexed geometry for the vertex cache gained to
+// the totals, and prints it
+static void reportVertexCache(const char* name, const VertexCacheReport& report) {
+	cerr << "Vertex cache " << name << ": " << report.numTriangles << " triangles, ACMR "
+		<< report.acmrBefore << " -> " << report.acmrAfter << endl;
+
+	VertexCacheReport& totals = g_vertexCacheTotals;
+	const int numTriangles = totals.numTriangles + report.numTriangles;
+	if (numTriangles > 0) {
+		totals.acmrBefore = (totals.acmrBefore * totals.numTriangles + report.acmrBefore * report.numTriangles) / numTriangles;
+		totals.acmrAfter = (totals.acmrAfter * totals.numTriangles + report.acmrAfter * report.numTriangles) / numTriangles;
+	}
+	totals.numTriangles = numTriangles;
+}
+
+// Triangles of the mesh, smooth shaded with the vertex normals. The
+// vertices are shared between faces, which the bunny material can afford
+// as it has no use for the texture coordinates the fur shells need per
+// corner.
+static shared_ptr<SimpleIndexedGeometryPN> makeMeshGeometry(Mesh& mesh) {
+	if (mesh.getNumVertices() > 0x10000)
+		throw runtime_error("Mesh has too many vertices for 16 bit indices");
+
+	vector<VertexPN> verts;
+	verts.reserve(mesh.getNumVertices());
+	for (int i = 0; i < mesh.getNumVertices(); ++i) {
+		const Mesh::Vertex v = mesh.getVertex(i);
+		const Cvec3 p = v.getPosition(), n = v.getNormal();
+		verts.push_back(VertexPN(p[0], p[1], p[2], n[0], n[1], n[2]));
+	}
+
+	vector<unsigned short> idx;
+	idx.reserve(mesh.getNumFaces() * 6);
+	for (int z = 0; z < mesh.getNumFaces(); ++z)
 	{
-		Mesh::Face temp = g_bunnyMesh.getFace(z);
+		Mesh::Face temp = mesh.getFace(z);
 		for (int n = 0; n < temp.getNumVertices() - 2; ++n)
 		{
-			verts.push_back(VertexPNX(temp.getVertex(n).getPosition(), temp.getVertex(n).getNormal(), Cvec2(0,0)));
-			verts.push_back(VertexPNX(temp.getVertex(n + 1).getPosition(), temp.getVertex(n + 1).getNormal(),Cvec2(g_hairyness,0)));
-			verts.push_back(VertexPNX(temp.getVertex(n + 2).getPosition(), temp.getVertex(n + 2).getNormal(),Cvec2(0, g_hairyness)));
+			idx.push_back(temp.getVertex(0).getIndex());
+			idx.push_back(temp.getVertex(n + 1).getIndex());
+			idx.push_back(temp.getVertex(n + 2).getIndex());
 		}
 	}
 
-	g_bunnyGeometry.reset(new SimpleGeometryPNX());// upload(&verts[0], vertnum);
-												  //g_bunnyGeometry->upload(&verts[0], vertnum);
-												  // Now allocate array of SimpleGeometryPNX to for shells, one per layer
+	return shared_ptr<SimpleIndexedGeometryPN>(new SimpleIndexedGeometryPN(&verts[0], &idx[0], verts.size(), idx.size()));
+}
 
+// The three point rules of a Catmull-Clark step, each for a range of the
+// faces, edges or vertices of *mesh. Each writes only its own entries, so
+// ranges run in parallel; a rule only reads points of the ones before.
+struct NewFaceVertexJob {
+	Mesh *mesh;
+
+	void operator()(int begin, int end) const {
+		for (int i = begin; i < end; ++i) {
+			const Mesh::Face f = mesh->getFace(i);
+			Cvec3 p(0);
+			for (int j = 0; j < f.getNumVertices(); ++j)
+				p += f.getVertex(j).getPosition();
+			mesh->setNewFaceVertex(f, p / f.getNumVertices());
+		}
+	}
+};
 
-	g_bunnyGeometry->upload(&verts[0], facenum * 3);
+struct NewEdgeVertexJob {
+	Mesh *mesh;
 
-	g_bunnyShellGeometries.resize(g_numShells);
-	for (int i = 0; i < g_numShells; ++i) {
-		g_bunnyShellGeometries[i].reset(new SimpleGeometryPNX());
+	void operator()(int begin, int end) const {
+		for (int i = begin; i < end; ++i) {
+			const Mesh::Edge e = mesh->getEdge(i);
+			mesh->setNewEdgeVertex(e, (e.getVertex(0).getPosition() + e.getVertex(1).getPosition() +
+				mesh->getNewFaceVertex(e.getFace(0)) + mesh->getNewFaceVertex(e.getFace(1))) / 4);
+		}
 	}
+};
+
+struct NewVertexVertexJob {
+	Mesh *mesh;
+
+	void operator()(int begin, int end) const {
+		for (int i = begin; i < end; ++i) {
+			const Mesh::Vertex v = mesh->getVertex(i);
+			Cvec3 vertexSum(0), faceSum(0);
+			int n = 0;
+			Mesh::VertexIterator it = v.getIterator(), it0 = it;
+			do {
+				vertexSum += it.getVertex().getPosition();
+				faceSum += mesh->getNewFaceVertex(it.getFace());
+				++n;
+			} while (++it != it0);
+			mesh->setNewVertexVertex(v, v.getPosition() * (double(n - 2) / n) + (vertexSum + faceSum) / (n * n));
+		}
+	}
+};
+
+// One step of Catmull-Clark subdivision. The new points are computed on the
+// job system; rebuilding the connectivity (Mesh::subdivide) stays serial.
+static void subdivideCatmullClark(Mesh& mesh) {
+	const NewFaceVertexJob faceJob = { &mesh };
+	parallelFor(0, mesh.getNumFaces(), 1024, faceJob);
+	const NewEdgeVertexJob edgeJob = { &mesh };
+	parallelFor(0, mesh.getNumEdges(), 1024, edgeJob);
+	const NewVertexVertexJob vertexJob = { &mesh };
+	parallelFor(0, mesh.getNumVertices(), 1024, vertexJob);
+	mesh.subdivide();
+}
+
+static void initBunnyMeshes() {
+	g_bunnyMesh.load("bunny.mesh");
+
+	computeVertexNormals(g_bunnyMesh);
+	for (int j = 0; j < g_bunnyMesh.getNumVertices(); j++) {
+		g_tipPos.push_back(g_bunnyMesh.getVertex(j).getPosition() + g_bunnyMesh.getVertex(j).getNormal() * g_furHeight);
+		g_tipVelocity.push_back(Cvec3(0));
+	}
+
+	shared_ptr<SimpleIndexedGeometryPN> bunnyGeometry = makeMeshGeometry(g_bunnyMesh);
+	reportVertexCache("bunny", bunnyGeometry->getVertexCacheReport());
+	g_bunnyGeometry = bunnyGeometry;
+
+	// decimated levels of detail for the bunny body; the fur shells stay
+	// with the full mesh
+	double radius = 0;
+	for (int i = 0; i < g_bunnyMesh.getNumVertices(); ++i)
+		radius = max(radius, norm(g_bunnyMesh.getVertex(i).getPosition()));
+	shared_ptr<LodGeometry> lods(new LodGeometry(radius));
+	lods->addLevel(g_bunnyGeometry, g_bunnyLods[0]);
+	for (int level = 1; level < NUM_BUNNY_LODS; ++level) {
+		Mesh decimated;
+		decimateMesh(g_bunnyMesh, decimated, g_bunnyMesh.getNumFaces() >> (2 * level));
+		computeVertexNormals(decimated);
+		shared_ptr<SimpleIndexedGeometryPN> geometry = makeMeshGeometry(decimated);
+		reportVertexCache("decimated bunny", geometry->getVertexCacheReport());
+		lods->addLevel(geometry, g_bunnyLods[level]);
+	}
+	g_flatScene.setLods(g_bunnyGeometry, lods);
+
+	// room for four updates, so that the GPU is long done with a span by
+	// the time it gets reused
+	const int shellBytes = g_bunnyMesh.getNumFaces() * 3 * sizeof(ShellVertex);
+	g_shellStream.reset(new StreamingBuffer(4 * shellBytes));
+	cerr << "Shell vertices stream through " << 4 * shellBytes / 1024 << " KB, "
+		<< (g_shellStream->isPersistent() ? "persistently mapped" : "mapped per update") << endl;
+
+	g_bunnyShellGeometry.reset(new StreamedGeometry(g_shellStream, ShellVertex::FORMAT));
+	g_bunnyShellGeometry->setNumInstances(g_numShells);
 }
 
 static void initGround() {
@@ -828,7 +1156,23 @@ static void initGround() {
 	vector<unsigned short> idx(ibLen);
 
 	makePlane(g_groundSize * 2, vtx.begin(), idx.begin());
-	g_ground.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vbLen, ibLen));
+	shared_ptr<SimpleIndexedGeometryPNTBX> ground(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vbLen, ibLen));
+	reportVertexCache("ground", ground->getVertexCacheReport());
+	g_ground = ground;
+}
+
+// Uploads vtx/idx in the packed vertex format when the context takes its
+// 2_10_10_10 normals, and in the float one otherwise.
+static shared_ptr<Geometry> makeIndexedGeometry(const char* name, const vector<VertexPNTBX>& vtx, const vector<unsigned short>& idx) {
+	if (isPackedNormalSupported()) {
+		vector<PackedVertexPNTBX> packed(vtx.begin(), vtx.end());
+		shared_ptr<SimpleIndexedGeometryPackedPNTBX> geometry(new SimpleIndexedGeometryPackedPNTBX(&packed[0], &idx[0], packed.size(), idx.size()));
+		reportVertexCache(name, geometry->getVertexCacheReport());
+		return geometry;
+	}
+	shared_ptr<SimpleIndexedGeometryPNTBX> geometry(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vtx.size(), idx.size()));
+	reportVertexCache(name, geometry->getVertexCacheReport());
+	return geometry;
 }
 
 static void initCubes() {
@@ -840,7 +1184,7 @@ static void initCubes() {
 	vector<unsigned short> idx(ibLen);
 
 	makeCube(1, vtx.begin(), idx.begin());
-	g_cube.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vbLen, ibLen));
+	g_cube = makeIndexedGeometry("cube", vtx, idx);
 }
 
 static void initSphere() {
@@ -851,7 +1195,17 @@ static void initSphere() {
 	vector<VertexPNTBX> vtx(vbLen);
 	vector<unsigned short> idx(ibLen);
 	makeSphere(1, 20, 10, vtx.begin(), idx.begin());
-	g_sphere.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vtx.size(), idx.size()));
+	g_sphere = makeIndexedGeometry("sphere", vtx, idx);
+
+	shared_ptr<LodGeometry> lods(new LodGeometry(1));
+	for (int i = 0; i < NUM_SPHERE_LODS; ++i) {
+		getSphereVbIbLen(g_sphereLods[i][0], g_sphereLods[i][1], vbLen, ibLen);
+		vtx.resize(vbLen);
+		idx.resize(ibLen);
+		makeSphere(1, g_sphereLods[i][0], g_sphereLods[i][1], vtx.begin(), idx.begin());
+		lods->addLevel(makeIndexedGeometry("sphere", vtx, idx), g_sphereLods[i][2]);
+	}
+	g_flatScene.setLods(g_sphere, lods);
 }
 
 static void initRobots() {
@@ -925,67 +1279,167 @@ static void updateArcballScale() {
 		g_arcballScale = getScreenToEyeScale(depth, g_frustFovY, g_windowHeight);
 }
 
-static void drawArcBall(Uniforms& uniforms) {
-	RigTForm arcballEye = inv(getPathAccumRbt(g_world, g_currentCameraNode)) * getArcballRbt();
-	Matrix4 MVM = rigTFormToMatrix(arcballEye) * Matrix4::makeScale(Cvec3(1, 1, 1) * g_arcballScale * g_arcballScreenRadius);
+static Matrix4 makeArcballMatrix(const RigTForm& invEyeRbt) {
+	RigTForm arcballEye = invEyeRbt * getArcballRbt();
+	return rigTFormToMatrix(arcballEye) * Matrix4::makeScale(Cvec3(1, 1, 1) * g_arcballScale * g_arcballScreenRadius);
+}
 
+static void drawArcBall(const Matrix4& MVM, Uniforms& uniforms) {
 	sendModelViewNormalMatrix(uniforms, MVM, normalMatrix(MVM));
 
 	g_arcballMat->draw(*g_sphere, uniforms);
 }
 
-static void drawStuff(bool picking) {
+// Whether a draw call uses `material', or (if !uses) does not
+struct UsesMaterial {
+	shared_ptr<Material> material;
+	bool uses;
 
-	if (g_shellNeedsUpdate)
-	{
-		updateShellGeometry();
+	bool operator()(const RenderItem& item) const {
+		return (item.material == material) == uses;
 	}
+};
+
+// Runs on the update thread: advances the weather and the sky, then publishes
+// a snapshot of the scene graph for the GLUT thread to draw. Must not make GL calls.
+static void updateFrame() {
+	PROFILE_ZONE("updateFrame");
+	SceneLock lock;
+	Stopwatch stopwatch;
+	const unsigned startChangeCount = getChangeCount();
 
 	drawRain(); 
 	drawSun();
 	drawClouds();
-	
-	// if we are not translating, update arcball scale
-	if (!(g_mouseMClickButton || (g_mouseLClickButton && g_mouseRClickButton) || (g_mouseLClickButton && !g_mouseRClickButton && g_spaceDown)))
-		updateArcballScale();
+	if (weather != SNOW)
+		g_snowCover->melt(.0001);
+	// squeeze out the holes left by this frame's removals before traversing
+	g_world->compactChildren();
+
+	FrameSnapshot& snapshot = g_snapshots.back();
+	snapshot.clear();
+	snapshot.updateMs = stopwatch.elapsedMs();
+	stopwatch.reset();
+
+	snapshot.clearColor = skyColor;
+	snapshot.timeOfDay = tick;
+	JobSystem *jobs = g_useJobSystem ? &getJobSystem() : NULL;
+	g_flatScene.update(g_world, jobs);
+	g_flatScene.setLodViewport(g_frustFovY, g_useLod ? g_windowHeight : 0);
+	snapshot.eyeRbt = g_flatScene.getWorldRbt(*g_currentCameraNode);
+	const RigTForm invEyeRbt = inv(snapshot.eyeRbt);
+
+	Cvec3 l1 = g_flatScene.getWorldRbt(*g_sun).getTranslation();
+	Cvec3 l2 = l1;
+	snapshot.uniforms.put("uLight", Cvec3(invEyeRbt * Cvec4(l1, 1)));
+	snapshot.uniforms.put("uLight2", Cvec3(invEyeRbt * Cvec4(l2, 1)));
 
-	Uniforms uniforms;
+	{
+		PROFILE_ZONE("buildSnapshot");
+		g_flatScene.buildSnapshot(invEyeRbt, snapshot, jobs);
+	}
 
-	// build & send proj. matrix to vshader
-	const Matrix4 projmat = makeProjectionMatrix();
-	sendProjectionMatrix(uniforms, projmat);
+	// tag the draw calls that get timed on the GPU separately
+	for (size_t i = 0; i < snapshot.items.size(); ++i) {
+		RenderItem& item = snapshot.items[i];
+		if (item.material == g_bumpFloorMat)
+			item.gpuPass = GPU_GROUND;
+		else if (item.material == g_bunnyShellMat)
+			item.gpuPass = GPU_SHELLS;
+	}
 
-	const RigTForm eyeRbt = getPathAccumRbt(g_world, g_currentCameraNode);
-	const RigTForm invEyeRbt = inv(eyeRbt);
+	// The opaque bunny goes first, as a depth prepass of sorts: whatever
+	// lies behind it fails the depth test before shading. The translucent
+	// shells go last, over everything opaque.
+	const UsesMaterial isBunny = { g_bunnyMat, true }, isNotShell = { g_bunnyShellMat, false };
+	stable_partition(snapshot.items.begin(), snapshot.items.end(), isBunny);
+	stable_partition(snapshot.items.begin(), snapshot.items.end(), isNotShell);
+	snapshot.snapshotMs = stopwatch.elapsedMs();
+	snapshot.changeCount = getChangeCount();
+	snapshot.updateChanged = snapshot.changeCount != startChangeCount;
+
+	g_snapshots.publish();
+}
 
-	Cvec3 l1 = getPathAccumRbt(g_world, g_sun).getTranslation();
-	Cvec3 l2 = getPathAccumRbt(g_world, g_sun).getTranslation();
-	uniforms.put("uLight", Cvec3(invEyeRbt * Cvec4(l1, 1)));
-	uniforms.put("uLight2", Cvec3(invEyeRbt * Cvec4(l2, 1)));
+// Steps the GPU particles and draws them. `viewMatrix' takes world to eye
+// coordinates.
+static void drawGpuParticles(Weather weather, float speed, float size, const Matrix4& viewMatrix, Uniforms& uniforms, GpuTimer *gpuTimer) {
+	PROFILE_ZONE("drawGpuParticles");
+	static Stopwatch stopwatch;
+	const float dt = min(stopwatch.elapsedMs() / 1000, .1);
+	stopwatch.reset();
 
+	if (gpuTimer)
+		gpuTimer->begin(GPU_PARTICLES);
 
-	if (!picking) {
-		Drawer drawer(invEyeRbt, uniforms);
-		g_world->accept(drawer);
+	// speeds used to be per frame at 60 fps
+	if (weather == SNOW)
+		g_gpuParticles->update(dt, 3 + 60 * speed, .5);
+	else
+		g_gpuParticles->update(dt, 30 + 60 * speed, .05);
 
-		if (g_displayArcball && shouldUseArcball())
-			drawArcBall(uniforms);
-	}
-	else {
-		Picker picker(invEyeRbt, uniforms);
+	sendModelViewNormalMatrix(uniforms, viewMatrix, normalMatrix(viewMatrix));
+	uniforms.put("uViewportHeight", float(g_windowHeight));
+	shared_ptr<Material> material = weather == SNOW ? g_snowParticleMat : g_rainParticleMat;
+	material->getUniforms().put("uPointSize", weather == SNOW ? 20 * size : 5 * size);
+	material->draw(*g_gpuParticles->getGeometry(), uniforms);
 
-		g_overridingMaterial = g_pickingMat;
-		g_world->accept(picker);
-		g_overridingMaterial.reset();
+	if (gpuTimer)
+		gpuTimer->end(GPU_PARTICLES);
+}
 
-		glFlush();
-		g_currentPickedRbtNode = picker.getRbtNodeAtXY(g_mouseClickX, g_mouseClickY);
-		if (g_currentPickedRbtNode == g_groundNode)
-			g_currentPickedRbtNode.reset(); // set to NULL
+static void drawStuff(const FrameSnapshot& snapshot) {
+	PROFILE_ZONE("drawStuff");
+	bool showArcball;
+	Matrix4 arcballMVM;
+	Weather particleWeather;
+	float particleSpeed, particleScale;
+	{
+		SceneLock lock;
+		particleWeather = weather;
+		particleSpeed = velocity;
+		particleScale = particleSize;
 
-		cout << (g_currentPickedRbtNode ? "Part picked" : "No part picked") << endl;
+		if (g_shellNeedsUpdate)
+		{
+			Stopwatch shellStopwatch;
+			updateShellGeometry();
+			g_frameStats.record(FrameStats::SHELLS, shellStopwatch.elapsedMs());
+		}
+
+		// if we are not translating, update arcball scale
+		if (!(g_mouseMClickButton || (g_mouseLClickButton && g_mouseRClickButton) || (g_mouseLClickButton && !g_mouseRClickButton && g_spaceDown)))
+			updateArcballScale();
 
+		showArcball = g_displayArcball && shouldUseArcball();
+		if (showArcball)
+			arcballMVM = makeArcballMatrix(inv(snapshot.eyeRbt));
 	}
+
+	Stopwatch stopwatch;
+	Uniforms uniforms(snapshot.uniforms);
+
+	// build & send proj. matrix to vshader
+	const Matrix4 projmat = makeProjectionMatrix();
+	sendProjectionMatrix(uniforms, projmat);
+
+	GpuTimer *gpuTimer = g_showGpuTimes ? g_gpuTimer.get() : NULL;
+	if (gpuTimer)
+		gpuTimer->begin(GPU_MAIN);
+
+	const int numTriangles = snapshot.submit(uniforms, gpuTimer);
+
+	if (g_gpuParticles && particleWeather != CLEAR)
+		drawGpuParticles(particleWeather, particleSpeed, particleScale, rigTFormToMatrix(inv(snapshot.eyeRbt)), uniforms, gpuTimer);
+
+	if (showArcball)
+		drawArcBall(arcballMVM, uniforms);
+
+	if (gpuTimer)
+		gpuTimer->end(GPU_MAIN);
+
+	g_frameStats.record(FrameStats::SUBMIT, stopwatch.elapsedMs());
+	g_frameStats.setNumDrawCalls(int(snapshot.items.size()), numTriangles);
 }
 
 void drawBitmapText(char *string, float x, float y, float z)
@@ -1010,16 +1464,173 @@ void drawBitmapText(string str, float x, float y, float z)
 	}
 }
 
+// Resident set size of the process in KB, or -1 if unknown on this platform
+static long getResidentMemoryKb() {
+#ifdef __linux__
+	long pages, residentPages;
+	ifstream f("/proc/self/statm");
+	if (f >> pages >> residentPages)
+		return residentPages * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+	return -1;
+}
+
+// Called once per frame while a soak test is running
+static void updateSoakTest() {
+	const double minutes = g_soakStopwatch.elapsedMs() / 60000;
+	if (minutes < g_soakReports + 1 && minutes < g_soakMinutes)
+		return;
+	++g_soakReports;
+
+	int numNodes;
+	{
+		SceneLock lock;
+		numNodes = g_world->getNumChildren();
+	}
+	cerr << "Soak " << int(minutes + .5) << " min: memory " << getResidentMemoryKb() << " KB, "
+		<< numNodes << " world nodes, snow coverage " << g_snowCover->getCoverage() * 100 << "%, ";
+	g_frameStats.print(cerr);
+
+	if (minutes >= g_soakMinutes) {
+		cerr << "Soak test done" << endl;
+		g_updateThread.stop();
+		exit(0);
+	}
+}
+
+// Draws the ids of the shapes within the rectangle into g_pickBuffer and
+// starts reading them back; resolvePick() picks the result up when it is
+// ready, without waiting for the GPU here
+static void pick(int x, int y, int width, int height) {
+	PROFILE_ZONE("pick");
+	SceneLock lock;
+
+	Uniforms uniforms;
+
+	// build & send proj. matrix to vshader
+	const Matrix4 projmat = makeProjectionMatrix();
+	sendProjectionMatrix(uniforms, projmat);
+
+	const RigTForm eyeRbt = getPathAccumRbt(g_world, g_currentCameraNode);
+	const RigTForm invEyeRbt = inv(eyeRbt);
+
+	// the picking shader would draw every shell layer at the root surface,
+	// which the bunny covers anyway
+	Picker picker(invEyeRbt, uniforms);
+	picker.skipShape(*g_bunnyShellNode);
+
+	GpuTimer *gpuTimer = g_showGpuTimes ? g_gpuTimer.get() : NULL;
+	if (gpuTimer)
+		gpuTimer->begin(GPU_PICK);
+
+	RenderStates().apply(); // for the depth clear, see display()
+	g_pickBuffer->begin(x, y, width, height);
+	g_overridingMaterial = g_pickingMat;
+	g_world->accept(picker);
+	g_overridingMaterial.reset();
+	g_pickBuffer->end(picker.getRbtNodes());
+
+	if (gpuTimer)
+		gpuTimer->end(GPU_PICK);
+
+	glFlush();
+	checkGlErrors();
+}
+
+// Takes the result of the last pick() once it has been read back: the node
+// with the most pixels becomes the one the arcball edits, and a box keeps
+// all of them in g_selectedRbtNodes
+static void resolvePick() {
+	vector<PickBuffer::Hit> hits;
+	if (!g_pickBuffer->poll(hits)) {
+		if (g_pickBuffer->isPending())
+			glutPostRedisplay(); // look again next frame
+		return;
+	}
+
+	SceneLock lock;
+	g_selectedRbtNodes.clear();
+	for (size_t i = 0; i < hits.size(); ++i) {
+		if (hits[i].node != g_groundNode)
+			g_selectedRbtNodes.push_back(hits[i].node);
+	}
+	if (g_selectedRbtNodes.empty())
+		g_currentPickedRbtNode.reset(); // set to NULL
+	else
+		g_currentPickedRbtNode = g_selectedRbtNodes[0];
+	markDirty(); // the arcball moves to the new part
+
+	if (g_pickingBox)
+		cout << g_selectedRbtNodes.size() << " parts selected" << (g_currentPickedRbtNode ? ", editing the largest" : "") << endl;
+	else
+		cout << (g_currentPickedRbtNode ? "Part picked" : "No part picked") << endl;
+}
+
 static void display() {
-	glClearColor;
+	Profiler::markFrame();
+	PROFILE_ZONE("display");
+
+	// pick up the latest snapshot published by the update thread, if any
+	const bool newSnapshot = g_snapshots.acquire();
+	if (newSnapshot) {
+		g_frameStats.record(FrameStats::UPDATE, g_snapshots.front().updateMs);
+		g_frameStats.record(FrameStats::SNAPSHOT, g_snapshots.front().snapshotMs);
+	}
+	const FrameSnapshot& snapshot = g_snapshots.front();
+
+	// the update thread works on the next frame while we submit this one, as
+	// long as the scene changed since the snapshot, or was still changing
+	// while it was built
+	g_updateRequested = !g_renderOnDemand || snapshot.updateChanged || snapshot.changeCount != getChangeCount();
+	if (g_updateRequested)
+		g_updateThread.requestFrame();
+
+	if (g_frameStats.getNumFrames() == 0)
+		cerr << "First frame after " << g_startupStopwatch.elapsedMs() << " ms, "
+			<< g_textureLoader->getNumPending() << " textures still loading" << endl;
+	{
+		PROFILE_ZONE("textureUploads");
+		g_textureLoader->update(g_textureUploadBudgetMs);
+	}
+	if (!g_startupTexturesReported && g_textureLoader->getNumPending() == 0) {
+		cerr << "Textures loaded after " << g_startupStopwatch.elapsedMs() << " ms" << endl;
+		g_startupTexturesReported = true;
+	}
+
+	resolvePick();
+
+	// the GPU particles move on their own, everything else marks itself dirty.
+	// An expose or partial uncover changes nothing of ours but leaves the
+	// window contents undefined, which GLUT reports as normal plane damage.
+	bool particlesMoving;
+	{
+		SceneLock lock;
+		particlesMoving = g_gpuParticles && weather != CLEAR;
+	}
+	const bool damaged = glutLayerGet(GLUT_NORMAL_DAMAGED) != 0;
+	g_lastFrameSkipped = g_renderOnDemand && !newSnapshot && !particlesMoving && !damaged &&
+		getChangeCount() == g_drawnChangeCount;
+	if (g_lastFrameSkipped) {
+		g_frameStats.skipFrame();
+		if (g_soakMinutes > 0)
+			updateSoakTest();
+		return;
+	}
+	g_drawnChangeCount = getChangeCount();
+
+	if (g_gpuTimer && g_showGpuTimes)
+		g_gpuTimer->beginFrame();
+
+	glClearColor(snapshot.clearColor[0], snapshot.clearColor[1], snapshot.clearColor[2], 0.);
+	RenderStates().apply(); // the depth mask also masks glClear, and the shells turn it off
  	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
- 	drawStuff(false);
+ 	drawStuff(snapshot);
 
  	glPushAttrib(GL_CURRENT_BIT);
  	glColor3f(1.0, 0.0, 0.0);
  	int tick_int;
- 	tick_int = (int (tick *1.9) + 12) % 24; 
+ 	tick_int = (int (snapshot.timeOfDay *1.9) + 12) % 24; 
  	char tickbuffer[100];
 
 	string tickstring = "Time:" + to_string(tick_int) + ":00";
@@ -1037,34 +1648,37 @@ static void display() {
 	 glDisable(GL_LIGHTING);
  	glColor3f(255.0f, 255.0f, 255.0f);
  	drawBitmapText(tickstring, g_windowWidth - 100, g_windowHeight - 25, 0);
+ 	if (g_gpuTimer && g_showGpuTimes) {
+ 		for (int i = 0; i < g_gpuTimer->getNumPasses(); ++i) {
+ 			ostringstream s;
+ 			s.setf(ios::fixed);
+ 			s.precision(2);
+ 			s << "GPU " << g_gpuTimer->getPassName(i) << ": ";
+ 			if (g_gpuTimer->getMs(i) < 0)
+ 				s << "-";
+ 			else
+ 				s << g_gpuTimer->getMs(i) << " ms";
+ 			drawBitmapText(s.str(), g_windowWidth - 300, g_windowHeight - 25 - 20 * i, 0);
+ 		}
+ 	}
  	glEnable(GL_LIGHTING);
  	glPopAttrib();
 
- 	glutSwapBuffers();
+ 	{
+ 		PROFILE_ZONE("swapBuffers");
+ 		glutSwapBuffers();
+ 	}
 
  	checkGlErrors();
- }
-
-static void pick() {
-	// We need to set the clear color to black, for pick rendering.
-	// so let's save the clear color
-	GLdouble clearColor[4];
-	glGetDoublev(GL_COLOR_CLEAR_VALUE, clearColor);
-
-	glClearColor(0, 0, 0, 0);
-
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	drawStuff(true);
-
-	// Uncomment below and comment out the glutPostRedisplay in mouse(...) call back
-	// to see result of the pick rendering pass
-	// glutSwapBuffers();
 
-	//Now set back the clear color
-	glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
-
-	checkGlErrors();
-}
+	g_frameStats.record(FrameStats::FRAME, g_frameStopwatch.elapsedMs());
+	g_frameStopwatch.reset();
+	g_frameStats.endFrame();
+	if (g_printFrameStats && g_frameStats.getNumFrames() % 120 == 0)
+		g_frameStats.print(cerr);
+	if (g_soakMinutes > 0)
+		updateSoakTest();
+ }
 
 bool interpolateAndDisplay(float t) {
 	if (t > g_animator.getNumKeyFrames() - 3)
@@ -1074,6 +1688,8 @@ bool interpolateAndDisplay(float t) {
 }
 
 static void animateTimerCallback(int ms) {
+	PROFILE_ZONE("animate");
+	SceneLock lock;
 	double t = (double)ms / g_msBetweenKeyFrames;
 	bool endReached = interpolateAndDisplay(t);
 	if (g_playingAnimation && !endReached) {
@@ -1096,10 +1712,21 @@ static void reshape(const int w, const int h) {
 	g_windowWidth = w;
 	g_windowHeight = h;
 	glViewport(0, 0, w, h);
+	if (g_pickBuffer)
+		g_pickBuffer->resize(w, h);
 	cerr << "Size of window is now " << w << "x" << h << endl;
 	g_arcballScreenRadius = max(1.0, min(h, w) * 0.25);
 	updateFrustFovY();
-	glutPostRedisplay();
+	markDirty();
+	redraw();
+}
+
+// Uncovering the window needs a redraw even if the scene did not change
+static void visibility(const int state) {
+	if (state == GLUT_VISIBLE) {
+		markDirty();
+		redraw();
+	}
 }
 
 static Cvec3 getArcballDirection(const Cvec2& p, const double r) {
@@ -1175,9 +1802,11 @@ static RigTForm makeMixedFrame(const RigTForm& objRbt, const RigTForm& eyeRbt) {
 //   => a M (A')^-1 O = l A' M (A')^-1 O
 
 static void motion(const int x, const int y) {
-	if (!g_mouseClickDown)
+	if (!g_mouseClickDown || g_pickDragging)
 		return;
 
+	SceneLock lock;
+
 	const double dx = x - g_mouseClickX;
 	const double dy = g_windowHeight - y - 1 - g_mouseClickY;
 
@@ -1205,10 +1834,12 @@ static void motion(const int x, const int y) {
 
 	g_mouseClickX += dx;
 	g_mouseClickY += dy;
-	glutPostRedisplay();  // we always redraw if we changed the scene
+	redraw();  // we always redraw if we changed the scene
 }
 
 static void mouse(const int button, const int state, const int x, const int y) {
+	SceneLock lock;
+
 	g_mouseClickX = x;
 	g_mouseClickY = g_windowHeight - y - 1;  // conversion from GLUT window-coordinate-system to OpenGL window-coordinate-system
 
@@ -1222,36 +1853,57 @@ static void mouse(const int button, const int state, const int x, const int y) {
 
 	g_mouseClickDown = g_mouseLClickButton || g_mouseRClickButton || g_mouseMClickButton;
 
+	// in picking mode, a click picks the part under the mouse and a drag
+	// selects the parts within the box, once the left button goes up
 	if (g_pickingMode && button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
-		pick();
+		g_pickDragging = true;
+		g_pickStartX = g_mouseClickX;
+		g_pickStartY = g_mouseClickY;
+	}
+	if (g_pickDragging && button == GLUT_LEFT_BUTTON && state == GLUT_UP) {
+		const int x0 = min(g_pickStartX, g_mouseClickX), y0 = min(g_pickStartY, g_mouseClickY);
+		const int width = abs(g_mouseClickX - g_pickStartX) + 1, height = abs(g_mouseClickY - g_pickStartY) + 1;
+		g_pickingBox = width > 2 || height > 2;
+		if (g_pickingBox)
+			pick(x0, y0, width, height);
+		else
+			pick(g_mouseClickX, g_mouseClickY, 1, 1);
+		g_pickDragging = false;
 		g_pickingMode = false;
 		cerr << "Picking mode is off" << endl;
-		glutPostRedisplay(); // request redisplay since the arcball will have moved
+		redraw(); // request redisplay since the arcball will have moved
 	}
-	glutPostRedisplay();
+	markDirty();
+	redraw();
 }
 
-static void keyboardUp(const unsigned char key, const int x, const int y) {
+static void keyboardUp(const unsigned char key, const int /*x*/, const int /*y*/) {
 	switch (key) {
 	case ' ':
 		g_spaceDown = false;
 		break;
 	}
-	glutPostRedisplay();
+	markDirty();
+	redraw();
 }
 
-static void keyboard(const unsigned char key, const int x, const int y) {
+static void keyboard(const unsigned char key, const int /*x*/, const int /*y*/) {
+	if (key == 27) {                            // ESC
+		g_updateThread.stop(); // must not hold the scene lock here
+		exit(0);
+	}
+
+	SceneLock lock;
+
 	switch (key) {
 	case ' ':
 		g_spaceDown = true;
 		break;
-	case 27:
-		exit(0);                                  // ESC
 	case 'h':
 		cout << " ============== H E L P ==============\n\n"
 			<< "h\t\thelp menu\n"
 			<< "s\t\tsave screenshot\n"
-			<< "p\t\tUse mouse to pick a part to edit\n"
+			<< "p\t\tUse mouse to pick a part to edit, or drag a box to select parts\n"
 			<< "v\t\tCycle view\n"
 			<< "drag left mouse to rotate\n"
 			<< "a\t\tToggle display arcball\n"
@@ -1264,6 +1916,17 @@ static void keyboard(const unsigned char key, const int x, const int y) {
 			<< ">\t\tGo to next frame\n"
 			<< "<\t\tGo to prev. frame\n"
 			<< "y\t\tPlay/Stop animation\n"
+			<< "f\t\tToggle printing frame time breakdown\n"
+			<< "j\t\tToggle running simulation on the job system\n"
+			<< "g\t\tToggle GPU pass timing overlay\n"
+			<< "o\t\tToggle the frame profiler\n"
+			<< "t\t\tWrite profiled frames to trace.json (chrome://tracing)\n"
+			<< "b\t\tToggle drawing distant clouds as impostors\n"
+			<< "e\t\tToggle sphere levels of detail\n"
+			<< "q\t\tPrint vertex buffer memory by vertex format\n"
+			<< "T\t\tPrint the texture cache and which materials use its textures\n"
+			<< "D\t\tToggle drawing only the frames where something changed\n"
+			<< "P\t\tPause/resume the time of day and the clouds\n"
 			<< endl;
 		break;
 	case 's':
@@ -1431,17 +2094,20 @@ static void keyboard(const unsigned char key, const int x, const int y) {
 	 case 'r': 
 	 	weather = Weather((weather + 1) % 3);
 	 	if (weather == RAIN) {
-	 		initParticles();
+	 		if (!g_gpuParticles)
+	 			initParticles();
 	 		cerr << "weather forecast is rainy\n" << endl;
 	 	}
 	 	else if (weather == SNOW) {
 	 		cerr << "weather forecast is snowy\n" << endl;
 	 	}
-	 	else {
+	 	else if (!g_gpuParticles) {
 	 		for (int i = 0; i < PARTICLES; i++) 
 	 			g_world->removeChild(particle_system[i].node);
 	 		cerr << "weather forecast is clear\n" << endl;
 	 	}
+	 	else
+	 		cerr << "weather forecast is clear\n" << endl;
 	 	break;
 	 case'z':
 	 	if (particleSize < .05)
@@ -1458,6 +2124,56 @@ static void keyboard(const unsigned char key, const int x, const int y) {
 	 		velocity += .01; 
 	 	cerr << "Velocity is " << velocity << endl; 
 	 	break; 
+	 case 'f':
+	 	g_printFrameStats = !g_printFrameStats;
+	 	cerr << "Frame stats printing is " << (g_printFrameStats ? "on" : "off") << endl;
+	 	break;
+	 case 'o':
+	 	Profiler::setEnabled(!Profiler::isEnabled());
+	 	cerr << "Profiler is " << (Profiler::isEnabled() ? "on" : "off") << endl;
+	 	break;
+	 case 't':
+	 	{
+	 		ofstream f("trace.json");
+	 		Profiler::writeChromeTrace(f, 120);
+	 		cerr << "Wrote the last 120 profiled frames to trace.json" << endl;
+	 	}
+	 	break;
+	 case 'g':
+	 	g_showGpuTimes = !g_showGpuTimes;
+	 	if (!g_gpuTimer)
+	 		cerr << "Timer queries not supported" << endl;
+	 	else
+	 		cerr << "GPU timing is " << (g_showGpuTimes ? "on" : "off") << endl;
+	 	break;
+	 case 'e':
+	 	g_useLod = !g_useLod;
+	 	cerr << "Levels of detail are " << (g_useLod ? "on" : "off") << endl;
+	 	break;
+	 case 'q':
+	 	printVertexMemory();
+	 	break;
+	 case 'T':
+	 	printTextureResidency();
+	 	break;
+	 case 'D':
+	 	g_renderOnDemand = !g_renderOnDemand;
+	 	cerr << "Rendering on demand is " << (g_renderOnDemand ? "on" : "off") << ", "
+	 		<< g_frameStats.getNumFrames() << " frames drawn, " << g_frameStats.getNumSkipped() << " skipped" << endl;
+	 	break;
+	 case 'P':
+	 	g_dayPaused = !g_dayPaused;
+	 	cerr << "Time of day is " << (g_dayPaused ? "paused" : "running") << endl;
+	 	break;
+	 case 'b':
+	 	g_useCloudImpostors = !g_useCloudImpostors;
+	 	cerr << "Cloud impostors are " << (g_useCloudImpostors ? "on" : "off") << endl;
+	 	break;
+	 case 'j':
+	 	g_useJobSystem = !g_useJobSystem;
+	 	cerr << "Job system is " << (g_useJobSystem ? "on" : "off")
+	 		<< " (" << getJobSystem().getNumThreads() << " threads)" << endl;
+	 	break;
 	 case 'l': 
 	 	if (velocity > 0.0)
 	 		velocity -= .01; 
@@ -1469,13 +2185,36 @@ static void keyboard(const unsigned char key, const int x, const int y) {
 	if (g_animator.getNumKeyFrames() > 0)
 		assert(g_animator.getNthKeyFrame(g_curKeyFrameNum) == g_curKeyFrame);
 
-	glutPostRedisplay();
+	// most keys change what is drawn in ways no setter sees (camera, overlays,
+	// weather), and a key press is rare enough to simply redraw
+	markDirty();
+	redraw();
+}
+
+static void snapshotPollTimerCallback(int) {
+	redraw();
 }
 
-void idle(void) {
+static void idle() {
+	// nothing was drawn last time: stop looking until redraw() is called
+	if (g_renderOnDemand && g_lastFrameSkipped) {
+		glutIdleFunc(NULL);
+		g_idleArmed = false;
+		if (g_updateRequested)
+			glutTimerFunc(g_snapshotPollMs, snapshotPollTimerCallback, 0);
+		return;
+	}
 	glutPostRedisplay();
 }
 
+// The update thread and the texture decoders change the scene without a
+// GLUT callback of their own, so look for their changes every now and then
+static void changePollTimerCallback(int) {
+	if (!g_idleArmed && (getChangeCount() != g_drawnChangeCount || g_textureLoader->getNumPending() > 0))
+		redraw();
+	glutTimerFunc(g_changePollMs, changePollTimerCallback, 0);
+}
+
 static void initGlutState(int argc, char * argv[]) {
 	glutInit(&argc, argv);                                  // initialize Glut based on cmd-line args
 #ifdef __MAC__
@@ -1489,11 +2228,13 @@ static void initGlutState(int argc, char * argv[]) {
 
 	glutDisplayFunc(display);                               // display rendering callback
 	glutReshapeFunc(reshape);                               // window reshape callback
+	glutVisibilityFunc(visibility);                         // window uncovered callback
 	glutMotionFunc(motion);                                 // mouse movement callback
 	glutMouseFunc(mouse);                                   // mouse click callback
 	glutKeyboardFunc(keyboard);
 	glutKeyboardUpFunc(keyboardUp);
 	glutIdleFunc(idle);	
+	glutTimerFunc(g_changePollMs, changePollTimerCallback, 0);
 }
 
 static void initGLState() {
@@ -1506,17 +2247,44 @@ static void initGLState() {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_GREATER);
 	glReadBuffer(GL_BACK);
-	if (!g_Gl2Compatible)
+	if (!g_Gl2Compatible) {
 		glEnable(GL_FRAMEBUFFER_SRGB);
+		glEnable(GL_PROGRAM_POINT_SIZE); // particle sprites set their own size
+	}
+
+	if (GpuTimer::isSupported()) {
+		static const char *passNames[NUM_GPU_PASSES] = { "main", "shells", "ground", "particles", "pick" };
+		g_gpuTimer.reset(new GpuTimer(vector<string>(passNames, passNames + NUM_GPU_PASSES)));
+	}
+	else
+		cerr << "Timer queries not supported, GPU times will not be shown" << endl;
+
+	// picking draws into it, like the pick shader this needs GL 3
+	g_pickBuffer.reset(new PickBuffer(g_windowWidth, g_windowHeight));
+}
+
+// The block compressed "<baseName>.dds" made by `make textures', if the GL
+// can sample it, and otherwise "<baseName>.ppm", from the texture cache
+static shared_ptr<Texture> loadCompressibleTexture(const string& baseName, bool srgb, const Cvec3f& placeholderColor) {
+	const shared_ptr<Texture> texture = g_textureCache->getCompressible(baseName, srgb, placeholderColor);
+	if (const CompressedTexture *compressed = dynamic_cast<const CompressedTexture*>(texture.get())) {
+		cerr << baseName << ".dds: " << (compressed->getResidentBytes() + 512) / 1024 << " KB compressed instead of "
+			<< (compressed->getUncompressedBytes() + 512) / 1024 << " KB" << endl;
+	}
+	return texture;
 }
 
 static void initMaterials() {
+	g_textureLoader.reset(new TextureLoader());
+	g_textureCache.reset(new TextureCache(g_textureLoader, g_textureBudgetBytes));
+
 #if EMBED_SOLUTION_GLSL
 	const char *NORMAL_GL3_FS =
 		"#version 150\n"
 		"\n"
 		"uniform sampler2D uTexColor;\n"
 		"uniform sampler2D uTexNormal;\n"
+		"uniform sampler2D uTexSnow; // depth of the snow lying on the ground\n"
 		"\n"
 		"// lights in eye space\n"
 		"uniform vec3 uLight;\n"
@@ -1529,9 +2297,19 @@ static void initMaterials() {
 		"out vec4 fragColor;\n"
 		"\n"
 		"void main() {\n"
-		"  vec3 normal = texture(uTexNormal, vTexCoord).xyz * 2.0 - 1.0;\n"
+		"  // snow hides the stones and their bumps, and has bumps of its own\n"
+		"  vec2 texel = 1.0 / vec2(textureSize(uTexSnow, 0));\n"
+		"  float coverage = smoothstep(0.0, 0.3, texture(uTexSnow, vTexCoord).r);\n"
+		"  vec3 snowNormal = normalize(vec3(\n"
+		"    texture(uTexSnow, vTexCoord - vec2(texel.x, 0.0)).r - texture(uTexSnow, vTexCoord + vec2(texel.x, 0.0)).r,\n"
+		"    texture(uTexSnow, vTexCoord - vec2(0.0, texel.y)).r - texture(uTexSnow, vTexCoord + vec2(0.0, texel.y)).r,\n"
+		"    0.1));\n"
 		"\n"
-		"  normal = normalize(vNTMat * normal);\n"
+		"  // z is reconstructed, as BC5 compressed normal maps only store x and y\n"
+		"  vec2 normalXY = texture(uTexNormal, vTexCoord).xy * 2.0 - 1.0;\n"
+		"  vec3 normal = vec3(normalXY, sqrt(max(0.0, 1.0 - dot(normalXY, normalXY))));\n"
+		"\n"
+		"  normal = normalize(vNTMat * mix(normal, snowNormal, coverage));\n"
 		"\n"
 		"  vec3 viewDir = normalize(-vEyePos);\n"
 		"  vec3 lightDir = normalize(uLight - vEyePos);\n"
@@ -1549,7 +2327,8 @@ static void initMaterials() {
 		"  specular += pow(rDotV, 32.0);\n"
 		"  diffuse += max(nDotL, 0.0);\n"
 		"\n"
-		"  vec3 color = texture(uTexColor, vTexCoord).xyz * diffuse + specular * vec3(0.6, 0.6, 0.6);\n"
+		"  vec3 albedo = mix(texture(uTexColor, vTexCoord).xyz, vec3(0.9, 0.92, 0.95), coverage);\n"
+		"  vec3 color = albedo * diffuse + specular * vec3(0.6, 0.6, 0.6) * (1.0 - coverage);\n"
 		"\n"
 		"  fragColor = vec4(color, 1);\n"
 		"}\n";
@@ -1557,6 +2336,7 @@ static void initMaterials() {
 	const char *NORMAL_GL2_FS =
 		"uniform sampler2D uTexColor;\n"
 		"uniform sampler2D uTexNormal;\n"
+		"uniform sampler2D uTexSnow; // depth of the snow lying on the ground\n"
 		"\n"
 		"// lights in eye space\n"
 		"uniform vec3 uLight;\n"
@@ -1567,9 +2347,11 @@ static void initMaterials() {
 		"varying vec3 vEyePos;\n"
 		"\n"
 		"void main() {\n"
-		"  vec3 normal = texture2D(uTexNormal, vTexCoord).xyz * 2.0 - 1.0;\n"
+		"  float coverage = smoothstep(0.0, 0.3, texture2D(uTexSnow, vTexCoord).r);\n"
+		"  vec2 normalXY = texture2D(uTexNormal, vTexCoord).xy * 2.0 - 1.0;\n"
+		"  vec3 normal = vec3(normalXY, sqrt(max(0.0, 1.0 - dot(normalXY, normalXY))));\n"
 		"\n"
-		"  normal = normalize(vNTMat * normal);\n"
+		"  normal = normalize(vNTMat * mix(normal, vec3(0.0, 0.0, 1.0), coverage));\n"
 		"\n"
 		"  vec3 viewDir = normalize(-vEyePos);\n"
 		"  vec3 lightDir = normalize(uLight - vEyePos);\n"
@@ -1587,7 +2369,8 @@ static void initMaterials() {
 		"  specular += pow(rDotV, 32.0);\n"
 		"  diffuse += max(nDotL, 0.0);\n"
 		"\n"
-		"  vec3 color = texture2D(uTexColor, vTexCoord).xyz * diffuse + specular * vec3(0.6, 0.6, 0.6);\n"
+		"  vec3 albedo = mix(texture2D(uTexColor, vTexCoord).xyz, vec3(0.9, 0.92, 0.95), coverage);\n"
+		"  vec3 color = albedo * diffuse + specular * vec3(0.6, 0.6, 0.6) * (1.0 - coverage);\n"
 		"  gl_FragColor = vec4(color, 1);\n"
 		"}\n";
 	Material::addInlineSource("./shaders/normal-gl3.fshader", strlen(NORMAL_GL3_FS), NORMAL_GL3_FS);
@@ -1616,8 +2399,10 @@ static void initMaterials() {
 
 	// normal mapping
 	g_bumpFloorMat.reset(new Material("./shaders/normal-gl3.vshader", "./shaders/normal-gl3.fshader"));
-	g_bumpFloorMat->getUniforms().put("uTexColor", shared_ptr<ImageTexture>(new ImageTexture("Fieldstone.ppm", true)));
-	g_bumpFloorMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("FieldstoneNormal.ppm", false)));
+	g_bumpFloorMat->getUniforms().put("uTexColor", loadCompressibleTexture("Fieldstone", true, Cvec3f(.5f, .45f, .4f)));
+	g_bumpFloorMat->getUniforms().put("uTexNormal", loadCompressibleTexture("FieldstoneNormal", false, Cvec3f(.5f, .5f, 1))); // flat
+	g_snowCover.reset(new SnowCover(g_groundSize));
+	g_bumpFloorMat->getUniforms().put("uTexSnow", shared_ptr<Texture>(g_snowCover));
 
 	// copy solid prototype, and set to wireframed rendering
 	g_arcballMat.reset(new Material(solid));
@@ -1631,6 +2416,22 @@ static void initMaterials() {
 	g_stormMat.reset(new Material(solid));
 	g_stormMat->getUniforms().put("uColor", Cvec3f(.8, .8, .8));
 
+	// GPU rain and snow, drawn as blended point sprites
+	if (ParticleSystem::isSupported()) {
+		Material particle("./shaders/particle-gl3.vshader", "./shaders/particle-gl3.fshader");
+		particle.getRenderStates()
+			.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)
+			.enable(GL_BLEND);
+
+		g_snowParticleMat.reset(new Material(particle));
+		g_snowParticleMat->getUniforms().put("uColor", Cvec3f(1, 1, 1));
+		g_snowParticleMat->getUniforms().put("uStretch", 1.f);
+
+		g_rainParticleMat.reset(new Material(particle));
+		g_rainParticleMat->getUniforms().put("uColor", Cvec3f(.6, .7, 1));
+		g_rainParticleMat->getUniforms().put("uStretch", 6.f);
+	}
+
 	// pick shader
 	g_pickingMat.reset(new Material("./shaders/basic-gl3.vshader", "./shaders/pick-gl3.fshader"));
 
@@ -1643,33 +2444,93 @@ static void initMaterials() {
 		.put("uColorDiffuse", Cvec3f(0.2f, 0.2f, 0.2f));
 
 	// bunny shell materials;
-	shared_ptr<ImageTexture> shellTexture(new ImageTexture("shell.ppm", false)); // common shell texture
-
-																				 // needs to enable repeating of texture coordinates
-	shellTexture->bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-	// eachy layer of the shell uses a different material, though the materials will share the
-	// same shader files and some common uniforms. hence we create a prototype here, and will
-	// copy from the prototype later
-	Material bunnyShellMatPrototype("./shaders/bunny-shell-gl3.vshader", "./shaders/bunny-shell-gl3.fshader");
-	bunnyShellMatPrototype.getUniforms().put("uTexShell", shellTexture);
-	bunnyShellMatPrototype.getRenderStates()
+	// common shell texture, repeating, and no fur until it is loaded
+	shared_ptr<AsyncTexture> shellTexture = g_textureCache->get("shell.ppm", false,
+		TextureSampler(GL_LINEAR, GL_LINEAR, GL_REPEAT), Cvec3f(0, 0, 0));
+
+	// all layers are drawn in one instanced call, innermost first, which is
+	// back to front wherever the fur faces the eye. The fragment shader
+	// discards nearly clear texels, and the ones left write depth, so the
+	// inner layers hide the fur behind them and most of the fragments in
+	// the outer layers fail the depth test before they are shaded. The far
+	// side of the shells is culled, as it is only ever seen through fur.
+	g_bunnyShellMat.reset(new Material("./shaders/bunny-shell-gl3.vshader", "./shaders/bunny-shell-gl3.fshader"));
+	g_bunnyShellMat->getUniforms()
+		.put("uTexShell", shellTexture)
+		.put("uNumShells", g_numShells)
+		.put("uShellSpacing", float(g_furHeight / g_numShells));
+	g_bunnyShellMat->getRenderStates()
 		.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) // set blending mode
-		.enable(GL_BLEND) // enable blending
-		.disable(GL_CULL_FACE); // disable culling
+		.enable(GL_BLEND); // enable blending
+};
 
-								// allocate array of materials
-	g_bunnyShellMats.resize(g_numShells);
-	for (int i = 0; i < g_numShells; ++i) {
-		g_bunnyShellMats[i].reset(new Material(bunnyShellMatPrototype)); // copy from the prototype
-																		 // but set a different exponent for blending transparency
-		g_bunnyShellMats[i]->getUniforms().put("uAlphaExponent", 2.f + 5.f * float(i + 1) / g_numShells);
+static void initGpuParticles() {
+	if (!ParticleSystem::isSupported()) {
+		cerr << "Transform feedback not supported, simulating particles on the CPU" << endl;
+		return;
 	}
+	g_gpuParticles.reset(new ParticleSystem(g_numGpuParticles, g_groundSize, g_groundY, 20));
+}
 
-};
+// Renders the cloud impostor atlas. Must be called after initMaterials and
+// initSphere, before initClouds uses the cloud impostor materials.
+static void initCloudImpostors() {
+	// a camera facing quad, [-1, 1]^2 in x and y
+	VertexPNX quad[6] = {
+		VertexPNX(Cvec3(-1, -1, 0), Cvec3(0, 0, 1), Cvec2(0, 0)),
+		VertexPNX(Cvec3( 1, -1, 0), Cvec3(0, 0, 1), Cvec2(1, 0)),
+		VertexPNX(Cvec3( 1,  1, 0), Cvec3(0, 0, 1), Cvec2(1, 1)),
+		VertexPNX(Cvec3(-1, -1, 0), Cvec3(0, 0, 1), Cvec2(0, 0)),
+		VertexPNX(Cvec3( 1,  1, 0), Cvec3(0, 0, 1), Cvec2(1, 1)),
+		VertexPNX(Cvec3(-1,  1, 0), Cvec3(0, 0, 1), Cvec2(0, 1)),
+	};
+	g_impostorQuad.reset(new SimpleGeometryPNX(quad, 6));
+
+	g_cloudAtlas.reset(new ImpostorAtlas(128, CLOUD_VIEWS, CLOUD_BLOATS));
+
+	// orthographic projection of the impostor quad onto the tile
+	Matrix4 projMatrix;
+	projMatrix(0, 0) = projMatrix(1, 1) = 1 / CLOUD_IMPOSTOR_SIZE;
+	projMatrix(2, 2) = -1 / CLOUD_IMPOSTOR_SIZE;
+
+	// the clouds are drawn with a flat color, so a white silhouette is all
+	// the impostor needs; it gets tinted when drawn
+	Material white("./shaders/basic-gl3.vshader", "./shaders/solid-gl3.fshader");
+	white.getUniforms().put("uColor", Cvec3f(1, 1, 1));
+
+	glDisable(GL_DEPTH_TEST);
+	for (int row = 0; row < CLOUD_BLOATS; ++row) {
+		const double bloat = 1 + double(row) / (CLOUD_BLOATS - 1);
+		for (int col = 0; col < CLOUD_VIEWS; ++col) {
+			// looking at the cloud from direction (sin a, 0, cos a)
+			const double angle = 360.0 * col / CLOUD_VIEWS;
+			const Matrix4 viewMatrix = Matrix4::makeYRotation(-angle) * Matrix4::makeTranslation(Cvec3(-g_cloudCenterX, 0, 0));
+
+			g_cloudAtlas->beginTile(col, row);
+			Uniforms uniforms;
+			sendProjectionMatrix(uniforms, projMatrix);
+			for (int j = 0; j < 4; ++j) {
+				const double scale = g_cloudBallScale[j] * bloat;
+				const Matrix4 MVM = viewMatrix * Matrix4::makeTranslation(Cvec3(g_cloudBallX[j], 0, 0)) * Matrix4::makeScale(Cvec3(scale, scale, scale));
+				sendModelViewNormalMatrix(uniforms, MVM, normalMatrix(MVM));
+				white.draw(*g_sphere, uniforms);
+			}
+			g_cloudAtlas->endTile(g_windowWidth, g_windowHeight);
+		}
+	}
+	glEnable(GL_DEPTH_TEST);
+
+	Material impostor("./shaders/impostor-gl3.vshader", "./shaders/impostor-gl3.fshader");
+	impostor.getUniforms().put("uTexAtlas", shared_ptr<Texture>(g_cloudAtlas));
+	for (int k = 0; k < 2; ++k) {
+		for (int i = 0; i < CLOUD_VIEWS * CLOUD_BLOATS; ++i) {
+			g_cloudImpostorMats[k][i].reset(new Material(impostor));
+			g_cloudImpostorMats[k][i]->getUniforms()
+				.put("uColor", k == 0 ? Cvec3f(1, 1, 1) : Cvec3f(.8, .8, .8))
+				.put("uTileRect", g_cloudAtlas->getTileRect(i % CLOUD_VIEWS, i / CLOUD_VIEWS));
+		}
+	}
+}
 
 static void initGeometry() {
 	initGround();
@@ -1677,6 +2538,11 @@ static void initGeometry() {
 	initSphere();
 	initRobots();
 	initBunnyMeshes();
+	initGpuParticles();
+	initCloudImpostors();
+
+	cerr << "Vertex cache in total: " << g_vertexCacheTotals.numTriangles << " triangles, ACMR "
+		<< g_vertexCacheTotals.acmrBefore << " -> " << g_vertexCacheTotals.acmrAfter << endl;
 }
 
 static void constructRobot(shared_ptr<SgTransformNode> base, shared_ptr<Material> material) {
@@ -1697,7 +2563,7 @@ static void constructRobot(shared_ptr<SgTransformNode> base, shared_ptr<Material
 	};
 
 	JointDesc jointDesc[NUM_JOINTS] = {
-		{ -1 }, // torso
+		{ -1, 0, 0, 0 }, // torso
 		{ 0,  TORSO_WIDTH / 2, TORSO_LEN / 2, 0 }, // upper right arm
 		{ 0, -TORSO_WIDTH / 2, TORSO_LEN / 2, 0 }, // upper left arm
 		{ 1,  ARM_LEN, 0, 0 }, // lower right arm
@@ -1767,11 +2633,9 @@ static void initScene() {
 	g_bunnyNode->addChild(shared_ptr<MyShapeNode>(
 		new MyShapeNode(g_bunnyGeometry, g_bunnyMat)));
 
-	// add each shell as shape node
-	for (int i = 0; i < g_numShells; ++i) {
-		g_bunnyNode->addChild(shared_ptr<MyShapeNode>(
-			new MyShapeNode(g_bunnyShellGeometries[i], g_bunnyShellMats[i])));
-	}
+	// add the shells as one shape node, drawing all layers
+	g_bunnyShellNode.reset(new MyShapeNode(g_bunnyShellGeometry, g_bunnyShellMat));
+	g_bunnyNode->addChild(g_bunnyShellNode);
 
 	g_robot1Node.reset(new SgRbtNode(RigTForm(Cvec3(-2, 1, 0))));
 	g_robot2Node.reset(new SgRbtNode(RigTForm(Cvec3(2, 1, 0))));
@@ -1809,10 +2673,489 @@ static void initAnimation() {
 	g_curKeyFrame = g_animator.keyFramesBegin();
 }
 
+// Decimates the bunny after Catmull-Clark subdividing it numSubdivisions
+// times, and reports how long it took and how far the result is from the
+// input. Run with --bench-decimate <n>; needs no GL context.
+static void benchDecimation(int numSubdivisions) {
+	Mesh mesh;
+	mesh.load("bunny.mesh");
+	const int numOriginalFaces = mesh.getNumFaces();
+	Stopwatch stopwatch;
+	for (int i = 0; i < numSubdivisions; ++i)
+		subdivideCatmullClark(mesh);
+	cerr << "Subdivided the bunny " << numSubdivisions << " times in " << stopwatch.elapsedMs() << " ms" << endl;
+
+	// down to a tenth of the triangles, and back to the size of the original bunny
+	const int targets[2] = { mesh.getNumFaces() * 2 / 10, numOriginalFaces };
+	for (int i = 0; i < 2; ++i) {
+		Mesh decimated;
+		const DecimationReport report = decimateMesh(mesh, decimated, targets[i]);
+		stopwatch.reset();
+		const MeshDistance distance = measureMeshDistance(mesh, decimated);
+		cerr << report.numFacesBefore << " faces, " << report.numVerticesBefore << " vertices -> "
+			<< report.numFacesAfter << " triangles, " << report.numVerticesAfter << " vertices in " << report.ms << " ms\n"
+			<< "  max quadric error " << report.maxError
+			<< ", distance max " << distance.maxDistance << " mean " << distance.meanDistance
+			<< " (measured in " << stopwatch.elapsedMs() << " ms)" << endl;
+	}
+}
+
+// Times adding and removing children of a root with numChildren children,
+// against the std::find + vector::erase scheme SgTransformNode used to have.
+// Run with --bench-children <n>; needs no GL context.
+static void benchChildChurn(int numChildren) {
+	const int numRounds = 100, churnPerRound = 1000;
+
+	vector<shared_ptr<SgNode> > nodes(numChildren);
+	for (int i = 0; i < numChildren; ++i)
+		nodes[i].reset(new SgRbtNode());
+
+	shared_ptr<SgRootNode> root(new SgRootNode());
+	root->addChildren(nodes);
+	vector<shared_ptr<SgNode> > flat(nodes);
+
+	vector<int> victims(churnPerRound);
+	double graphMs = 0, flatMs = 0, numOps = 0;
+	for (int round = 0; round < numRounds; ++round) {
+		for (int i = 0; i < churnPerRound; ++i)
+			victims[i] = rand() % numChildren;
+		sort(victims.begin(), victims.end());
+		victims.erase(unique(victims.begin(), victims.end()), victims.end());
+
+		Stopwatch stopwatch;
+		for (size_t i = 0; i < victims.size(); ++i)
+			root->removeChild(nodes[victims[i]]);
+		for (size_t i = 0; i < victims.size(); ++i)
+			root->addChild(nodes[victims[i]]);
+		root->compactChildren();
+		graphMs += stopwatch.elapsedMs();
+
+		stopwatch.reset();
+		for (size_t i = 0; i < victims.size(); ++i)
+			flat.erase(find(flat.begin(), flat.end(), nodes[victims[i]]));
+		for (size_t i = 0; i < victims.size(); ++i)
+			flat.push_back(nodes[victims[i]]);
+		flatMs += stopwatch.elapsedMs();
+		numOps += 2 * victims.size();
+		victims.resize(churnPerRound);
+	}
+
+	cerr << "Child churn on " << numChildren << " children, " << numOps << " adds/removes:\n"
+		<< "  SgTransformNode   " << graphMs << " ms (" << graphMs * 1e6 / numOps << " ns/op)\n"
+		<< "  find + erase      " << flatMs << " ms (" << flatMs * 1e6 / numOps << " ns/op)" << endl;
+}
+
+// Times building a frame snapshot of a scene of about numNodes nodes with
+// the SnapshotBuilder visitor and with FlatSceneGraph, serially and on the
+// job system. Run with --bench-traversal <n>; needs no GL context.
+static void benchTraversal(int numNodes) {
+	const int numFrames = 20, numJoints = 10;
+
+	// articulated "robots": chains of numJoints joints with one shape each
+	shared_ptr<SgRootNode> root(new SgRootNode());
+	for (int i = 0; i < numNodes / (2 * numJoints); ++i) {
+		shared_ptr<SgTransformNode> parent = root;
+		for (int j = 0; j < numJoints; ++j) {
+			shared_ptr<SgRbtNode> joint(new SgRbtNode(j == 0 ? RigTForm(Cvec3(i % 100, 0, i / 100)) : RigTForm(Cvec3(0, 1, 0), Quat::makeXRotation(10))));
+			joint->addChild(shared_ptr<MyShapeNode>(new MyShapeNode(shared_ptr<Geometry>(), shared_ptr<Material>(), Cvec3(0, .5, 0))));
+			parent->addChild(joint);
+			parent = joint;
+		}
+	}
+
+	const RigTForm invEyeRbt = inv(RigTForm(Cvec3(0, 0, 10)));
+	FrameSnapshot snapshot;
+
+	Stopwatch stopwatch;
+	for (int i = 0; i < numFrames; ++i) {
+		snapshot.clear();
+		SnapshotBuilder builder(invEyeRbt, snapshot);
+		root->accept(builder);
+	}
+	const double visitorMs = stopwatch.elapsedMs() / numFrames;
+
+	FlatSceneGraph flatScene;
+	stopwatch.reset();
+	flatScene.update(root);
+	const double compileMs = stopwatch.elapsedMs();
+
+	double flatMs[2];
+	for (int k = 0; k < 2; ++k) {
+		JobSystem *jobs = k == 0 ? NULL : &getJobSystem();
+		stopwatch.reset();
+		for (int i = 0; i < numFrames; ++i) {
+			snapshot.clear();
+			flatScene.update(root, jobs);
+			flatScene.buildSnapshot(invEyeRbt, snapshot, jobs);
+		}
+		flatMs[k] = stopwatch.elapsedMs() / numFrames;
+	}
+
+	cerr << "Snapshot of " << flatScene.getNumTransformNodes() << " transform and "
+		<< flatScene.getNumShapeNodes() << " shape nodes, per frame:\n"
+		<< "  SnapshotBuilder            " << visitorMs << " ms\n"
+		<< "  FlatSceneGraph             " << flatMs[0] << " ms (compiling once " << compileMs << " ms)\n"
+		<< "  FlatSceneGraph, " << getJobSystem().getNumThreads() << " threads " << flatMs[1] << " ms" << endl;
+}
+
+// Stands in for the GL geometry in benchmarks run without a GL context:
+// draws nothing, but knows how many triangles the real one submits.
+class CountedGeometry : public Geometry {
+public:
+	explicit CountedGeometry(int numTriangles) : numTriangles_(numTriangles) {}
+
+	virtual const vector<string>& getVertexAttribNames() {
+		static const vector<string> names;
+		return names;
+	}
+
+	virtual void draw(int* /*attribIndices*/) {}
+
+	virtual int getNumTriangles() {
+		return numTriangles_;
+	}
+
+private:
+	int numTriangles_;
+};
+
+// Triangles submitted by a snapshot of g_world, with levels of detail
+// picked for screenHeight (off if 0)
+static int countSnapshotTriangles(FlatSceneGraph& flatScene, int screenHeight) {
+	flatScene.setLodViewport(g_frustFovY, screenHeight);
+	flatScene.update(g_world);
+	FrameSnapshot snapshot;
+	flatScene.buildSnapshot(inv(getPathAccumRbt(g_world, g_currentCameraNode)), snapshot);
+	int numTriangles = 0;
+	for (size_t i = 0; i < snapshot.items.size(); ++i) {
+		if (snapshot.items[i].geometry)
+			numTriangles += snapshot.items[i].geometry->getNumTriangles();
+	}
+	return numTriangles;
+}
+
+// Counts the triangles a frame of the initial scene submits, seen from the
+// sky camera at the default window size, with levels of detail on and off:
+// once with the sky clear and once after numRainSteps updates of CPU rain.
+// Run with --bench-lod <numRainSteps>; needs no GL context.
+static void benchLod(int numRainSteps) {
+	int ibLen, vbLen;
+	FlatSceneGraph flatScene;
+
+	getPlaneVbIbLen(vbLen, ibLen);
+	g_ground.reset(new CountedGeometry(ibLen / 3));
+	getCubeVbIbLen(vbLen, ibLen);
+	g_cube.reset(new CountedGeometry(ibLen / 3));
+	getSphereVbIbLen(20, 10, vbLen, ibLen);
+	g_sphere.reset(new CountedGeometry(ibLen / 3));
+	g_impostorQuad.reset(new CountedGeometry(2));
+
+	shared_ptr<LodGeometry> sphereLods(new LodGeometry(1));
+	for (int i = 0; i < NUM_SPHERE_LODS; ++i) {
+		getSphereVbIbLen(g_sphereLods[i][0], g_sphereLods[i][1], vbLen, ibLen);
+		sphereLods->addLevel(shared_ptr<Geometry>(new CountedGeometry(ibLen / 3)), g_sphereLods[i][2]);
+	}
+	flatScene.setLods(g_sphere, sphereLods);
+
+	g_bunnyMesh.load("bunny.mesh");
+	double radius = 0;
+	for (int i = 0; i < g_bunnyMesh.getNumVertices(); ++i)
+		radius = max(radius, norm(g_bunnyMesh.getVertex(i).getPosition()));
+	g_bunnyGeometry.reset(new CountedGeometry(g_bunnyMesh.getNumFaces()));
+	shared_ptr<LodGeometry> bunnyLods(new LodGeometry(radius));
+	bunnyLods->addLevel(g_bunnyGeometry, g_bunnyLods[0]);
+	for (int level = 1; level < NUM_BUNNY_LODS; ++level) {
+		Mesh decimated;
+		const DecimationReport report = decimateMesh(g_bunnyMesh, decimated, g_bunnyMesh.getNumFaces() >> (2 * level));
+		bunnyLods->addLevel(shared_ptr<Geometry>(new CountedGeometry(report.numFacesAfter)), g_bunnyLods[level]);
+	}
+	flatScene.setLods(g_bunnyGeometry, bunnyLods);
+
+	// the shells are streamed, so their node is left without geometry
+	const int numShellTriangles = g_bunnyMesh.getNumFaces() * g_numShells;
+
+	initScene();
+	for (int i = 0; i < PARTICLES; i++)
+		initParticle(i);
+	initClouds();
+	drawClouds();
+
+	cerr << "Triangles per frame at " << g_windowWidth << "x" << g_windowHeight
+		<< " (fur shells " << numShellTriangles << " of them):\n";
+	for (int k = 0; k < 2; ++k) {
+		if (k == 1) {
+			weather = RAIN;
+			for (int i = 0; i < numRainSteps; ++i)
+				drawRain();
+		}
+		const int withLod = countSnapshotTriangles(flatScene, g_windowHeight) + numShellTriangles;
+		const int withoutLod = countSnapshotTriangles(flatScene, 0) + numShellTriangles;
+		cerr << (k == 0 ? "  clear" : "  rain ") << " LOD on " << withLod << ", off " << withoutLod
+			<< " (" << 100. * withLod / withoutLod << "%), " << flatScene.getNumShapeNodes() << " shapes" << endl;
+	}
+}
+
+// Times decoding the textures the program loads, P6 (Fieldstone.ppm) and
+// P3 (shell.ppm), reading every pixel the way an upload would, and reports
+// the throughput in MB of file read per second. Run with --bench-ppm
+// <rounds>; needs no GL context.
+static void benchPpm(int numRounds) {
+	const char *fileNames[2] = { "Fieldstone.ppm", "shell.ppm" };
+	for (int i = 0; i < 2; ++i) {
+		size_t fileSize = 0;
+		unsigned checksum = 0;
+		Stopwatch stopwatch;
+		for (int round = 0; round < numRounds; ++round) {
+			const PpmImage image(fileNames[i]);
+			for (int row = 0; row < image.getHeight(); ++row) {
+				const unsigned char *p = image.getRow(row);
+				for (int j = 0; j < image.getRowSize(); ++j)
+					checksum += p[j];
+			}
+			fileSize = MappedFile(fileNames[i]).getSize();
+		}
+		const double ms = stopwatch.elapsedMs();
+		cerr << fileNames[i] << ": " << numRounds << " x " << fileSize / 1024 << " KB in " << ms << " ms, "
+			<< fileSize * numRounds / (ms * 1e3) << " MB/s (checksum " << checksum << ")" << endl;
+	}
+}
+
+// Times building the mip chain of Fieldstone.ppm serially and on the job
+// system, and writing and reading it as a cache file. Run with --bench-mips
+// <rounds>; needs no GL context.
+static void benchMipChain(int numRounds) {
+	const PpmImage image("Fieldstone.ppm");
+	double buildMs[2];
+	for (int k = 0; k < 2; ++k) {
+		Stopwatch stopwatch;
+		for (int i = 0; i < numRounds; ++i)
+			MipChain mips(image, true, k == 0 ? NULL : &getJobSystem());
+		buildMs[k] = stopwatch.elapsedMs() / numRounds;
+	}
+
+	const MipChain mips(image, true, &getJobSystem());
+	Stopwatch stopwatch;
+	const bool saved = mips.saveCached("bench.mips", "Fieldstone.ppm");
+	const double saveMs = stopwatch.elapsedMs();
+	stopwatch.reset();
+	for (int i = 0; i < numRounds; ++i)
+		MipChain::loadCached("bench.mips", "Fieldstone.ppm", true);
+	const double loadMs = stopwatch.elapsedMs() / numRounds;
+	remove("bench.mips");
+
+	cerr << "Mip chain of Fieldstone.ppm, " << mips.getNumLevels() << " levels:\n"
+		<< "  built serially          " << buildMs[0] << " ms\n"
+		<< "  built on " << getJobSystem().getNumThreads() << " threads       " << buildMs[1] << " ms\n"
+		<< "  cache file written in   " << saveMs << " ms" << (saved ? "" : " (failed)") << "\n"
+		<< "  cache file mapped in    " << loadMs << " ms" << endl;
+}
+
+// Times what the traversals do per shape node, composing the rigid
+// transforms and getting the model view and normal matrices, both in
+// general (with an inverse) and the way SgGeometryShapeNode does it, along
+// with the math kernels on their own. Compare builds with and without
+// -DCS175_MATH_SCALAR (and with AVX=1). Run with --bench-transforms <n>;
+// needs no GL context.
+static void benchTransforms(int numNodes) {
+	const int numRounds = 20;
+	vector<RigTForm> rbts(numNodes);
+	vector<shared_ptr<MyShapeNode> > shapes(numNodes);
+	vector<Matrix4> affines(numNodes);
+	for (int i = 0; i < numNodes; ++i) {
+		rbts[i] = RigTForm(Cvec3(i % 7, i % 5, i % 3), Quat::makeXRotation(i) * Quat::makeYRotation(2 * i));
+		shapes[i].reset(new MyShapeNode(shared_ptr<Geometry>(), shared_ptr<Material>(), Cvec3(0, .5, 0), Cvec3(i % 90, 0, 0), Cvec3(1 + i % 3, 1, 1)));
+		affines[i] = shapes[i]->getAffineMatrix();
+	}
+	const RigTForm parent = inv(RigTForm(Cvec3(0, 0, 10), Quat::makeZRotation(30)));
+
+	double generalNs, nodeNs, matrixNs, composeNs, quatNs, rotateNs, checksum = 0;
+	Stopwatch stopwatch;
+	for (int round = 0; round < numRounds; ++round) {
+		for (int i = 0; i < numNodes; ++i) {
+			const Matrix4 MVM = rigTFormToMatrix(parent * rbts[i]) * affines[i];
+			const Matrix4 NMVM = normalMatrix(MVM);
+			checksum += MVM(0, 3) + NMVM(1, 1);
+		}
+	}
+	generalNs = stopwatch.elapsedMs() * 1e6 / (numRounds * numNodes);
+
+	stopwatch.reset();
+	for (int round = 0; round < numRounds; ++round) {
+		for (int i = 0; i < numNodes; ++i) {
+			Matrix4 MVM, NMVM;
+			shapes[i]->getModelViewMatrices(parent * rbts[i], MVM, NMVM);
+			checksum += MVM(0, 3) + NMVM(1, 1);
+		}
+	}
+	nodeNs = stopwatch.elapsedMs() * 1e6 / (numRounds * numNodes);
+
+	Matrix4 m;
+	stopwatch.reset();
+	for (int round = 0; round < numRounds; ++round) {
+		for (int i = 0; i < numNodes; ++i)
+			m = affines[i] * m;
+	}
+	matrixNs = stopwatch.elapsedMs() * 1e6 / (numRounds * numNodes);
+
+	RigTForm rbt;
+	stopwatch.reset();
+	for (int round = 0; round < numRounds; ++round) {
+		for (int i = 0; i < numNodes; ++i)
+			rbt = rbt * rbts[i];
+		rbt.setRotation(normalize(rbt.getRotation()));
+	}
+	composeNs = stopwatch.elapsedMs() * 1e6 / (numRounds * numNodes);
+
+	Quat q;
+	stopwatch.reset();
+	for (int round = 0; round < numRounds; ++round) {
+		for (int i = 0; i < numNodes; ++i)
+			q = rbts[i].getRotation() * q;
+		q = normalize(q);
+	}
+	quatNs = stopwatch.elapsedMs() * 1e6 / (numRounds * numNodes);
+
+	Cvec3 v(1, 2, 3);
+	stopwatch.reset();
+	for (int round = 0; round < numRounds; ++round) {
+		for (int i = 0; i < numNodes; ++i)
+			v = rbts[i].getRotation() * v;
+	}
+	rotateNs = stopwatch.elapsedMs() * 1e6 / (numRounds * numNodes);
+
+	checksum += m(0, 3) + rbt.getTranslation()[0] + q[0] + v[0];
+	cerr << simdmath::getBackendName() << " math, " << numNodes << " nodes, per operation:\n"
+		<< "  shape node, in general   " << generalNs << " ns\n"
+		<< "  shape node, rigid path   " << nodeNs << " ns\n"
+		<< "  Matrix4 * Matrix4        " << matrixNs << " ns\n"
+		<< "  RigTForm * RigTForm      " << composeNs << " ns\n"
+		<< "  Quat * Quat              " << quatNs << " ns\n"
+		<< "  Quat * Cvec3             " << rotateNs << " ns\n"
+		<< "  (checksum " << checksum << ")" << endl;
+}
+
+// Does nothing, to time scheduling alone
+struct EmptyJob {
+	void operator()(int, int) const {}
+};
+
+// Times the job system: what scheduling one task costs (parallelFor over
+// ranges of one empty item), and the scaling efficiency T1 / (p Tp) with p
+// threads on two real workloads, hair simulation steps on the bunny and the
+// point rules of a Catmull-Clark step on the twice subdivided bunny. Runs
+// JobSystems of 1 to maxThreads threads. Run with --bench-jobs <maxThreads>;
+// needs no GL context.
+static void benchJobs(int maxThreads) {
+	const int numTasks = 4000, numRounds = 50, numSteps = 100;
+
+	g_bunnyMesh.load("bunny.mesh");
+	computeVertexNormals(g_bunnyMesh);
+	const int numVertices = g_bunnyMesh.getNumVertices();
+	vector<Cvec3> restTips(numVertices);
+	for (int i = 0; i < numVertices; ++i)
+		restTips[i] = g_bunnyMesh.getVertex(i).getPosition() + g_bunnyMesh.getVertex(i).getNormal() * g_furHeight;
+	const HairStepJob hairStep = { RigTForm(Cvec3(0, .1, 0)) }; // a little off rest, so the hair moves
+
+	Mesh mesh;
+	mesh.load("bunny.mesh");
+	for (int i = 0; i < 2; ++i)
+		subdivideCatmullClark(mesh);
+	const NewFaceVertexJob faceJob = { &mesh };
+	const NewEdgeVertexJob edgeJob = { &mesh };
+	const NewVertexVertexJob vertexJob = { &mesh };
+
+	cerr << "Job system, " << thread::hardware_concurrency() << " hardware threads; hair on "
+		<< numVertices << " vertices, subdivision points for " << mesh.getNumFaces() << " faces" << endl;
+	double hairMs1 = 0, subdivMs1 = 0;
+	for (int numThreads = 1; numThreads <= maxThreads; ++numThreads) {
+		JobSystem jobs(numThreads - 1);
+
+		Stopwatch stopwatch;
+		for (int i = 0; i < numRounds; ++i)
+			jobs.parallelFor(0, numTasks, 1, EmptyJob());
+		const double taskNs = stopwatch.elapsedMs() * 1e6 / (numRounds * numTasks);
+
+		g_tipPos = restTips;
+		g_tipVelocity.assign(numVertices, Cvec3(0));
+		stopwatch.reset();
+		for (int i = 0; i < numSteps; ++i)
+			jobs.parallelFor(0, numVertices, 256, hairStep);
+		const double hairMs = stopwatch.elapsedMs() / numSteps;
+
+		stopwatch.reset();
+		for (int i = 0; i < numRounds; ++i) {
+			jobs.parallelFor(0, mesh.getNumFaces(), 1024, faceJob);
+			jobs.parallelFor(0, mesh.getNumEdges(), 1024, edgeJob);
+			jobs.parallelFor(0, mesh.getNumVertices(), 1024, vertexJob);
+		}
+		const double subdivMs = stopwatch.elapsedMs() / numRounds;
+
+		if (numThreads == 1) {
+			hairMs1 = hairMs;
+			subdivMs1 = subdivMs;
+		}
+		cerr << "  " << numThreads << " threads: ";
+		if (numThreads == 1)
+			cerr << "inline, no tasks";
+		else
+			cerr << taskNs << " ns per task";
+		cerr << ", hair step "
+			<< hairMs << " ms (efficiency " << hairMs1 / (numThreads * hairMs) << "), subdivision points "
+			<< subdivMs << " ms (efficiency " << subdivMs1 / (numThreads * subdivMs) << ")" << endl;
+	}
+}
+
 int main(int argc, char * argv[]) {
 	try {
+		for (int i = 1; i + 1 < argc; ++i) {
+			if (string(argv[i]) == "--bench-children") {
+				benchChildChurn(atoi(argv[i + 1]));
+				return 0;
+			}
+			if (string(argv[i]) == "--bench-decimate") {
+				benchDecimation(atoi(argv[i + 1]));
+				return 0;
+			}
+			if (string(argv[i]) == "--bench-traversal") {
+				benchTraversal(atoi(argv[i + 1]));
+				return 0;
+			}
+			if (string(argv[i]) == "--bench-lod") {
+				benchLod(atoi(argv[i + 1]));
+				return 0;
+			}
+			if (string(argv[i]) == "--bench-ppm") {
+				benchPpm(atoi(argv[i + 1]));
+				return 0;
+			}
+			if (string(argv[i]) == "--bench-mips") {
+				benchMipChain(atoi(argv[i + 1]));
+				return 0;
+			}
+			if (string(argv[i]) == "--bench-transforms") {
+				benchTransforms(atoi(argv[i + 1]));
+				return 0;
+			}
+			if (string(argv[i]) == "--bench-jobs") {
+				benchJobs(atoi(argv[i + 1]));
+				return 0;
+			}
+		}
+
 		initGlutState(argc, argv);
 
+		for (int i = 1; i + 1 < argc; ++i) {
+			if (string(argv[i]) == "--soak") {
+				g_soakMinutes = atof(argv[i + 1]);
+				weather = SNOW;
+				cerr << "Soak testing for " << g_soakMinutes << " minutes of snow" << endl;
+			}
+			else if (string(argv[i]) == "--particles")
+				g_numGpuParticles = atoi(argv[i + 1]);
+			else if (string(argv[i]) == "--clouds")
+				g_numClouds = atoi(argv[i + 1]);
+		}
+
 		// on Mac, we shouldn't use GLEW.
 
 #ifndef __MAC__
@@ -1827,14 +3170,22 @@ int main(int argc, char * argv[]) {
 		else if (g_Gl2Compatible && !GLEW_VERSION_2_0)
 			throw runtime_error("Error: card/driver does not support OpenGL Shading Language v1.0");
 #endif
+		cout << (isPackedNormalSupported() ? "Will pack normals as 2_10_10_10" : "Will keep normals as floats") << endl;
 
 		initGLState();
 		initMaterials();
 		initGeometry();
 		initScene();
 		initAnimation();
-		initParticles(); 
+		if (!g_gpuParticles)
+			initParticles(); 
 		initClouds();
+
+		// have the first snapshot ready before the first frame is drawn
+		Profiler::setThreadName("main");
+		updateFrame();
+		g_updateThread.start(updateFrame);
+
 		glutMainLoop();
 		return 0;
 	}
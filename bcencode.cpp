@@ -0,0 +1,72 @@
+// Offline block compressor for textures: reads a PPM image, builds its
+// mipmap levels and writes them BC1 or BC5 compressed as a DDS file, which
+// CompressedTexture uploads as it is. Built and run by `make textures'.
+//
+// Usage: bcencode bc1|bc5 [srgb] input.ppm output.dds
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "ppm.h"
+#include "mipchain.h"
+#include "blockcompress.h"
+#include "frametimer.h"
+
+using namespace std;
+
+// Peak signal to noise ratio over all channels, in dB
+static double getPsnr(const unsigned char* a, const unsigned char* b, size_t size) {
+  double sum = 0;
+  for (size_t i = 0; i < size; ++i)
+    sum += (double(a[i]) - b[i]) * (double(a[i]) - b[i]);
+  return sum == 0 ? 99 : 10 * log10(255.0 * 255.0 * size / sum);
+}
+
+int main(int argc, char* argv[]) {
+  try {
+    int arg = 1;
+    if (argc < 4)
+      throw runtime_error("usage: bcencode bc1|bc5 [srgb] input.ppm output.dds");
+    const string formatName = argv[arg++];
+    if (formatName != "bc1" && formatName != "bc5")
+      throw runtime_error("bcencode: format must be bc1 or bc5");
+    const BlockFormat format = formatName == "bc1" ? BLOCK_FORMAT_BC1 : BLOCK_FORMAT_BC5;
+    const bool srgb = string(argv[arg]) == "srgb";
+    if (srgb)
+      ++arg;
+    if (arg + 2 != argc)
+      throw runtime_error("usage: bcencode bc1|bc5 [srgb] input.ppm output.dds");
+    const char *inputFileName = argv[arg], *outputFileName = argv[arg + 1];
+
+    Stopwatch stopwatch;
+    const PpmImage image(inputFileName);
+    const MipChain mips(image, srgb, &getJobSystem());
+
+    vector<vector<unsigned char> > levels(mips.getNumLevels());
+    size_t compressedSize = 0, uncompressedSize = 0;
+    for (int i = 0; i < mips.getNumLevels(); ++i) {
+      compressImage(format, mips.getPixels(i), mips.getWidth(i), mips.getHeight(i), levels[i]);
+      compressedSize += levels[i].size();
+      uncompressedSize += size_t(3) * mips.getWidth(i) * mips.getHeight(i);
+    }
+    writeDds(outputFileName, format, mips.getWidth(0), mips.getHeight(0), levels);
+
+    vector<unsigned char> decoded;
+    decompressImage(format, &levels[0][0], mips.getWidth(0), mips.getHeight(0), decoded);
+    const double psnr = getPsnr(mips.getPixels(0), &decoded[0], decoded.size());
+
+    cout << outputFileName << ": " << formatName << (srgb ? " srgb" : "") << ", "
+         << mips.getWidth(0) << "x" << mips.getHeight(0) << ", " << mips.getNumLevels() << " levels, "
+         << (compressedSize + 512) / 1024 << " KB instead of " << (uncompressedSize + 512) / 1024
+         << " KB of RGB, top level PSNR " << psnr << " dB, " << stopwatch.elapsedMs() << " ms" << endl;
+    return 0;
+  }
+  catch (const runtime_error& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+}
@@ -0,0 +1,437 @@
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "blockcompress.h"
+
+using namespace std;
+
+int getBlockSize(BlockFormat format) {
+  return format == BLOCK_FORMAT_BC1 ? 8 : 16;
+}
+
+int getCompressedSize(BlockFormat format, int width, int height) {
+  return ((width + 3) / 4) * ((height + 3) / 4) * getBlockSize(format);
+}
+
+// ---------- BC1
+
+static inline int packRgb565(const float c[3]) {
+  const int r = int(min(max(c[0], 0.f), 255.f) * 31 / 255 + .5f);
+  const int g = int(min(max(c[1], 0.f), 255.f) * 63 / 255 + .5f);
+  const int b = int(min(max(c[2], 0.f), 255.f) * 31 / 255 + .5f);
+  return (r << 11) | (g << 5) | b;
+}
+
+static inline void unpackRgb565(int c, int rgb[3]) {
+  const int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+// The four colors of a block with color0 > color1
+static void getBc1Palette(int color0, int color1, int palette[4][3]) {
+  unpackRgb565(color0, palette[0]);
+  unpackRgb565(color1, palette[1]);
+  for (int c = 0; c < 3; ++c) {
+    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+  }
+}
+
+// Picks the nearest palette color for each texel, and returns the total
+// squared error
+static int fitBc1Indices(const unsigned char rgb[16 * 3], int color0, int color1, int indices[16]) {
+  int palette[4][3];
+  getBc1Palette(color0, color1, palette);
+  int totalError = 0;
+  for (int i = 0; i < 16; ++i) {
+    int bestError = 1 << 30;
+    for (int j = 0; j < 4; ++j) {
+      int error = 0;
+      for (int c = 0; c < 3; ++c) {
+        const int d = rgb[3 * i + c] - palette[j][c];
+        error += d * d;
+      }
+      if (error < bestError) {
+        bestError = error;
+        indices[i] = j;
+      }
+    }
+    totalError += bestError;
+  }
+  return totalError;
+}
+
+// Endpoints minimizing the squared error of the texels for fixed indices,
+// as weights along the line: index 0 is 1 of color0, 2 is 2/3, 3 is 1/3
+// and 1 is none
+static bool solveBc1Endpoints(const unsigned char rgb[16 * 3], const int indices[16],
+                              float end0[3], float end1[3]) {
+  static const float weights[4] = { 1.f, 0.f, 2.f / 3, 1.f / 3 };
+  float aa = 0, ab = 0, bb = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+  for (int i = 0; i < 16; ++i) {
+    const float a = weights[indices[i]], b = 1 - a;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = 0; c < 3; ++c) {
+      ax[c] += a * rgb[3 * i + c];
+      bx[c] += b * rgb[3 * i + c];
+    }
+  }
+  const float det = aa * bb - ab * ab;
+  if (fabs(det) < 1e-6f)
+    return false;
+  for (int c = 0; c < 3; ++c) {
+    end0[c] = (ax[c] * bb - bx[c] * ab) / det;
+    end1[c] = (bx[c] * aa - ax[c] * ab) / det;
+  }
+  return true;
+}
+
+static void writeBc1Block(int color0, int color1, const int indices[16], unsigned char block[8]) {
+  unsigned bits = 0;
+  for (int i = 0; i < 16; ++i)
+    bits |= unsigned(indices[i]) << (2 * i);
+  block[0] = color0 & 0xff;
+  block[1] = color0 >> 8;
+  block[2] = color1 & 0xff;
+  block[3] = color1 >> 8;
+  for (int i = 0; i < 4; ++i)
+    block[4 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+// Endpoints start at the extremes of the texels along their principal
+// axis, and are then refit by least squares to the indices they give
+void encodeBc1Block(const unsigned char rgb[16 * 3], unsigned char block[8]) {
+  float mean[3] = { 0, 0, 0 };
+  for (int i = 0; i < 16; ++i) {
+    for (int c = 0; c < 3; ++c)
+      mean[c] += rgb[3 * i + c] / 16.f;
+  }
+  float cov[6] = { 0, 0, 0, 0, 0, 0 }; // rr rg rb gg gb bb
+  for (int i = 0; i < 16; ++i) {
+    const float r = rgb[3 * i] - mean[0], g = rgb[3 * i + 1] - mean[1], b = rgb[3 * i + 2] - mean[2];
+    cov[0] += r * r;
+    cov[1] += r * g;
+    cov[2] += r * b;
+    cov[3] += g * g;
+    cov[4] += g * b;
+    cov[5] += b * b;
+  }
+
+  // power iteration for the principal axis
+  float axis[3] = { 1, 1, 1 };
+  for (int k = 0; k < 8; ++k) {
+    const float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    const float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    const float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    const float length = max(fabs(x), max(fabs(y), fabs(z)));
+    if (length < 1e-6f)
+      break;
+    axis[0] = x / length;
+    axis[1] = y / length;
+    axis[2] = z / length;
+  }
+
+  int minTexel = 0, maxTexel = 0;
+  float minDot = 1e30f, maxDot = -1e30f;
+  for (int i = 0; i < 16; ++i) {
+    const float d = rgb[3 * i] * axis[0] + rgb[3 * i + 1] * axis[1] + rgb[3 * i + 2] * axis[2];
+    if (d < minDot) {
+      minDot = d;
+      minTexel = i;
+    }
+    if (d > maxDot) {
+      maxDot = d;
+      maxTexel = i;
+    }
+  }
+  float end0[3], end1[3];
+  for (int c = 0; c < 3; ++c) {
+    end0[c] = rgb[3 * maxTexel + c];
+    end1[c] = rgb[3 * minTexel + c];
+  }
+
+  int bestColor0 = 0, bestColor1 = 0, bestIndices[16], bestError = 1 << 30;
+  for (int iteration = 0; iteration < 3; ++iteration) {
+    int color0 = packRgb565(end0), color1 = packRgb565(end1);
+    int indices[16];
+    if (color0 == color1) {
+      // a single color, where the three color mode would do as well
+      fill(indices, indices + 16, 0);
+      int palette[4][3];
+      getBc1Palette(color0, color1, palette);
+      int error = 0;
+      for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 3; ++c)
+          error += (rgb[3 * i + c] - palette[0][c]) * (rgb[3 * i + c] - palette[0][c]);
+      }
+      if (error < bestError) {
+        bestError = error;
+        bestColor0 = bestColor1 = color0;
+        copy(indices, indices + 16, bestIndices);
+      }
+      break;
+    }
+    if (color0 < color1) {
+      swap(color0, color1);
+      swap(end0, end1);
+    }
+
+    const int error = fitBc1Indices(rgb, color0, color1, indices);
+    if (error >= bestError)
+      break;
+    bestError = error;
+    bestColor0 = color0;
+    bestColor1 = color1;
+    copy(indices, indices + 16, bestIndices);
+    if (error == 0 || !solveBc1Endpoints(rgb, indices, end0, end1))
+      break;
+  }
+  writeBc1Block(bestColor0, bestColor1, bestIndices, block);
+}
+
+void decodeBc1Block(const unsigned char block[8], unsigned char rgb[16 * 3]) {
+  const int color0 = block[0] | (block[1] << 8), color1 = block[2] | (block[3] << 8);
+  int palette[4][3];
+  getBc1Palette(color0, color1, palette);
+  if (color0 <= color1) {
+    // three colors and black
+    for (int c = 0; c < 3; ++c) {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  const unsigned bits = block[4] | (block[5] << 8) | (block[6] << 16) | (unsigned(block[7]) << 24);
+  for (int i = 0; i < 16; ++i) {
+    const int index = (bits >> (2 * i)) & 3;
+    for (int c = 0; c < 3; ++c)
+      rgb[3 * i + c] = static_cast<unsigned char>(palette[index][c]);
+  }
+}
+
+// ---------- BC4, two of which make a BC5 block
+
+// The eight values of a block with value0 > value1
+static void getBc4Palette(int value0, int value1, int palette[8]) {
+  palette[0] = value0;
+  palette[1] = value1;
+  if (value0 > value1) {
+    for (int i = 1; i < 7; ++i)
+      palette[i + 1] = ((7 - i) * value0 + i * value1 + 3) / 7;
+  }
+  else {
+    for (int i = 1; i < 5; ++i)
+      palette[i + 1] = ((5 - i) * value0 + i * value1 + 2) / 5;
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+static void encodeBc4Block(const unsigned char rgb[16 * 3], int channel, unsigned char block[8]) {
+  int minValue = 255, maxValue = 0;
+  for (int i = 0; i < 16; ++i) {
+    minValue = min(minValue, int(rgb[3 * i + channel]));
+    maxValue = max(maxValue, int(rgb[3 * i + channel]));
+  }
+
+  int palette[8];
+  getBc4Palette(maxValue, minValue, palette);
+  unsigned long long bits = 0;
+  for (int i = 0; i < 16 && maxValue > minValue; ++i) {
+    int bestIndex = 0, bestError = 1 << 30;
+    for (int j = 0; j < 8; ++j) {
+      const int error = abs(rgb[3 * i + channel] - palette[j]);
+      if (error < bestError) {
+        bestError = error;
+        bestIndex = j;
+      }
+    }
+    bits |= (unsigned long long)bestIndex << (3 * i);
+  }
+  block[0] = maxValue;
+  block[1] = minValue;
+  for (int i = 0; i < 6; ++i)
+    block[2 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+static void decodeBc4Block(const unsigned char block[8], int channel, unsigned char rgb[16 * 3]) {
+  int palette[8];
+  getBc4Palette(block[0], block[1], palette);
+  unsigned long long bits = 0;
+  for (int i = 0; i < 6; ++i)
+    bits |= (unsigned long long)block[2 + i] << (8 * i);
+  for (int i = 0; i < 16; ++i)
+    rgb[3 * i + channel] = static_cast<unsigned char>(palette[(bits >> (3 * i)) & 7]);
+}
+
+void encodeBc5Block(const unsigned char rgb[16 * 3], unsigned char block[16]) {
+  encodeBc4Block(rgb, 0, block);
+  encodeBc4Block(rgb, 1, block + 8);
+}
+
+void decodeBc5Block(const unsigned char block[16], unsigned char rgb[16 * 3]) {
+  decodeBc4Block(block, 0, rgb);
+  decodeBc4Block(block + 8, 1, rgb);
+  for (int i = 0; i < 16; ++i) {
+    const float x = rgb[3 * i] / 127.5f - 1, y = rgb[3 * i + 1] / 127.5f - 1;
+    const float z = sqrt(max(0.f, 1 - x * x - y * y));
+    rgb[3 * i + 2] = static_cast<unsigned char>((z + 1) * 127.5f + .5f);
+  }
+}
+
+// ---------- whole images
+
+void compressImage(BlockFormat format, const unsigned char* rgb, int width, int height,
+                   vector<unsigned char>& blocks) {
+  const int blockSize = getBlockSize(format);
+  const int numBlocksX = (width + 3) / 4, numBlocksY = (height + 3) / 4;
+  blocks.resize(size_t(numBlocksX) * numBlocksY * blockSize);
+
+  unsigned char texels[16 * 3];
+  for (int by = 0; by < numBlocksY; ++by) {
+    for (int bx = 0; bx < numBlocksX; ++bx) {
+      for (int i = 0; i < 16; ++i) {
+        const int x = min(4 * bx + i % 4, width - 1), y = min(4 * by + i / 4, height - 1);
+        memcpy(texels + 3 * i, rgb + 3 * (size_t(y) * width + x), 3);
+      }
+      unsigned char *block = &blocks[(size_t(by) * numBlocksX + bx) * blockSize];
+      if (format == BLOCK_FORMAT_BC1)
+        encodeBc1Block(texels, block);
+      else
+        encodeBc5Block(texels, block);
+    }
+  }
+}
+
+void decompressImage(BlockFormat format, const unsigned char* blocks, int width, int height,
+                     vector<unsigned char>& rgb) {
+  const int blockSize = getBlockSize(format);
+  const int numBlocksX = (width + 3) / 4, numBlocksY = (height + 3) / 4;
+  rgb.resize(size_t(3) * width * height);
+
+  unsigned char texels[16 * 3];
+  for (int by = 0; by < numBlocksY; ++by) {
+    for (int bx = 0; bx < numBlocksX; ++bx) {
+      const unsigned char *block = blocks + (size_t(by) * numBlocksX + bx) * blockSize;
+      if (format == BLOCK_FORMAT_BC1)
+        decodeBc1Block(block, texels);
+      else
+        decodeBc5Block(block, texels);
+      for (int i = 0; i < 16; ++i) {
+        const int x = 4 * bx + i % 4, y = 4 * by + i / 4;
+        if (x < width && y < height)
+          memcpy(&rgb[3 * (size_t(y) * width + x)], texels + 3 * i, 3);
+      }
+    }
+  }
+}
+
+// ---------- DDS files
+
+// The parts of the DDS header used here, all little endian 32 bit words.
+// Word 0 is the "DDS " magic.
+enum {
+  DDS_WORD_SIZE = 1,         // 124
+  DDS_WORD_FLAGS = 2,
+  DDS_WORD_HEIGHT = 3,
+  DDS_WORD_WIDTH = 4,
+  DDS_WORD_LINEAR_SIZE = 5,
+  DDS_WORD_MIPMAP_COUNT = 7,
+  DDS_WORD_PF_SIZE = 19,     // 32
+  DDS_WORD_PF_FLAGS = 20,
+  DDS_WORD_PF_FOURCC = 21,
+  DDS_WORD_CAPS = 27,
+  DDS_NUM_WORDS = 32         // 4 byte magic and 124 byte header
+};
+
+static const unsigned DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PIXELFORMAT = 0x1000,
+                      DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000;
+static const unsigned DDPF_FOURCC = 0x4;
+static const unsigned DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+
+static unsigned makeFourCC(const char* s) {
+  return unsigned(s[0]) | (unsigned(s[1]) << 8) | (unsigned(s[2]) << 16) | (unsigned(s[3]) << 24);
+}
+
+static unsigned readWord(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (unsigned(p[3]) << 24);
+}
+
+static void writeWord(unsigned char* p, unsigned word) {
+  for (int i = 0; i < 4; ++i)
+    p[i] = (word >> (8 * i)) & 0xff;
+}
+
+DdsImage::DdsImage(const char* filename)
+  : file_(filename) {
+  const unsigned char *data = reinterpret_cast<const unsigned char*>(file_.getData());
+  const size_t size = file_.getSize();
+  if (size < 4 * DDS_NUM_WORDS || readWord(data) != makeFourCC("DDS ") ||
+      readWord(data + 4 * DDS_WORD_SIZE) != 124)
+    throw runtime_error(string("DdsImage: bad file format in ") + filename);
+
+  if (!(readWord(data + 4 * DDS_WORD_PF_FLAGS) & DDPF_FOURCC))
+    throw runtime_error(string("DdsImage: not block compressed: ") + filename);
+  const unsigned fourCC = readWord(data + 4 * DDS_WORD_PF_FOURCC);
+  if (fourCC == makeFourCC("DXT1"))
+    format_ = BLOCK_FORMAT_BC1;
+  else if (fourCC == makeFourCC("ATI2") || fourCC == makeFourCC("BC5U"))
+    format_ = BLOCK_FORMAT_BC5;
+  else
+    throw runtime_error(string("DdsImage: unsupported format in ") + filename);
+
+  int width = readWord(data + 4 * DDS_WORD_WIDTH), height = readWord(data + 4 * DDS_WORD_HEIGHT);
+  const unsigned flags = readWord(data + 4 * DDS_WORD_FLAGS);
+  const int numLevels = flags & DDSD_MIPMAPCOUNT ? max(1, int(readWord(data + 4 * DDS_WORD_MIPMAP_COUNT))) : 1;
+  if (width <= 0 || height <= 0 || numLevels > 32)
+    throw runtime_error(string("DdsImage: invalid header in ") + filename);
+
+  size_t offset = 4 * DDS_NUM_WORDS;
+  for (int i = 0; i < numLevels; ++i) {
+    const Level level = { width, height, data + offset };
+    offset += getCompressedSize(format_, width, height);
+    if (offset > size)
+      throw runtime_error(string("DdsImage: unexpected end of file ") + filename);
+    levels_.push_back(level);
+    width = max(1, width / 2);
+    height = max(1, height / 2);
+  }
+}
+
+void writeDds(const char* filename, BlockFormat format, int width, int height,
+              const vector<vector<unsigned char> >& levels) {
+  unsigned char header[4 * DDS_NUM_WORDS];
+  memset(header, 0, sizeof(header));
+  writeWord(header, makeFourCC("DDS "));
+  writeWord(header + 4 * DDS_WORD_SIZE, 124);
+  writeWord(header + 4 * DDS_WORD_FLAGS,
+            DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE);
+  writeWord(header + 4 * DDS_WORD_HEIGHT, height);
+  writeWord(header + 4 * DDS_WORD_WIDTH, width);
+  writeWord(header + 4 * DDS_WORD_LINEAR_SIZE, getCompressedSize(format, width, height));
+  writeWord(header + 4 * DDS_WORD_MIPMAP_COUNT, unsigned(levels.size()));
+  writeWord(header + 4 * DDS_WORD_PF_SIZE, 32);
+  writeWord(header + 4 * DDS_WORD_PF_FLAGS, DDPF_FOURCC);
+  writeWord(header + 4 * DDS_WORD_PF_FOURCC, makeFourCC(format == BLOCK_FORMAT_BC1 ? "DXT1" : "ATI2"));
+  writeWord(header + 4 * DDS_WORD_CAPS, DDSCAPS_TEXTURE | (levels.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0));
+
+  FILE *f = fopen(filename, "wb");
+  if (!f)
+    throw runtime_error(string("writeDds: Cannot open file ") + filename + " for write");
+  bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+  for (size_t i = 0; ok && i < levels.size(); ++i) {
+    assert(int(levels[i].size()) == getCompressedSize(format, width, height));
+    ok = fwrite(&levels[i][0], levels[i].size(), 1, f) == 1;
+    width = max(1, width / 2);
+    height = max(1, height / 2);
+  }
+  if (fclose(f) != 0 || !ok)
+    throw runtime_error(string("writeDds: Cannot write ") + filename);
+}
@@ -0,0 +1,101 @@
+#ifndef BLOCKCOMPRESS_H
+#define BLOCKCOMPRESS_H
+
+#include <vector>
+#include <string>
+
+#include "mappedfile.h"
+#include "glsupport.h" // for Noncopyable
+
+// Block compression of 8 bit RGB images, in 4x4 texel blocks:
+//
+// BC1 (DXT1) stores colors in 8 bytes per block, as two RGB 5:6:5
+// endpoints and a 2 bit index per texel into the four colors on the line
+// between them. Meant for color maps.
+//
+// BC5 (RGTC2, ATI2) stores the red and green channels in 16 bytes per
+// block, each as two 8 bit endpoints and a 3 bit index per texel into the
+// eight values between them. Meant for tangent space normal maps, whose z
+// is reconstructed from x and y.
+//
+// Images are passed bottom row first, like everywhere else GL sees them,
+// and the blocks are laid out the same way. Blocks at the right and top
+// edges of an image that is not a multiple of 4 wide or high repeat the
+// edge texels.
+enum BlockFormat {
+  BLOCK_FORMAT_BC1,
+  BLOCK_FORMAT_BC5
+};
+
+// Bytes per 4x4 block
+int getBlockSize(BlockFormat format);
+
+// Bytes taken by a width x height image
+int getCompressedSize(BlockFormat format, int width, int height);
+
+// rgb holds the 16 texels of the block, row by row
+void encodeBc1Block(const unsigned char rgb[16 * 3], unsigned char block[8]);
+void decodeBc1Block(const unsigned char block[8], unsigned char rgb[16 * 3]);
+
+// The blue channel is ignored by the encoder. The decoder reconstructs
+// it as the z of a unit normal.
+void encodeBc5Block(const unsigned char rgb[16 * 3], unsigned char block[16]);
+void decodeBc5Block(const unsigned char block[16], unsigned char rgb[16 * 3]);
+
+void compressImage(BlockFormat format, const unsigned char* rgb, int width, int height,
+                   std::vector<unsigned char>& blocks);
+void decompressImage(BlockFormat format, const unsigned char* blocks, int width, int height,
+                     std::vector<unsigned char>& rgb);
+
+// A block compressed image with all its mipmap levels, read from a DDS
+// file as written by writeDds(). Only the BC1 ("DXT1") and BC5 ("ATI2")
+// formats are understood. The blocks are used in place in the mapped
+// file. Throws runtime_error on error.
+//
+// Since the blocks are stored bottom row first, other DDS viewers show
+// these files upside down.
+class DdsImage : Noncopyable {
+public:
+  explicit DdsImage(const char* filename);
+
+  BlockFormat getFormat() const {
+    return format_;
+  }
+
+  int getNumLevels() const {
+    return int(levels_.size());
+  }
+
+  int getWidth(int level) const {
+    return levels_[level].width;
+  }
+
+  int getHeight(int level) const {
+    return levels_[level].height;
+  }
+
+  const unsigned char* getBlocks(int level) const {
+    return levels_[level].blocks;
+  }
+
+  int getSize(int level) const {
+    return getCompressedSize(format_, getWidth(level), getHeight(level));
+  }
+
+private:
+  struct Level {
+    int width, height;
+    const unsigned char* blocks;
+  };
+
+  MappedFile file_;
+  BlockFormat format_;
+  std::vector<Level> levels_;
+};
+
+// Writes the levels, each halving the size of the one before down to 1x1
+// or fewer, as a DDS file. Throws runtime_error on error.
+void writeDds(const char* filename, BlockFormat format, int width, int height,
+              const std::vector<std::vector<unsigned char> >& levels);
+
+#endif
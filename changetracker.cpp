@@ -0,0 +1,16 @@
+#include <atomic>
+
+#include "changetracker.h"
+
+using namespace std;
+
+static atomic<unsigned> g_changeCount(0);
+
+void markDirty() {
+  // only the value matters, not its order with respect to other memory
+  g_changeCount.fetch_add(1, memory_order_relaxed);
+}
+
+unsigned getChangeCount() {
+  return g_changeCount.load(memory_order_relaxed);
+}
@@ -0,0 +1,19 @@
+#ifndef CHANGETRACKER_H
+#define CHANGETRACKER_H
+
+// Change tracking for drawing frames only on demand. Whatever changes what
+// gets drawn calls markDirty(): the scene graph setters (SgRbtNode::setRbt,
+// adding and removing children, shape affine matrices), the non-const
+// Material::getUniforms(), and uploads of geometry and texture data. A frame
+// drawn after getChangeCount() returned n is still up to date as long as it
+// keeps returning n.
+//
+// Assigning the public fields of a shape node (geometry, material) is not
+// tracked; call markDirty() after doing so outside of an update that is
+// tracked anyway. Both functions may be called from any thread.
+
+void markDirty();
+
+unsigned getChangeCount();
+
+#endif
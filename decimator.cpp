@@ -0,0 +1,711 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "decimator.h"
+#include "frametimer.h"
+
+using namespace std;
+
+typedef Cvec<int, 3> Triangle;
+
+// Reads the vertex positions and faces of a mesh, with quads split in two
+static void getTriangles(Mesh& mesh, vector<Cvec3>& positions, vector<Triangle>& triangles) {
+  positions.resize(mesh.getNumVertices());
+  for (int i = 0; i < mesh.getNumVertices(); ++i)
+    positions[i] = mesh.getVertex(i).getPosition();
+
+  triangles.clear();
+  triangles.reserve(2 * mesh.getNumFaces());
+  for (int i = 0; i < mesh.getNumFaces(); ++i) {
+    const Mesh::Face f = mesh.getFace(i);
+    for (int j = 1; j + 1 < f.getNumVertices(); ++j)
+      triangles.push_back(Triangle(f.getVertex(0).getIndex(), f.getVertex(j).getIndex(), f.getVertex(j + 1).getIndex()));
+  }
+}
+
+// Interleaves the low 10 bits of x with zeros: ..., x1, 0, 0, x0
+static unsigned spreadBits(unsigned x) {
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+struct KeyLess {
+  bool operator () (const pair<unsigned, int>& a, const pair<unsigned, int>& b) const {
+    return a.first < b.first;
+  }
+};
+
+// Renumbers the vertices along a Z-order curve and the triangles by their
+// smallest vertex, so that neighbors are mostly close in memory. Meshes
+// coming out of subdivision have neighbors spread all over their arrays,
+// and both the decimation and the distance queries are bound by the memory
+// accesses to them.
+static void sortSpatially(vector<Cvec3>& positions, vector<Triangle>& triangles) {
+  if (positions.empty())
+    return;
+  Cvec3 lo = positions[0], hi = positions[0];
+  for (size_t i = 0; i < positions.size(); ++i) {
+    for (int k = 0; k < 3; ++k) {
+      lo[k] = min(lo[k], positions[i][k]);
+      hi[k] = max(hi[k], positions[i][k]);
+    }
+  }
+  const double extent = max(hi[0] - lo[0], max(hi[1] - lo[1], hi[2] - lo[2]));
+  const double scale = extent > 0 ? 1023 / extent : 0;
+
+  vector<pair<unsigned, int> > keys(positions.size());
+  for (size_t i = 0; i < positions.size(); ++i) {
+    const Cvec3 q = (positions[i] - lo) * scale;
+    keys[i] = make_pair(spreadBits(unsigned(q[0])) | spreadBits(unsigned(q[1])) << 1 | spreadBits(unsigned(q[2])) << 2, int(i));
+  }
+  sort(keys.begin(), keys.end(), KeyLess());
+
+  vector<Cvec3> sorted(positions.size());
+  vector<int> newIndices(positions.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    sorted[i] = positions[keys[i].second];
+    newIndices[keys[i].second] = i;
+  }
+  positions.swap(sorted);
+
+  keys.resize(triangles.size());
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    for (int j = 0; j < 3; ++j)
+      triangles[t][j] = newIndices[triangles[t][j]];
+    keys[t] = make_pair(unsigned(min(triangles[t][0], min(triangles[t][1], triangles[t][2]))), int(t));
+  }
+  sort(keys.begin(), keys.end(), KeyLess());
+  vector<Triangle> sortedTriangles(triangles.size());
+  for (size_t t = 0; t < keys.size(); ++t)
+    sortedTriangles[t] = triangles[keys[t].second];
+  triangles.swap(sortedTriangles);
+}
+
+static Cvec3 getTriangleNormal(const Cvec3& p0, const Cvec3& p1, const Cvec3& p2) {
+  return cross(p1 - p0, p2 - p0);
+}
+
+// ---------- Quadrics
+
+namespace {
+
+// Symmetric 4x4 matrix Q, such that the error of p is (p, 1)^T Q (p, 1)
+struct Quadric {
+  double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+
+  Quadric() : a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0), a22(0), a23(0), a33(0) {}
+
+  // Squared distance to the plane dot(n, p) + d = 0, times weight. n must
+  // be of unit length.
+  Quadric(const Cvec3& n, double d, double weight)
+    : a00(weight * n[0] * n[0]), a01(weight * n[0] * n[1]), a02(weight * n[0] * n[2]), a03(weight * n[0] * d)
+    , a11(weight * n[1] * n[1]), a12(weight * n[1] * n[2]), a13(weight * n[1] * d)
+    , a22(weight * n[2] * n[2]), a23(weight * n[2] * d)
+    , a33(weight * d * d) {}
+
+  Quadric& operator += (const Quadric& q) {
+    a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+    a11 += q.a11; a12 += q.a12; a13 += q.a13;
+    a22 += q.a22; a23 += q.a23;
+    a33 += q.a33;
+    return *this;
+  }
+
+  double evaluate(const Cvec3& p) const {
+    const double x = p[0], y = p[1], z = p[2];
+    return x * (a00 * x + 2 * (a01 * y + a02 * z + a03)) +
+           y * (a11 * y + 2 * (a12 * z + a13)) +
+           z * (a22 * z + 2 * a23) + a33;
+  }
+
+  // Point of least error, if well defined
+  bool minimize(Cvec3& p) const {
+    // solve A p = -b by Cramer's rule
+    const double c00 = a11 * a22 - a12 * a12, c01 = a02 * a12 - a01 * a22, c02 = a01 * a12 - a02 * a11;
+    const double det = a00 * c00 + a01 * c01 + a02 * c02;
+    const double scale = a00 + a11 + a22;
+    if (std::abs(det) <= 1e-12 * scale * scale * scale)
+      return false;
+    const double c11 = a00 * a22 - a02 * a02, c12 = a01 * a02 - a00 * a12, c22 = a00 * a11 - a01 * a01;
+    p[0] = -(c00 * a03 + c01 * a13 + c02 * a23) / det;
+    p[1] = -(c01 * a03 + c11 * a13 + c12 * a23) / det;
+    p[2] = -(c02 * a03 + c12 * a13 + c22 * a23) / det;
+    return true;
+  }
+};
+
+// Orders (a, b, triangle) edges by their end points
+struct EdgeLess {
+  bool operator () (const Triangle& e, const Triangle& f) const {
+    return e[0] < f[0] || (e[0] == f[0] && e[1] < f[1]);
+  }
+};
+
+// Kept small, as the heap holds many stale entries; the position is found
+// again when the collapse is made
+struct Collapse {
+  double cost;
+  int keep, remove;
+  unsigned keepVersion, removeVersion; // collapse is stale once these change
+
+  bool operator < (const Collapse& c) const {
+    return cost > c.cost; // cheapest on top of the heap
+  }
+};
+
+class Decimator {
+public:
+  Decimator(vector<Cvec3>& positions, vector<Triangle>& triangles);
+
+  // Returns the square root of the largest error of a collapse made
+  double run(int targetFaces, double maxError);
+
+  int getNumFaces() const {
+    return numFaces_;
+  }
+
+  bool isDead(int triangle) const {
+    return deadTriangles_[triangle] != 0;
+  }
+
+private:
+  // a boundary edge is held in place by planes this many times stronger
+  // than the face planes
+  static const double BOUNDARY_WEIGHT;
+
+  vector<Cvec3>& positions_;
+  vector<Triangle>& triangles_;
+  vector<char> deadTriangles_;
+  int numFaces_;
+
+  vector<Quadric> quadrics_;
+  vector<vector<int> > vertexTriangles_;
+  vector<unsigned> versions_;
+  vector<char> removed_, boundary_;
+
+  // scratch space for marking vertices
+  vector<unsigned> marks_;
+  unsigned mark_;
+
+  // binary heap of collapses, cheapest first, thinned out by dropStale()
+  // when stale entries dominate
+  vector<Collapse> heap_;
+
+  double findPosition(int a, int b, Cvec3& position) const;
+  void pushCollapse(int a, int b);
+  void dropStale();
+
+  bool isStale(const Collapse& c) const {
+    return removed_[c.keep] || removed_[c.remove] ||
+           versions_[c.keep] != c.keepVersion || versions_[c.remove] != c.removeVersion;
+  }
+  bool isValid(int keep, int remove, const Cvec3& position);
+  void collapse(int keep, int remove, const Cvec3& position);
+
+  unsigned newMark() {
+    if (++mark_ == 0) {
+      fill(marks_.begin(), marks_.end(), 0);
+      mark_ = 1;
+    }
+    return mark_;
+  }
+};
+
+const double Decimator::BOUNDARY_WEIGHT = 1000;
+
+Decimator::Decimator(vector<Cvec3>& positions, vector<Triangle>& triangles)
+  : positions_(positions)
+  , triangles_(triangles)
+  , deadTriangles_(triangles.size(), 0)
+  , numFaces_(triangles.size())
+  , quadrics_(positions.size())
+  , vertexTriangles_(positions.size())
+  , versions_(positions.size(), 0)
+  , removed_(positions.size(), 1)
+  , boundary_(positions.size(), 0)
+  , marks_(positions.size(), 0)
+  , mark_(0) {
+
+  vector<int> degrees(positions.size(), 0);
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    for (int j = 0; j < 3; ++j)
+      ++degrees[triangles[t][j]];
+  }
+  for (size_t v = 0; v < positions.size(); ++v)
+    vertexTriangles_[v].reserve(degrees[v]);
+
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    const Triangle& tri = triangles[t];
+    Cvec3 n = getTriangleNormal(positions[tri[0]], positions[tri[1]], positions[tri[2]]);
+    if (norm2(n) > 0) {
+      n.normalize();
+      const Quadric q(n, -dot(n, positions[tri[0]]), 1);
+      for (int j = 0; j < 3; ++j)
+        quadrics_[tri[j]] += q;
+    }
+    for (int j = 0; j < 3; ++j) {
+      vertexTriangles_[tri[j]].push_back(t);
+      removed_[tri[j]] = 0; // unused vertices stay removed
+    }
+  }
+
+  // each edge once, as (smaller vertex, larger vertex, triangle)
+  vector<Triangle> edges;
+  edges.reserve(3 * triangles.size());
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    for (int j = 0; j < 3; ++j) {
+      const int a = triangles[t][j], b = triangles[t][(j + 1) % 3];
+      edges.push_back(Triangle(min(a, b), max(a, b), t));
+    }
+  }
+  sort(edges.begin(), edges.end(), EdgeLess());
+
+  for (size_t i = 0; i < edges.size(); ) {
+    size_t j = i + 1;
+    while (j < edges.size() && edges[j][0] == edges[i][0] && edges[j][1] == edges[i][1])
+      ++j;
+
+    const int a = edges[i][0], b = edges[i][1];
+    if (j - i == 1) {
+      // boundary: add a plane through the edge, perpendicular to the face
+      const Triangle& tri = triangles[edges[i][2]];
+      const Cvec3 e = positions[b] - positions[a];
+      Cvec3 n = cross(e, getTriangleNormal(positions[tri[0]], positions[tri[1]], positions[tri[2]]));
+      if (norm2(n) > 0) {
+        n.normalize();
+        const Quadric q(n, -dot(n, positions[a]), BOUNDARY_WEIGHT);
+        quadrics_[a] += q;
+        quadrics_[b] += q;
+      }
+      boundary_[a] = boundary_[b] = 1;
+    }
+    i = j;
+  }
+
+  for (size_t i = 0; i < edges.size(); ++i) {
+    if (i == 0 || edges[i][0] != edges[i - 1][0] || edges[i][1] != edges[i - 1][1])
+      pushCollapse(edges[i][0], edges[i][1]);
+  }
+}
+
+// Where the end points of the edge ab should be merged to; returns the cost
+double Decimator::findPosition(int a, int b, Cvec3& position) const {
+  Quadric q = quadrics_[a];
+  q += quadrics_[b];
+
+  if (!q.minimize(position)) {
+    // degenerate quadric (e.g., flat region): best of the end points and middle
+    const Cvec3 candidates[3] = { positions_[a], positions_[b], (positions_[a] + positions_[b]) * 0.5 };
+    position = candidates[0];
+    for (int i = 1; i < 3; ++i) {
+      if (q.evaluate(candidates[i]) < q.evaluate(position))
+        position = candidates[i];
+    }
+  }
+  return max(0.0, q.evaluate(position));
+}
+
+void Decimator::pushCollapse(int a, int b) {
+  Cvec3 position;
+  Collapse c;
+  c.cost = findPosition(a, b, position);
+  c.keep = a;
+  c.remove = b;
+  c.keepVersion = versions_[a];
+  c.removeVersion = versions_[b];
+  heap_.push_back(c);
+  push_heap(heap_.begin(), heap_.end());
+}
+
+void Decimator::dropStale() {
+  size_t n = 0;
+  for (size_t i = 0; i < heap_.size(); ++i) {
+    if (!isStale(heap_[i]))
+      heap_[n++] = heap_[i];
+  }
+  heap_.resize(n);
+  make_heap(heap_.begin(), heap_.end());
+}
+
+bool Decimator::isValid(int keep, int remove, const Cvec3& position) {
+  // an interior edge between two boundary vertices would pinch the surface
+  const vector<int>& keepTriangles = vertexTriangles_[keep];
+  const vector<int>& removeTriangles = vertexTriangles_[remove];
+  int numShared = 0;
+  for (size_t i = 0; i < removeTriangles.size(); ++i) {
+    const int t = removeTriangles[i];
+    if (!deadTriangles_[t] && (triangles_[t][0] == keep || triangles_[t][1] == keep || triangles_[t][2] == keep))
+      ++numShared;
+  }
+  if (numShared == 0 || (numShared == 2 && boundary_[keep] && boundary_[remove]))
+    return false;
+
+  // link condition: the end points may only share the neighbors opposite
+  // the edge, otherwise the collapse would fold the surface onto itself
+  const unsigned mark = newMark();
+  for (size_t i = 0; i < keepTriangles.size(); ++i) {
+    const int t = keepTriangles[i];
+    if (deadTriangles_[t])
+      continue;
+    for (int j = 0; j < 3; ++j)
+      marks_[triangles_[t][j]] = mark;
+  }
+  int numCommon = 0;
+  const unsigned counted = newMark();
+  for (size_t i = 0; i < removeTriangles.size(); ++i) {
+    const int t = removeTriangles[i];
+    if (deadTriangles_[t])
+      continue;
+    for (int j = 0; j < 3; ++j) {
+      const int v = triangles_[t][j];
+      if (v == keep || v == remove)
+        continue;
+      if (marks_[v] == mark) {
+        ++numCommon;
+        marks_[v] = counted;
+      }
+    }
+  }
+  if (numCommon != numShared)
+    return false;
+
+  // no face may flip or degenerate
+  for (int k = 0; k < 2; ++k) {
+    const int moved = k == 0 ? keep : remove, other = k == 0 ? remove : keep;
+    const vector<int>& tris = vertexTriangles_[moved];
+    for (size_t i = 0; i < tris.size(); ++i) {
+      const int t = tris[i];
+      if (deadTriangles_[t])
+        continue;
+      const Triangle& tri = triangles_[t];
+      if (tri[0] == other || tri[1] == other || tri[2] == other)
+        continue;
+
+      Cvec3 p[3];
+      for (int j = 0; j < 3; ++j)
+        p[j] = tri[j] == moved ? position : positions_[tri[j]];
+      const Cvec3 oldNormal = getTriangleNormal(positions_[tri[0]], positions_[tri[1]], positions_[tri[2]]);
+      const Cvec3 newNormal = getTriangleNormal(p[0], p[1], p[2]);
+      const double oldLength = norm(oldNormal), newLength = norm(newNormal);
+      if (newLength <= 1e-12 * oldLength || dot(oldNormal, newNormal) < 0.2 * oldLength * newLength)
+        return false;
+    }
+  }
+  return true;
+}
+
+void Decimator::collapse(int keep, int remove, const Cvec3& position) {
+  vector<int>& keepTriangles = vertexTriangles_[keep];
+  vector<int>& removeTriangles = vertexTriangles_[remove];
+
+  for (size_t i = 0; i < removeTriangles.size(); ++i) {
+    const int t = removeTriangles[i];
+    if (deadTriangles_[t])
+      continue;
+    Triangle& tri = triangles_[t];
+    if (tri[0] == keep || tri[1] == keep || tri[2] == keep) {
+      deadTriangles_[t] = 1;
+      --numFaces_;
+      continue;
+    }
+    for (int j = 0; j < 3; ++j) {
+      if (tri[j] == remove)
+        tri[j] = keep;
+    }
+    keepTriangles.push_back(t);
+  }
+
+  // drop the dead triangles from the list
+  size_t n = 0;
+  for (size_t i = 0; i < keepTriangles.size(); ++i) {
+    if (!deadTriangles_[keepTriangles[i]])
+      keepTriangles[n++] = keepTriangles[i];
+  }
+  keepTriangles.resize(n);
+  vector<int>().swap(removeTriangles);
+
+  positions_[keep] = position;
+  quadrics_[keep] += quadrics_[remove];
+  boundary_[keep] = boundary_[keep] || boundary_[remove];
+  removed_[remove] = 1;
+  ++versions_[keep];
+  ++versions_[remove];
+
+  // every edge at the kept vertex has a new cost; the old entries are stale
+  const unsigned mark = newMark();
+  marks_[keep] = mark;
+  for (size_t i = 0; i < keepTriangles.size(); ++i) {
+    const Triangle& tri = triangles_[keepTriangles[i]];
+    for (int j = 0; j < 3; ++j) {
+      const int v = tri[j];
+      if (marks_[v] != mark) {
+        marks_[v] = mark;
+        pushCollapse(keep, v);
+      }
+    }
+  }
+}
+
+double Decimator::run(int targetFaces, double maxError) {
+  const double maxCost = maxError * maxError;
+  double maxCostDone = 0;
+  while (numFaces_ > targetFaces && !heap_.empty()) {
+    // a face has about 1.5 edges
+    if (heap_.size() > 8 * size_t(numFaces_))
+      dropStale();
+
+    const Collapse c = heap_.front();
+    pop_heap(heap_.begin(), heap_.end());
+    heap_.pop_back();
+    if (isStale(c))
+      continue;
+    if (c.cost > maxCost)
+      break;
+    Cvec3 position;
+    findPosition(c.keep, c.remove, position);
+    if (!isValid(c.keep, c.remove, position))
+      continue; // may come back once a neighbor has moved
+    collapse(c.keep, c.remove, position);
+    maxCostDone = max(maxCostDone, c.cost);
+  }
+  return sqrt(maxCostDone);
+}
+
+} // namespace
+
+DecimationReport decimateMesh(Mesh& mesh, Mesh& result, int targetFaces, double maxError) {
+  Stopwatch stopwatch;
+  DecimationReport report;
+  report.numFacesBefore = mesh.getNumFaces();
+  report.numVerticesBefore = mesh.getNumVertices();
+
+  vector<Cvec3> positions;
+  vector<Triangle> triangles;
+  getTriangles(mesh, positions, triangles);
+  sortSpatially(positions, triangles);
+
+  Decimator decimator(positions, triangles);
+  report.maxError = decimator.run(targetFaces, maxError);
+
+  // compact what is left
+  vector<int> newIndices(positions.size(), -1);
+  vector<Cvec3> newPositions;
+  vector<Cvec<int, 4> > faces;
+  faces.reserve(decimator.getNumFaces());
+  for (size_t t = 0; t < triangles.size(); ++t) {
+    if (decimator.isDead(t))
+      continue;
+    const Triangle& tri = triangles[t];
+    Cvec<int, 4> face(-1);
+    for (int j = 0; j < 3; ++j) {
+      int& v = newIndices[tri[j]];
+      if (v < 0) {
+        v = newPositions.size();
+        newPositions.push_back(positions[tri[j]]);
+      }
+      face[j] = v;
+    }
+    faces.push_back(face);
+  }
+  result.build(newPositions, faces);
+
+  report.numFacesAfter = result.getNumFaces();
+  report.numVerticesAfter = result.getNumVertices();
+  report.ms = stopwatch.elapsedMs();
+  return report;
+}
+
+// ---------- Distance between meshes
+
+namespace {
+
+// Closest point to p on the triangle abc (Ericson, Real-Time Collision
+// Detection, 5.1.5)
+Cvec3 closestPointOnTriangle(const Cvec3& p, const Cvec3& a, const Cvec3& b, const Cvec3& c) {
+  const Cvec3 ab = b - a, ac = c - a, ap = p - a;
+  const double d1 = dot(ab, ap), d2 = dot(ac, ap);
+  if (d1 <= 0 && d2 <= 0)
+    return a;
+
+  const Cvec3 bp = p - b;
+  const double d3 = dot(ab, bp), d4 = dot(ac, bp);
+  if (d3 >= 0 && d4 <= d3)
+    return b;
+
+  const double vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    return a + ab * (d1 / (d1 - d3));
+
+  const Cvec3 cp = p - c;
+  const double d5 = dot(ab, cp), d6 = dot(ac, cp);
+  if (d6 >= 0 && d5 <= d6)
+    return c;
+
+  const double vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    return a + ac * (d2 / (d2 - d6));
+
+  const double va = d3 * d6 - d5 * d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+  const double denom = 1 / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Uniform grid of triangles, for nearest point queries
+class TriangleGrid {
+public:
+  TriangleGrid(const vector<Cvec3>& positions, const vector<Triangle>& triangles);
+
+  double getDistance(const Cvec3& p) const;
+
+private:
+  const vector<Cvec3>& positions_;
+  const vector<Triangle>& triangles_;
+  Cvec3 min_;
+  double cellSize_;
+  int dims_[3];
+  vector<int> cellStarts_, cellTriangles_; // triangles of cell i: cellStarts_[i] .. cellStarts_[i + 1]
+
+  int getCell(double x, int axis) const {
+    return max(0, min(dims_[axis] - 1, int(floor((x - min_[axis]) / cellSize_))));
+  }
+};
+
+TriangleGrid::TriangleGrid(const vector<Cvec3>& positions, const vector<Triangle>& triangles)
+  : positions_(positions)
+  , triangles_(triangles) {
+  Cvec3 max_ = min_ = positions.empty() ? Cvec3(0) : positions[0];
+  for (size_t i = 0; i < positions.size(); ++i) {
+    for (int k = 0; k < 3; ++k) {
+      min_[k] = min(min_[k], positions[i][k]);
+      max_[k] = max(max_[k], positions[i][k]);
+    }
+  }
+  const Cvec3 size = max_ - min_;
+
+  // cells about twice the size of an average triangle, but no more than a
+  // few per triangle in total, as a surface only touches a thin layer of them
+  double area = 0;
+  for (size_t t = 0; t < triangles.size(); ++t)
+    area += norm(getTriangleNormal(positions[triangles[t][0]], positions[triangles[t][1]], positions[triangles[t][2]])) / 2;
+  const size_t numTriangles = max<size_t>(1, triangles.size());
+  const double volume = max(size[0], 1e-9) * max(size[1], 1e-9) * max(size[2], 1e-9);
+  cellSize_ = max(1e-9, max(2 * sqrt(area / numTriangles), cbrt(volume / (8.0 * numTriangles))));
+  for (int k = 0; k < 3; ++k)
+    dims_[k] = max(1, min(1024, int(ceil(size[k] / cellSize_))));
+
+  // bin the triangles by their bounding boxes, counting first
+  const int numCells = dims_[0] * dims_[1] * dims_[2];
+  cellStarts_.assign(numCells + 1, 0);
+  for (int pass = 0; pass < 2; ++pass) {
+    vector<int> fill(cellStarts_.begin(), cellStarts_.end() - 1);
+    for (size_t t = 0; t < triangles.size(); ++t) {
+      int lo[3], hi[3];
+      for (int k = 0; k < 3; ++k) {
+        const double a = positions[triangles[t][0]][k], b = positions[triangles[t][1]][k], c = positions[triangles[t][2]][k];
+        lo[k] = getCell(min(a, min(b, c)), k);
+        hi[k] = getCell(max(a, max(b, c)), k);
+      }
+      for (int z = lo[2]; z <= hi[2]; ++z)
+        for (int y = lo[1]; y <= hi[1]; ++y)
+          for (int x = lo[0]; x <= hi[0]; ++x) {
+            const int cell = (z * dims_[1] + y) * dims_[0] + x;
+            if (pass == 0)
+              ++cellStarts_[cell + 1];
+            else
+              cellTriangles_[fill[cell]++] = t;
+          }
+    }
+    if (pass == 0) {
+      for (int i = 0; i < numCells; ++i)
+        cellStarts_[i + 1] += cellStarts_[i];
+      cellTriangles_.resize(cellStarts_[numCells]);
+    }
+  }
+}
+
+double TriangleGrid::getDistance(const Cvec3& p) const {
+  const int c[3] = { getCell(p[0], 0), getCell(p[1], 1), getCell(p[2], 2) };
+  double best2 = numeric_limits<double>::infinity();
+
+  // search growing shells of cells around p, until no unsearched cell can
+  // be closer than the best triangle so far
+  const int maxR = max(dims_[0], max(dims_[1], dims_[2]));
+  for (int r = 0; r <= maxR; ++r) {
+    for (int z = c[2] - r; z <= c[2] + r; ++z) {
+      if (z < 0 || z >= dims_[2])
+        continue;
+      for (int y = c[1] - r; y <= c[1] + r; ++y) {
+        if (y < 0 || y >= dims_[1])
+          continue;
+        for (int x = c[0] - r; x <= c[0] + r; ++x) {
+          if (x < 0 || x >= dims_[0])
+            continue;
+          if (max(abs(x - c[0]), max(abs(y - c[1]), abs(z - c[2]))) != r)
+            continue; // inner shells are done
+          const int cell = (z * dims_[1] + y) * dims_[0] + x;
+          for (int i = cellStarts_[cell]; i < cellStarts_[cell + 1]; ++i) {
+            const Triangle& tri = triangles_[cellTriangles_[i]];
+            const Cvec3 q = closestPointOnTriangle(p, positions_[tri[0]], positions_[tri[1]], positions_[tri[2]]);
+            best2 = min(best2, norm2(p - q));
+          }
+        }
+      }
+    }
+    double bound = numeric_limits<double>::infinity();
+    for (int k = 0; k < 3; ++k) {
+      if (c[k] - r > 0)
+        bound = min(bound, p[k] - (min_[k] + (c[k] - r) * cellSize_));
+      if (c[k] + r < dims_[k] - 1)
+        bound = min(bound, min_[k] + (c[k] + r + 1) * cellSize_ - p[k]);
+    }
+    if (best2 <= bound * bound)
+      break;
+  }
+  return sqrt(best2);
+}
+
+// Adds the distances of the vertices and triangle centers of `from' to the
+// surface of `to'
+void addDistances(const vector<Cvec3>& fromPositions, const vector<Triangle>& fromTriangles,
+                  const TriangleGrid& to, MeshDistance& distance, double& sum, int& count) {
+  for (size_t i = 0; i < fromPositions.size(); ++i) {
+    const double d = to.getDistance(fromPositions[i]);
+    distance.maxDistance = max(distance.maxDistance, d);
+    sum += d;
+  }
+  for (size_t t = 0; t < fromTriangles.size(); ++t) {
+    const Triangle& tri = fromTriangles[t];
+    const double d = to.getDistance((fromPositions[tri[0]] + fromPositions[tri[1]] + fromPositions[tri[2]]) / 3);
+    distance.maxDistance = max(distance.maxDistance, d);
+    sum += d;
+  }
+  count += fromPositions.size() + fromTriangles.size();
+}
+
+} // namespace
+
+MeshDistance measureMeshDistance(Mesh& a, Mesh& b) {
+  vector<Cvec3> aPositions, bPositions;
+  vector<Triangle> aTriangles, bTriangles;
+  getTriangles(a, aPositions, aTriangles);
+  getTriangles(b, bPositions, bTriangles);
+  sortSpatially(aPositions, aTriangles);
+  sortSpatially(bPositions, bTriangles);
+
+  MeshDistance distance;
+  distance.maxDistance = 0;
+  double sum = 0;
+  int count = 0;
+  addDistances(aPositions, aTriangles, TriangleGrid(bPositions, bTriangles), distance, sum, count);
+  addDistances(bPositions, bTriangles, TriangleGrid(aPositions, aTriangles), distance, sum, count);
+  distance.meanDistance = count > 0 ? sum / count : 0;
+  return distance;
+}
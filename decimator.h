@@ -0,0 +1,41 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <limits>
+
+#include "mesh.h"
+
+struct DecimationReport {
+  int numFacesBefore, numFacesAfter;
+  int numVerticesBefore, numVerticesAfter;
+
+  // Square root of the largest quadric error of any collapse made. The
+  // quadric error of a vertex is the sum of its squared distances to the
+  // planes of the original faces merged into it.
+  double maxError;
+
+  double ms;
+};
+
+// Simplifies `mesh' into `result' by edge collapses, cheapest first by
+// quadric error (Garland & Heckbert). Quads are split into triangles, so
+// the result is all triangles.
+//
+// Collapses continue until the result has at most targetFaces faces or the
+// next collapse would have an error above maxError (as in
+// DecimationReport::maxError). Collapses that would flip a face or make the
+// surface non manifold are skipped, so the target may not be reached.
+// Boundary edges are kept in place by additional planes through them.
+DecimationReport decimateMesh(Mesh& mesh, Mesh& result, int targetFaces,
+                              double maxError = std::numeric_limits<double>::infinity());
+
+struct MeshDistance {
+  double maxDistance, meanDistance;
+};
+
+// Approximates the Hausdorff distance between the surfaces of two meshes,
+// from the distances of the vertices and face centers of each mesh to the
+// surface of the other one.
+MeshDistance measureMeshDistance(Mesh& a, Mesh& b);
+
+#endif
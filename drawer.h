@@ -27,8 +27,9 @@ public:
   }
 
   virtual bool visit(SgShapeNode& shapeNode) {
-    const Matrix4 MVM = rigTFormToMatrix(rbtStack_.back()) * shapeNode.getAffineMatrix();
-    sendModelViewNormalMatrix(uniforms_, MVM, normalMatrix(MVM));
+    Matrix4 MVM, NMVM;
+    shapeNode.getModelViewMatrices(rbtStack_.back(), MVM, NMVM);
+    sendModelViewNormalMatrix(uniforms_, MVM, NMVM);
     shapeNode.draw(uniforms_);
     return true;
   }
@@ -0,0 +1,236 @@
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+#include "flatscene.h"
+#include "arcball.h"
+#include "jobsystem.h"
+#include "profiler.h"
+
+using namespace std;
+
+// Appends the nodes to the arrays in depth first order
+class FlatSceneCompiler : public SgNodeVisitor {
+  vector<SgTransformNode*>& transformNodes_;
+  vector<int>& parents_;
+  vector<int>& subtreeEnds_;
+  vector<SgGeometryShapeNode*>& shapeNodes_;
+  vector<int>& shapeParents_;
+  vector<int> stack_; // indices of the transform nodes on the current path
+
+public:
+  FlatSceneCompiler(vector<SgTransformNode*>& transformNodes, vector<int>& parents, vector<int>& subtreeEnds,
+                    vector<SgGeometryShapeNode*>& shapeNodes, vector<int>& shapeParents)
+    : transformNodes_(transformNodes)
+    , parents_(parents)
+    , subtreeEnds_(subtreeEnds)
+    , shapeNodes_(shapeNodes)
+    , shapeParents_(shapeParents) {}
+
+  virtual bool visit(SgTransformNode& node) {
+    parents_.push_back(stack_.empty() ? -1 : stack_.back());
+    subtreeEnds_.push_back(-1);
+    stack_.push_back(transformNodes_.size());
+    transformNodes_.push_back(&node);
+    return true;
+  }
+
+  virtual bool postVisit(SgTransformNode& /*node*/) {
+    subtreeEnds_[stack_.back()] = transformNodes_.size();
+    stack_.pop_back();
+    return true;
+  }
+
+  virtual bool visit(SgShapeNode& node) {
+    SgGeometryShapeNode* shape = dynamic_cast<SgGeometryShapeNode*>(&node);
+    if (!shape)
+      throw runtime_error("FlatSceneGraph: unsupported shape node type");
+    shapeNodes_.push_back(shape);
+    shapeParents_.push_back(stack_.back());
+    return true;
+  }
+};
+
+struct FlatSceneGraph::UpdateLocalRbts {
+  FlatSceneGraph& scene;
+
+  UpdateLocalRbts(FlatSceneGraph& _scene) : scene(_scene) {}
+
+  void operator () (int begin, int end) const {
+    for (int i = begin; i < end; ++i)
+      scene.localRbts_[i] = scene.transformNodes_[i]->getRbt();
+  }
+};
+
+struct FlatSceneGraph::AccumulateRanges {
+  FlatSceneGraph& scene;
+
+  AccumulateRanges(FlatSceneGraph& _scene) : scene(_scene) {}
+
+  void operator () (int begin, int end) const {
+    PROFILE_ZONE("accumulateRanges");
+    const int *parents = &scene.parents_[0];
+    const RigTForm *localRbts = &scene.localRbts_[0];
+    RigTForm *eyeRbts = &scene.eyeRbts_[0];
+    for (int k = begin; k < end; ++k) {
+      // the parents of the subtree roots are above the range, hence done
+      for (int i = scene.ranges_[k].first, e = scene.ranges_[k].second; i < e; ++i)
+        eyeRbts[i] = eyeRbts[parents[i]] * localRbts[i];
+    }
+  }
+};
+
+struct FlatSceneGraph::FillRenderItems {
+  const FlatSceneGraph& scene;
+  RenderItem *items;
+
+  FillRenderItems(const FlatSceneGraph& _scene, RenderItem *_items) : scene(_scene), items(_items) {}
+
+  void operator () (int begin, int end) const {
+    PROFILE_ZONE("fillRenderItems");
+    for (int i = begin; i < end; ++i) {
+      SgGeometryShapeNode& shape = *scene.shapeNodes_[i];
+      RenderItem& item = items[i];
+      shape.getModelViewMatrices(scene.eyeRbts_[scene.shapeParents_[i]], item.MVM, item.NMVM);
+      item.geometry = shape.geometry;
+      item.material = shape.material;
+
+      const LodGeometry *lods = scene.lodScreenHeight_ > 0 ? scene.findLods(shape.geometry.get()) : NULL;
+      if (lods) {
+        shape.lodLevel = lods->selectLevel(scene.getPixelRadius(item.MVM, lods->getBoundingRadius()), shape.lodLevel);
+        item.geometry = lods->getGeometry(shape.lodLevel);
+      }
+    }
+  }
+};
+
+void FlatSceneGraph::setLods(const shared_ptr<Geometry>& geometry, const shared_ptr<LodGeometry>& lods) {
+  for (size_t i = 0; i < lods_.size(); ++i) {
+    if (lods_[i].first == geometry.get()) {
+      lods_[i].second = lods;
+      return;
+    }
+  }
+  lods_.push_back(make_pair(geometry.get(), lods));
+}
+
+const LodGeometry* FlatSceneGraph::findLods(const Geometry* geometry) const {
+  // only ever a handful of entries
+  for (size_t i = 0; i < lods_.size(); ++i) {
+    if (lods_[i].first == geometry)
+      return lods_[i].second.get();
+  }
+  return NULL;
+}
+
+double FlatSceneGraph::getPixelRadius(const Matrix4& MVM, double radius) const {
+  // the center must be in front of the eye; anything else is up close
+  const double z = MVM(2, 3);
+  if (z > -CS175_EPS)
+    return numeric_limits<double>::infinity();
+
+  // largest scale of the linear part
+  double scale2 = 0;
+  for (int j = 0; j < 3; ++j)
+    scale2 = max(scale2, MVM(0, j) * MVM(0, j) + MVM(1, j) * MVM(1, j) + MVM(2, j) * MVM(2, j));
+  return radius * sqrt(scale2) / getScreenToEyeScale(z, lodFovY_, lodScreenHeight_);
+}
+
+// Runs body over [0, n) on the jobs, or serially
+template<typename Body>
+static void runRange(JobSystem *jobs, int n, int grainSize, const Body& body) {
+  if (jobs && n > grainSize)
+    jobs->parallelFor(0, n, grainSize, body);
+  else if (n > 0)
+    body(0, n);
+}
+
+void FlatSceneGraph::addRange(int begin, int end) {
+  if (begin < end)
+    ranges_.push_back(make_pair(begin, end));
+}
+
+// Makes `node' an upper node and cuts its descendents into ranges
+void FlatSceneGraph::partition(int node) {
+  upperNodes_.push_back(node);
+
+  // runs of small sibling subtrees are merged into one range
+  int begin = node + 1, end = node + 1;
+  for (int child = node + 1; child < subtreeEnds_[node]; child = subtreeEnds_[child]) {
+    if (subtreeEnds_[child] - child > SUBTREE_SIZE) {
+      addRange(begin, end);
+      partition(child);
+      begin = end = subtreeEnds_[child];
+    }
+    else {
+      end = subtreeEnds_[child];
+      if (end - begin >= SUBTREE_SIZE) {
+        addRange(begin, end);
+        begin = end;
+      }
+    }
+  }
+  addRange(begin, end);
+}
+
+void FlatSceneGraph::compile(SgTransformNode& root) {
+  PROFILE_ZONE("compileFlatScene");
+  transformNodes_.clear();
+  parents_.clear();
+  subtreeEnds_.clear();
+  shapeNodes_.clear();
+  shapeParents_.clear();
+
+  FlatSceneCompiler compiler(transformNodes_, parents_, subtreeEnds_, shapeNodes_, shapeParents_);
+  root.accept(compiler);
+
+  const int n = transformNodes_.size();
+  localRbts_.resize(n);
+  eyeRbts_.resize(n);
+  transformIndices_.clear();
+  for (int i = 0; i < n; ++i)
+    transformIndices_[transformNodes_[i]] = i;
+
+  ranges_.clear();
+  upperNodes_.clear();
+  partition(0);
+
+  root_ = &root;
+  structureVersion_ = SgTransformNode::getStructureVersion();
+}
+
+void FlatSceneGraph::update(const shared_ptr<SgTransformNode>& root, JobSystem *jobs) {
+  PROFILE_ZONE("updateFlatScene");
+  if (transformNodes_.empty() || root_ != root.get() ||
+      structureVersion_ != SgTransformNode::getStructureVersion())
+    compile(*root);
+
+  runRange(jobs, transformNodes_.size(), 4 * SUBTREE_SIZE, UpdateLocalRbts(*this));
+}
+
+void FlatSceneGraph::buildSnapshot(const RigTForm& invEyeRbt, FrameSnapshot& snapshot, JobSystem *jobs) {
+  // the nodes above the subtrees, parents before their children
+  eyeRbts_[0] = invEyeRbt * localRbts_[0];
+  for (size_t k = 1; k < upperNodes_.size(); ++k) {
+    const int i = upperNodes_[k];
+    eyeRbts_[i] = eyeRbts_[parents_[i]] * localRbts_[i];
+  }
+  runRange(jobs, ranges_.size(), 1, AccumulateRanges(*this));
+
+  const int first = snapshot.items.size(), numShapes = shapeNodes_.size();
+  snapshot.items.resize(first + numShapes);
+  if (numShapes > 0)
+    runRange(jobs, numShapes, SUBTREE_SIZE, FillRenderItems(*this, &snapshot.items[first]));
+}
+
+RigTForm FlatSceneGraph::getWorldRbt(const SgTransformNode& node) const {
+  unordered_map<const SgTransformNode*, int>::const_iterator i = transformIndices_.find(&node);
+  if (i == transformIndices_.end())
+    throw runtime_error("FlatSceneGraph: node not in the scene");
+
+  RigTForm rbt;
+  for (int j = i->second; j >= 0; j = parents_[j])
+    rbt = localRbts_[j] * rbt;
+  return rbt;
+}
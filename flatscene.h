@@ -0,0 +1,113 @@
+#ifndef FLATSCENE_H
+#define FLATSCENE_H
+
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <memory>
+
+#include "rigtform.h"
+#include "scenegraph.h"
+#include "framesnapshot.h"
+#include "lod.h"
+
+class JobSystem;
+
+// A compiled copy of a scene graph, laid out for linear passes.
+//
+// The transform nodes are stored in depth first order in parallel arrays of
+// parent indices, local frames and accumulated frames, so every parent comes
+// before its children and all frames can be accumulated in one sweep over
+// the arrays. Shape nodes are stored in a second array that refers to their
+// parents by index. The scene graph stays the authoring layer: update()
+// re-reads the node Rbts, and recompiles when nodes have been added or
+// removed anywhere in the graph since the last compile.
+//
+// In depth first order every subtree is a contiguous range of the arrays,
+// and so is a run of sibling subtrees. The compile step cuts the tree into
+// such ranges of about SUBTREE_SIZE nodes, plus the few nodes above them.
+// Given a JobSystem, the frames of the ranges are then accumulated in
+// parallel, after the nodes above them have been done serially, and the
+// render items are filled in parallel too.
+//
+// Shapes whose geometry has been given levels of detail with setLods() are
+// drawn at the level matching their size on screen.
+//
+// Only raw pointers to the nodes are kept, so the graph must not change
+// between update() and the calls reading from it.
+class FlatSceneGraph {
+public:
+  static const int SUBTREE_SIZE = 1024;
+
+  FlatSceneGraph() : root_(NULL), structureVersion_(0), lodFovY_(0), lodScreenHeight_(0) {}
+
+  // Shapes drawing `geometry' get drawn at one of the levels of `lods'
+  // instead
+  void setLods(const std::shared_ptr<Geometry>& geometry, const std::shared_ptr<LodGeometry>& lods);
+
+  // Field of view and viewport height the levels of detail are picked for.
+  // Levels of detail are off while screenHeight is 0.
+  void setLodViewport(double fovY, int screenHeight) {
+    lodFovY_ = fovY;
+    lodScreenHeight_ = screenHeight;
+  }
+
+  // Brings the arrays and local frames up to date with the graph under root.
+  // Runs on `jobs' if given.
+  void update(const std::shared_ptr<SgTransformNode>& root, JobSystem *jobs = NULL);
+
+  // Accumulates the frames of all transform nodes with respect to the eye,
+  // and appends a render item for every shape node to the snapshot. Runs on
+  // `jobs' if given.
+  void buildSnapshot(const RigTForm& invEyeRbt, FrameSnapshot& snapshot, JobSystem *jobs = NULL);
+
+  // Frame of a transform node with respect to the root, accumulated along
+  // its path. Throws if the node was not under the root at the last
+  // update().
+  RigTForm getWorldRbt(const SgTransformNode& node) const;
+
+  int getNumTransformNodes() const {
+    return transformNodes_.size();
+  }
+
+  int getNumShapeNodes() const {
+    return shapeNodes_.size();
+  }
+
+private:
+  struct UpdateLocalRbts;
+  struct AccumulateRanges;
+  struct FillRenderItems;
+
+  void compile(SgTransformNode& root);
+  const LodGeometry* findLods(const Geometry* geometry) const;
+  double getPixelRadius(const Matrix4& MVM, double radius) const;
+  void partition(int node);
+  void addRange(int begin, int end);
+
+  // transform nodes, depth first
+  std::vector<SgTransformNode*> transformNodes_;
+  std::vector<int> parents_; // -1 for the root
+  std::vector<int> subtreeEnds_; // one past the last node of the subtree
+  std::vector<RigTForm> localRbts_;
+  std::vector<RigTForm> eyeRbts_; // with respect to the eye, by buildSnapshot()
+  std::unordered_map<const SgTransformNode*, int> transformIndices_;
+
+  // Ranges of sibling subtrees accumulated in parallel, as (begin, end)
+  // pairs, and the nodes above them in depth first order
+  std::vector<std::pair<int, int> > ranges_;
+  std::vector<int> upperNodes_;
+
+  // shape nodes, in drawing order
+  std::vector<SgGeometryShapeNode*> shapeNodes_;
+  std::vector<int> shapeParents_;
+
+  const SgTransformNode* root_;
+  unsigned structureVersion_;
+
+  std::vector<std::pair<const Geometry*, std::shared_ptr<LodGeometry> > > lods_;
+  double lodFovY_;
+  int lodScreenHeight_;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include "asstcommon.h"
+#include "framesnapshot.h"
+#include "profiler.h"
+#include "gputimer.h"
+
+using namespace std;
+
+int FrameSnapshot::submit(Uniforms& extraUniforms, GpuTimer *timer) const {
+  PROFILE_ZONE("submit");
+  int gpuPass = -1, numTriangles = 0;
+  for (size_t i = 0, n = items.size(); i < n; ++i) {
+    const RenderItem& item = items[i];
+    if (timer && item.gpuPass != gpuPass) {
+      if (gpuPass >= 0)
+        timer->end(gpuPass);
+      gpuPass = item.gpuPass;
+      if (gpuPass >= 0)
+        timer->begin(gpuPass);
+    }
+    sendModelViewNormalMatrix(extraUniforms, item.MVM, item.NMVM);
+    if (g_overridingMaterial)
+      g_overridingMaterial->draw(*item.geometry, extraUniforms);
+    else
+      item.material->draw(*item.geometry, extraUniforms);
+    numTriangles += item.geometry->getNumTriangles();
+  }
+  if (timer && gpuPass >= 0)
+    timer->end(gpuPass);
+  return numTriangles;
+}
+
+bool SnapshotBuilder::visit(SgTransformNode& node) {
+  rbtStack_.push_back(rbtStack_.back() * node.getRbt());
+  return true;
+}
+
+bool SnapshotBuilder::postVisit(SgTransformNode& /*node*/) {
+  rbtStack_.pop_back();
+  return true;
+}
+
+bool SnapshotBuilder::visit(SgShapeNode& node) {
+  SgGeometryShapeNode* shape = dynamic_cast<SgGeometryShapeNode*>(&node);
+  if (!shape)
+    throw runtime_error("SnapshotBuilder: unsupported shape node type");
+
+  snapshot_.items.push_back(RenderItem());
+  RenderItem& item = snapshot_.items.back();
+  shape->getModelViewMatrices(rbtStack_.back(), item.MVM, item.NMVM);
+  item.geometry = shape->geometry;
+  item.material = shape->material;
+  return true;
+}
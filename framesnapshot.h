@@ -0,0 +1,122 @@
+#ifndef FRAMESNAPSHOT_H
+#define FRAMESNAPSHOT_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+#include "cvec.h"
+#include "matrix4.h"
+#include "rigtform.h"
+#include "glsupport.h" // for Noncopyable
+#include "uniforms.h"
+#include "scenegraph.h"
+
+class GpuTimer;
+
+// One draw call of a frame: everything needed to submit a shape without
+// touching the scene graph again.
+struct RenderItem {
+  Matrix4 MVM, NMVM;
+  std::shared_ptr<Geometry> geometry;
+  std::shared_ptr<Material> material;
+
+  // GpuTimer pass the draw call is timed under, or -1
+  int gpuPass;
+
+  RenderItem() : gpuPass(-1) {}
+};
+
+// An immutable, flattened picture of the scene for one frame. It is built by
+// the update thread from the scene graph and consumed by the thread owning
+// the GL context, so the two can overlap.
+struct FrameSnapshot {
+  std::vector<RenderItem> items;
+
+  // Per frame uniforms (lights etc.) that do not depend on the window
+  Uniforms uniforms;
+
+  RigTForm eyeRbt;
+  Cvec3 clearColor;
+  double timeOfDay;
+
+  // Time spent producing this snapshot, in milliseconds
+  double updateMs, snapshotMs;
+
+  // getChangeCount() once the snapshot was built, and whether the update
+  // that built it changed anything (if not, the scene has settled)
+  unsigned changeCount;
+  bool updateChanged;
+
+  FrameSnapshot() : timeOfDay(0), updateMs(0), snapshotMs(0), changeCount(0), updateChanged(true) {}
+
+  // Drops the items but keeps the allocated storage around for reuse
+  void clear() {
+    items.clear();
+    uniforms = Uniforms();
+  }
+
+  // Draws all items. `uniforms' should contain the projection matrix and
+  // any other window dependent values. If a timer is given, runs of items
+  // with the same gpuPass are timed as that pass. Returns the number of
+  // triangles drawn, as far as the geometries know.
+  int submit(Uniforms& uniforms, GpuTimer *timer = NULL) const;
+};
+
+// Visitor that flattens the scene graph into a FrameSnapshot
+class SnapshotBuilder : public SgNodeVisitor {
+  std::vector<RigTForm> rbtStack_;
+  FrameSnapshot& snapshot_;
+
+public:
+  SnapshotBuilder(const RigTForm& initialRbt, FrameSnapshot& snapshot)
+    : rbtStack_(1, initialRbt)
+    , snapshot_(snapshot) {}
+
+  virtual bool visit(SgTransformNode& node);
+  virtual bool postVisit(SgTransformNode& node);
+  virtual bool visit(SgShapeNode& node);
+};
+
+// Lock-protected triple buffer. The producer fills back() and publish()es it,
+// the consumer acquire()s the most recently published buffer and reads it from
+// front(). Neither side ever waits for the other to finish a frame.
+template<typename T>
+class TripleBuffer : Noncopyable {
+  T buffers_[3];
+  int back_, pending_, front_;
+  bool fresh_;
+  std::mutex mutex_;
+
+public:
+  TripleBuffer() : back_(0), pending_(1), front_(2), fresh_(false) {}
+
+  T& back() {
+    return buffers_[back_];
+  }
+
+  const T& front() const {
+    return buffers_[front_];
+  }
+
+  // Hands the back buffer over to the consumer
+  void publish() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::swap(back_, pending_);
+    fresh_ = true;
+  }
+
+  // Makes the latest published buffer the front buffer. Returns false if
+  // nothing new was published since the last call.
+  bool acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!fresh_)
+      return false;
+    std::swap(front_, pending_);
+    fresh_ = false;
+    return true;
+  }
+};
+
+#endif
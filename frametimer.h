@@ -0,0 +1,83 @@
+#ifndef FRAMETIMER_H
+#define FRAMETIMER_H
+
+#include <chrono>
+#include <iostream>
+
+// Measures elapsed wall clock time in milliseconds
+class Stopwatch {
+  typedef std::chrono::high_resolution_clock Clock;
+  Clock::time_point start_;
+
+public:
+  Stopwatch() : start_(Clock::now()) {}
+
+  void reset() {
+    start_ = Clock::now();
+  }
+
+  double elapsedMs() const {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start_).count();
+  }
+};
+
+// Keeps running averages of how long each stage of a frame takes.
+// Only to be used from a single thread.
+class FrameStats {
+public:
+  enum Stage { UPDATE = 0, SNAPSHOT, SUBMIT, FRAME, SIMULATE, SHELLS, NUM_STAGES };
+
+  FrameStats() : numFrames_(0), numSkipped_(0), numDrawCalls_(0), numTriangles_(0) {
+    for (int i = 0; i < NUM_STAGES; ++i)
+      avgMs_[i] = 0;
+  }
+
+  void record(Stage stage, double ms) {
+    // exponential moving average over roughly the last 30 frames
+    const double alpha = numFrames_ == 0 ? 1.0 : 1.0 / 30;
+    avgMs_[stage] += (ms - avgMs_[stage]) * alpha;
+  }
+
+  // Number of scene graph draw calls and triangles in the latest frame
+  void setNumDrawCalls(int numDrawCalls, int numTriangles) {
+    numDrawCalls_ = numDrawCalls;
+    numTriangles_ = numTriangles;
+  }
+
+  void endFrame() {
+    ++numFrames_;
+  }
+
+  // A frame not redrawn since nothing had changed
+  void skipFrame() {
+    ++numSkipped_;
+  }
+
+  double getAverageMs(Stage stage) const {
+    return avgMs_[stage];
+  }
+
+  int getNumFrames() const {
+    return numFrames_;
+  }
+
+  int getNumSkipped() const {
+    return numSkipped_;
+  }
+
+  void print(std::ostream& os) const {
+    static const char *names[NUM_STAGES] = { "update", "snapshot", "submit", "frame", "simulate", "shells" };
+    os << "Frame " << numFrames_ << " (ms):";
+    for (int i = 0; i < NUM_STAGES; ++i)
+      os << ' ' << names[i] << ' ' << avgMs_[i];
+    os << ", " << numDrawCalls_ << " draw calls, " << numTriangles_ << " triangles, "
+       << numSkipped_ << " frames skipped" << std::endl;
+  }
+
+private:
+  double avgMs_[NUM_STAGES];
+  int numFrames_, numSkipped_;
+  int numDrawCalls_, numTriangles_;
+};
+
+#endif
@@ -1,28 +1,96 @@
 #include <stdexcept>
 #include <string>
 #include <cstddef>
+#include <map>
+#include <algorithm>
 
 #include "geometry.h"
 
 using namespace std;
-using namespace tr1;
 
-const VertexFormat VertexPN::FORMAT = VertexFormat(sizeof(VertexPN))
+const VertexFormat VertexPN::FORMAT = VertexFormat(sizeof(VertexPN), "PN")
                                       .put("aPosition", 3, GL_FLOAT, GL_FALSE, offsetof(VertexPN, p))
                                       .put("aNormal", 3, GL_FLOAT, GL_FALSE, offsetof(VertexPN, n));
 
-const VertexFormat VertexPNX::FORMAT = VertexFormat(sizeof(VertexPNX))
+const VertexFormat VertexPNX::FORMAT = VertexFormat(sizeof(VertexPNX), "PNX")
                                        .put("aPosition", 3, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, p))
                                        .put("aNormal", 3, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, n))
                                        .put("aTexCoord", 2, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, x));
 
-const VertexFormat VertexPNTBX::FORMAT = VertexFormat(sizeof(VertexPNTBX))
+const VertexFormat VertexPNTBX::FORMAT = VertexFormat(sizeof(VertexPNTBX), "PNTBX")
                                          .put("aPosition", 3, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, p))
                                          .put("aNormal", 3, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, n))
                                          .put("aTangent", 3, GL_FLOAT, GL_FALSE, offsetof(VertexPNTBX, t))
                                          .put("aBinormal", 3, GL_FLOAT, GL_FALSE, offsetof(VertexPNTBX, b))
                                          .put("aTexCoord", 2, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, x));
 
+const VertexFormat PackedVertexPNX::FORMAT = VertexFormat(sizeof(PackedVertexPNX), "packed PNX")
+                                             .put("aPosition", 4, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertexPNX, p))
+                                             .put("aNormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(PackedVertexPNX, n))
+                                             .put("aTexCoord", 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertexPNX, x));
+
+const VertexFormat PackedVertexPNTBX::FORMAT = VertexFormat(sizeof(PackedVertexPNTBX), "packed PNTBX")
+                                               .put("aPosition", 4, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertexPNTBX, p))
+                                               .put("aNormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(PackedVertexPNTBX, n))
+                                               .put("aTangent", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(PackedVertexPNTBX, t))
+                                               .put("aBinormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(PackedVertexPNTBX, b))
+                                               .put("aTexCoord", 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertexPNTBX, x));
+
+namespace {
+
+struct FormatMemory {
+  int numBuffers;
+  long long numVertices;
+
+  FormatMemory() : numBuffers(0), numVertices(0) {}
+};
+
+// formats outlive the buffers using them, so they can be the keys. Never
+// destroyed: buffers held by globals are destroyed at exit, in no
+// particular order with respect to a function local static.
+map<const VertexFormat*, FormatMemory>& getFormatMemory() {
+  static map<const VertexFormat*, FormatMemory>* formatMemory = new map<const VertexFormat*, FormatMemory>();
+  return *formatMemory;
+}
+
+struct MemoryUsageGreater {
+  bool operator () (const VertexMemoryUsage& a, const VertexMemoryUsage& b) const {
+    return a.numVertices * a.vertexSize > b.numVertices * b.vertexSize;
+  }
+};
+
+} // namespace
+
+bool isPackedNormalSupported() {
+#ifdef __MAC__
+  return true; // the core profile contexts there all take them
+#else
+  return GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev;
+#endif
+}
+
+void FormattedVbo::trackMemory(int numBuffers, int newLength) {
+  FormatMemory& memory = getFormatMemory()[&format_];
+  memory.numBuffers += numBuffers;
+  memory.numVertices += (numBuffers < 0 ? 0 : newLength) - length_;
+}
+
+vector<VertexMemoryUsage> getVertexMemoryUsage() {
+  vector<VertexMemoryUsage> usage;
+  const map<const VertexFormat*, FormatMemory>& formatMemory = getFormatMemory();
+  for (map<const VertexFormat*, FormatMemory>::const_iterator i = formatMemory.begin(); i != formatMemory.end(); ++i) {
+    if (i->second.numBuffers == 0)
+      continue;
+    VertexMemoryUsage u;
+    u.formatName = i->first->getName();
+    u.vertexSize = i->first->getVertexSize();
+    u.numBuffers = i->second.numBuffers;
+    u.numVertices = i->second.numVertices;
+    usage.push_back(u);
+  }
+  sort(usage.begin(), usage.end(), MemoryUsageGreater());
+  return usage;
+}
 
 BufferObjectGeometry::BufferObjectGeometry()
   : wiringChanged_(true),
@@ -113,6 +181,18 @@ void BufferObjectGeometry::draw(int attribIndices[]) {
   }
 }
 
+int BufferObjectGeometry::getNumTriangles() {
+  if (primitiveType_ != GL_TRIANGLES)
+    return 0;
+  if (isIndexed())
+    return ib_->length() / 3;
+
+  int vboLen = -1;
+  for (Wiring::const_iterator i = wiring_.begin(), e = wiring_.end(); i != e; ++i)
+    vboLen = vboLen < 0 ? i->second.first->length() : min(vboLen, i->second.first->length());
+  return max(vboLen, 0) / 3;
+}
+
 void BufferObjectGeometry::processWiring() {
   perVbWirings_.clear();
   vertexAttribNames_.clear();
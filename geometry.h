@@ -9,13 +9,13 @@
 #include <stdexcept>
 #include <memory>
 
-#if __GNUG__
-#   include <tr1/memory>
-#endif
 
 #include "cvec.h"
 #include "glsupport.h"
 #include "geometrymaker.h"
+#include "vertexcache.h"
+#include "vertexpacking.h"
+#include "changetracker.h"
 
 // An abstract class that encapsulates geometry data that provides vertex attributes and
 // know how to draw itself.
@@ -30,6 +30,11 @@ public:
   // not used. The caller is responsible for enable/disable vertex attribute arrays.
   virtual void draw(int attribIndices[]) = 0;
 
+  // Number of triangles a draw() call submits, or 0 if not known
+  virtual int getNumTriangles() {
+    return 0;
+  }
+
   virtual ~Geometry() {}
 };
 
@@ -63,11 +68,19 @@ public:
       assert(_name != "");   // some basic sanity checks
       assert(_size > 0);
       assert(_offset >= 0);
+      // packed types hold all four components in one 32 bit word
+      assert(_size == 4 || (_type != GL_INT_2_10_10_10_REV && _type != GL_UNSIGNED_INT_2_10_10_10_REV));
     }
   };
 
-  // Initialize to zero attributes
-  VertexFormat(int vertexSize) : vertexSize_(vertexSize) {}
+  // Initialize to zero attributes. The name is only for reports, such as
+  // the one of getVertexMemoryUsage().
+  VertexFormat(int vertexSize, const std::string& name = "")
+    : vertexSize_(vertexSize), name_(name) {}
+
+  const std::string& getName() const {
+    return name_;
+  }
 
   // append a new attrib description
   VertexFormat& put(const std::string& name, GLint size, GLenum type, GLboolean normalized, int offset) {
@@ -111,10 +124,22 @@ public:
 
 private:
   const int vertexSize_;
+  const std::string name_;
   std::vector<AttribDesc> attribDescs_;
   std::map<std::string, int> name2Idx_;
 };
 
+// Memory held by the vertex buffers of one vertex format
+struct VertexMemoryUsage {
+  std::string formatName;
+  int vertexSize;
+  int numBuffers;
+  long long numVertices;
+};
+
+// Memory held by all FormattedVbos, by their vertex format, largest first
+std::vector<VertexMemoryUsage> getVertexMemoryUsage();
+
 // Light wrapper for a GL buffer object storing vertices, together with format for its vertices.
 class FormattedVbo : public GlBufferObject {
   const VertexFormat& format_;
@@ -125,7 +150,13 @@ public:
   // should either pass in a static global variable, or ensure its lifespan
   // encompasses the lifespan of the FormmatedVbo
   FormattedVbo(const VertexFormat& formatDesc)
-    : format_(formatDesc), length_(0) {}
+    : format_(formatDesc), length_(0) {
+    trackMemory(1, 0);
+  }
+
+  ~FormattedVbo() {
+    trackMemory(-1, 0);
+  }
 
   const VertexFormat& getVertexFormat() const {
     return format_;
@@ -142,6 +173,7 @@ public:
   void upload(const Vertex* vertices, int length, bool dynamicUsage = false) {
     assert(sizeof(Vertex) == format_.getVertexSize());
     glBindBuffer(GL_ARRAY_BUFFER, *this);
+    trackMemory(0, length);
     length_ = length;
 
     const int size = sizeof(Vertex) * length;
@@ -155,10 +187,16 @@ public:
     else {
       glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW);
     }
+    markDirty();
 #ifndef NDEBUG
     checkGlErrors();
 #endif
   }
+
+private:
+  // Accounts for a buffer coming (numBuffers = 1) or going (-1), and for
+  // length_ becoming newLength, in getVertexMemoryUsage()
+  void trackMemory(int numBuffers, int newLength);
 };
 
 // Light wrapper for a GL buffer object storing indices, together with format for its
@@ -196,6 +234,7 @@ public:
     else {
       glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
     }
+    markDirty();
 #ifndef NDEBUG
     checkGlErrors();
 #endif
@@ -221,20 +260,20 @@ public:
   // Declares and maps a vertex attribute named 'targetAttribName' to the
   // vertex attribute named 'sourceAttribName' of the 'source' FormattedVbo
   BufferObjectGeometry& wire(const std::string& targetAttribName,
-                             std::tr1::shared_ptr<FormattedVbo> source,
+                             std::shared_ptr<FormattedVbo> source,
                              const std::string& sourceAttribName);
 
   // Declares and maps a vertex attribute to the vertex attribute
   // named 'sourceAttribName' of the 'source' FormattedVbo. The declared
   // vertex attribute also holds the name 'sourceAttribName'
-  BufferObjectGeometry& wire(std::tr1::shared_ptr<FormattedVbo> source, const std::string& sourceAttribName);
+  BufferObjectGeometry& wire(std::shared_ptr<FormattedVbo> source, const std::string& sourceAttribName);
 
   // Declares and maps all vertex attributes contained in the 'source' FormattedVbo.
   // Same names are used for each attribute.
-  BufferObjectGeometry& wire(std::tr1::shared_ptr<FormattedVbo> source);
+  BufferObjectGeometry& wire(std::shared_ptr<FormattedVbo> source);
 
   // Set the index buffer to be used. Pass in a null shared_ptr to mean non-indexed. Default is non-indexed
-  BufferObjectGeometry& indexedBy(std::tr1::shared_ptr<FormattedIbo> ib);
+  BufferObjectGeometry& indexedBy(std::shared_ptr<FormattedIbo> ib);
 
   // Same as indexBy(null shared_ptr)
   BufferObjectGeometry& noIndex();
@@ -256,14 +295,15 @@ public:
   // Methods declared by Geometry
   virtual const std::vector<std::string>& getVertexAttribNames();
   virtual void draw(int attribIndices[]);
+  virtual int getNumTriangles();
 
 private:
-  typedef std::map<std::string, std::pair<std::tr1::shared_ptr<FormattedVbo>, std::string> > Wiring;
+  typedef std::map<std::string, std::pair<std::shared_ptr<FormattedVbo>, std::string> > Wiring;
 
   GLenum primitiveType_;
   bool wiringChanged_;
   Wiring wiring_;
-  std::tr1::shared_ptr<FormattedIbo> ib_;
+  std::shared_ptr<FormattedIbo> ib_;
 
   // Internal struct for optimized vb binding order
   struct PerVbWiring {
@@ -407,10 +447,74 @@ struct VertexPNTBX : public VertexPNX {
   }
 };
 
+// Packed versions of the above, for about half the memory and bandwidth.
+// Positions and texture coordinates are half floats, good to about 3
+// significant digits, so they only suit objects of moderate size near their
+// origin. Normals, tangents and binormals are 10 bit signed normalized
+// integers. Shaders read them all as the float vectors they are used to.
+//
+// The 10 bit attributes need GL 3.3 or ARB_vertex_type_2_10_10_10_rev; see
+// isPackedNormalSupported(), and fall back to the float vertices without.
+
+// Whether the current context takes GL_INT_2_10_10_10_REV attributes
+bool isPackedNormalSupported();
+
+// A VertexPNX in 16 instead of 32 bytes
+struct PackedVertexPNX {
+  HalfVec<4> p; // w = 1 keeps the normal 4 byte aligned
+  GLuint n;
+  HalfVec<2> x;
+
+  static const VertexFormat FORMAT;
+
+  PackedVertexPNX() {}
+
+  PackedVertexPNX(const Cvec3f& pos, const Cvec3f& normal, const Cvec2f& texCoords)
+    : p(pos), n(packSnorm3(normal)), x(texCoords) {}
+
+  PackedVertexPNX(const VertexPNX& v)
+    : p(v.p), n(packSnorm3(v.n)), x(v.x) {}
+
+  PackedVertexPNX(const GenericVertex& v) {
+    *this = v;
+  }
+
+  PackedVertexPNX& operator = (const GenericVertex& v) {
+    return *this = PackedVertexPNX(v.pos, v.normal, v.tex);
+  }
+};
+
+// A VertexPNTBX in 24 instead of 56 bytes
+struct PackedVertexPNTBX {
+  HalfVec<4> p;
+  GLuint n, t, b;
+  HalfVec<2> x;
+
+  static const VertexFormat FORMAT;
+
+  PackedVertexPNTBX() {}
+
+  PackedVertexPNTBX(const VertexPNTBX& v)
+    : p(v.p), n(packSnorm3(v.n)), t(packSnorm3(v.t)), b(packSnorm3(v.b)), x(v.x) {}
+
+  PackedVertexPNTBX(const GenericVertex& v) {
+    *this = v;
+  }
+
+  PackedVertexPNTBX& operator = (const GenericVertex& v) {
+    p = HalfVec<4>(v.pos);
+    n = packSnorm3(v.normal);
+    t = packSnorm3(v.tangent);
+    b = packSnorm3(v.binormal);
+    x = HalfVec<2>(v.tex);
+    return *this;
+  }
+};
+
 // Simple unindex geometry implementation based on BufferObjectGeometry
 template<typename Vertex>
 class SimpleUnindexedGeometry : public BufferObjectGeometry {
-  std::tr1::shared_ptr<FormattedVbo> vbo;
+  std::shared_ptr<FormattedVbo> vbo;
 public:
   SimpleUnindexedGeometry() : vbo(new FormattedVbo(Vertex::FORMAT)) {
     wire(vbo);
@@ -430,21 +534,26 @@ public:
 };
 
 
-// Simple Index geometry implementation based on BufferObjectGeometry
+// Simple Index geometry implementation based on BufferObjectGeometry.
+//
+// upload() reorders the triangles and vertices for the vertex cache (see
+// vertexcache.h), so the buffers hold the same triangles as given, but not
+// in the same order.
 template<typename Vertex, typename Index>
 class SimpleIndexedGeometry : public BufferObjectGeometry {
-  std::tr1::shared_ptr<FormattedVbo> vbo;
-  std::tr1::shared_ptr<FormattedIbo> ibo;
+  std::shared_ptr<FormattedVbo> vbo;
+  std::shared_ptr<FormattedIbo> ibo;
+  VertexCacheReport vertexCacheReport;
 public:
   SimpleIndexedGeometry()
-    : vbo(new FormattedVbo(Vertex::FORMAT)), ibo(new FormattedIbo(size2IboFmt(sizeof(Index)))) {
+    : vbo(new FormattedVbo(Vertex::FORMAT)), ibo(new FormattedIbo(size2IboFmt(sizeof(Index)))), vertexCacheReport() {
     wire(vbo);
     indexedBy(ibo);
     primitiveType(GL_TRIANGLES);
   }
 
   SimpleIndexedGeometry(const Vertex* vertices,  const Index* indices, int numVertices, int numIndices)
-    : vbo(new FormattedVbo(Vertex::FORMAT)), ibo(new FormattedIbo(size2IboFmt(sizeof(Index)))) {
+    : vbo(new FormattedVbo(Vertex::FORMAT)), ibo(new FormattedIbo(size2IboFmt(sizeof(Index)))), vertexCacheReport() {
     wire(vbo);
     indexedBy(ibo);
     primitiveType(GL_TRIANGLES);
@@ -452,8 +561,16 @@ public:
   }
 
   void upload(const Vertex* vertices, const Index* indices, int numVertices, int numIndices) {
-    vbo->upload(vertices, numVertices, true);
-    ibo->upload(indices, numIndices, true);
+    std::vector<Vertex> reorderedVertices(vertices, vertices + numVertices);
+    std::vector<Index> reorderedIndices(indices, indices + numIndices);
+    vertexCacheReport = optimizeIndexedTriangles(reorderedVertices, reorderedIndices);
+    vbo->upload(reorderedVertices.empty() ? NULL : &reorderedVertices[0], reorderedVertices.size(), true);
+    ibo->upload(reorderedIndices.empty() ? NULL : &reorderedIndices[0], reorderedIndices.size(), true);
+  }
+
+  // How much the last upload() gained
+  const VertexCacheReport& getVertexCacheReport() const {
+    return vertexCacheReport;
   }
 
 private:
@@ -474,9 +591,11 @@ private:
 typedef SimpleUnindexedGeometry<VertexPN> SimpleGeometryPN;
 typedef SimpleUnindexedGeometry<VertexPNX> SimpleGeometryPNX;
 typedef SimpleUnindexedGeometry<VertexPNTBX> SimpleGeometryPNTBX;
+typedef SimpleUnindexedGeometry<PackedVertexPNX> SimpleGeometryPackedPNX;
 
 typedef SimpleIndexedGeometry<VertexPN, unsigned short> SimpleIndexedGeometryPN;
 typedef SimpleIndexedGeometry<VertexPNX, unsigned short> SimpleIndexedGeometryPNX;
 typedef SimpleIndexedGeometry<VertexPNTBX, unsigned short> SimpleIndexedGeometryPNTBX;
+typedef SimpleIndexedGeometry<PackedVertexPNTBX, unsigned short> SimpleIndexedGeometryPackedPNTBX;
 
 #endif
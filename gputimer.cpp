@@ -0,0 +1,100 @@
+#include <cassert>
+#include <algorithm>
+
+#include "gputimer.h"
+
+using namespace std;
+
+GpuTimer::GpuTimer(const vector<string>& passNames)
+  : passNames_(passNames)
+  , ms_(passNames.size(), -1)
+  , openSpans_(passNames.size(), -1)
+  , current_(0)
+  , numDropped_(0) {
+  for (int i = 0; i < NUM_FRAMES; ++i)
+    frames_[i].numUsedQueries = 0;
+}
+
+GpuTimer::~GpuTimer() {
+  for (int i = 0; i < NUM_FRAMES; ++i) {
+    if (!frames_[i].queries.empty())
+      glDeleteQueries(frames_[i].queries.size(), &frames_[i].queries[0]);
+  }
+}
+
+bool GpuTimer::isSupported() {
+#ifdef __MAC__
+  return true; // core profile contexts on the Mac are at least 3.2 with timer queries
+#else
+  return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+#endif
+}
+
+void GpuTimer::beginFrame() {
+  for (int i = 0, n = openSpans_.size(); i < n; ++i)
+    assert(openSpans_[i] < 0); // unbalanced begin/end in the last frame
+
+  current_ = (current_ + 1) % NUM_FRAMES;
+  collect(frames_[current_]);
+}
+
+void GpuTimer::begin(int pass) {
+  Frame& frame = frames_[current_];
+  assert(openSpans_[pass] < 0);
+  Span span;
+  span.pass = pass;
+  span.beginQuery = frame.numUsedQueries;
+  span.endQuery = -1;
+  issueTimestamp(frame);
+  openSpans_[pass] = frame.spans.size();
+  frame.spans.push_back(span);
+}
+
+void GpuTimer::end(int pass) {
+  Frame& frame = frames_[current_];
+  assert(openSpans_[pass] >= 0);
+  frame.spans[openSpans_[pass]].endQuery = frame.numUsedQueries;
+  issueTimestamp(frame);
+  openSpans_[pass] = -1;
+}
+
+GLuint GpuTimer::issueTimestamp(Frame& frame) {
+  if (frame.numUsedQueries == (int)frame.queries.size()) {
+    const int n = frame.queries.size();
+    frame.queries.resize(n ? n * 2 : 16);
+    glGenQueries(frame.queries.size() - n, &frame.queries[n]);
+  }
+  const GLuint query = frame.queries[frame.numUsedQueries++];
+  glQueryCounter(query, GL_TIMESTAMP);
+  return query;
+}
+
+void GpuTimer::collect(Frame& frame) {
+  if (frame.numUsedQueries > 0) {
+    // timestamps complete in order, so if the last one is there all are
+    GLint available = 0;
+    glGetQueryObjectiv(frame.queries[frame.numUsedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      ++numDropped_;
+    }
+    else {
+      vector<double> sums(passNames_.size(), -1);
+      for (size_t i = 0; i < frame.spans.size(); ++i) {
+        const Span& span = frame.spans[i];
+        if (span.endQuery < 0)
+          continue;
+        GLuint64 t0, t1;
+        glGetQueryObjectui64v(frame.queries[span.beginQuery], GL_QUERY_RESULT, &t0);
+        glGetQueryObjectui64v(frame.queries[span.endQuery], GL_QUERY_RESULT, &t1);
+        sums[span.pass] = max(sums[span.pass], 0.0) + (t1 - t0) * 1e-6;
+      }
+      // passes that did not run in that frame keep their last value
+      for (size_t i = 0; i < sums.size(); ++i) {
+        if (sums[i] >= 0)
+          ms_[i] = sums[i];
+      }
+    }
+  }
+  frame.numUsedQueries = 0;
+  frame.spans.clear();
+}
@@ -0,0 +1,80 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <vector>
+#include <string>
+
+#include "glsupport.h"
+
+// Measures how much GPU time groups of draw calls ("passes") take, using
+// GL_TIMESTAMP queries.
+//
+// Each frame gets its own set of queries from a pool of NUM_FRAMES slots.
+// The results of a frame are only read back when its slot comes around
+// again, by which time the GPU is normally long done with it; if it is not,
+// that frame's results are dropped rather than waited for. The timer thus
+// never stalls the pipeline, and reports numbers a few frames old.
+//
+// A pass may be begun and ended several times per frame, the spans are
+// summed. Spans of different passes may overlap or nest.
+class GpuTimer : Noncopyable {
+public:
+  static const int NUM_FRAMES = 4;
+
+  // Requires a current GL context
+  explicit GpuTimer(const std::vector<std::string>& passNames);
+  ~GpuTimer();
+
+  // Whether the current context supports timestamp queries
+  static bool isSupported();
+
+  // Starts a new frame, collecting the results of the frame that used the
+  // same slot NUM_FRAMES frames ago
+  void beginFrame();
+
+  void begin(int pass);
+  void end(int pass);
+
+  int getNumPasses() const {
+    return passNames_.size();
+  }
+
+  const std::string& getPassName(int pass) const {
+    return passNames_[pass];
+  }
+
+  // Latest available GPU time of the pass, in milliseconds. Negative if the
+  // pass has never been measured.
+  double getMs(int pass) const {
+    return ms_[pass];
+  }
+
+  // Number of frames whose results were not ready in time
+  int getNumDroppedFrames() const {
+    return numDropped_;
+  }
+
+private:
+  struct Span {
+    int pass;
+    int beginQuery, endQuery;
+  };
+
+  struct Frame {
+    std::vector<GLuint> queries;
+    int numUsedQueries;
+    std::vector<Span> spans;
+  };
+
+  GLuint issueTimestamp(Frame& frame);
+  void collect(Frame& frame);
+
+  std::vector<std::string> passNames_;
+  std::vector<double> ms_;
+  std::vector<int> openSpans_;
+  Frame frames_[NUM_FRAMES];
+  int current_;
+  int numDropped_;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include <vector>
+
+#include "impostor.h"
+
+using namespace std;
+
+ImpostorAtlas::ImpostorAtlas(int tileSize, int numCols, int numRows)
+  : tileSize_(tileSize)
+  , numCols_(numCols)
+  , numRows_(numRows) {
+  glBindTexture(GL_TEXTURE_2D, tex_);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tileSize * numCols, tileSize * numRows,
+               0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  // no mipmaps: they would bleed neighboring tiles into each other
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glGenFramebuffers(1, &fbo_);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_, 0);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    throw runtime_error("ImpostorAtlas: incomplete framebuffer");
+
+  GLfloat clearColor[4];
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+  glClearColor(0, 0, 0, 0);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  checkGlErrors();
+}
+
+ImpostorAtlas::~ImpostorAtlas() {
+  glDeleteFramebuffers(1, &fbo_);
+}
+
+void ImpostorAtlas::beginTile(int col, int row) {
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  glViewport(col * tileSize_, row * tileSize_, tileSize_, tileSize_);
+}
+
+void ImpostorAtlas::endTile(int viewportWidth, int viewportHeight) {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, viewportWidth, viewportHeight);
+  checkGlErrors();
+}
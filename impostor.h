@@ -0,0 +1,54 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include "cvec.h"
+#include "glsupport.h"
+#include "texture.h"
+
+// A texture holding a grid of equally sized tiles, each of which is an
+// image of some object rendered once (e.g., from different directions) to
+// be drawn later on a camera facing quad instead of the object itself.
+//
+// To fill a tile, call beginTile(), draw the object with the viewport set
+// up to cover the tile, then call endTile(). Tiles start out transparent.
+class ImpostorAtlas : public Texture {
+public:
+  // Requires a current GL context
+  ImpostorAtlas(int tileSize, int numCols, int numRows);
+  ~ImpostorAtlas();
+
+  int getNumCols() const {
+    return numCols_;
+  }
+
+  int getNumRows() const {
+    return numRows_;
+  }
+
+  // Redirects rendering into the tile. Blending, depth test and face culling
+  // are left as they are.
+  void beginTile(int col, int row);
+
+  // Restores the window framebuffer and the given viewport
+  void endTile(int viewportWidth, int viewportHeight);
+
+  // Texture coordinates of the tile as (u0, v0, width, height)
+  Cvec4 getTileRect(int col, int row) const {
+    return Cvec4(double(col) / numCols_, double(row) / numRows_, 1.0 / numCols_, 1.0 / numRows_);
+  }
+
+  virtual GLenum getSamplerType() const {
+    return GL_SAMPLER_2D;
+  }
+
+  virtual void bind() const {
+    glBindTexture(GL_TEXTURE_2D, tex_);
+  }
+
+private:
+  const int tileSize_, numCols_, numRows_;
+  GlTexture tex_;
+  GLuint fbo_;
+};
+
+#endif
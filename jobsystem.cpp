@@ -0,0 +1,202 @@
+#include <cassert>
+
+#include "jobsystem.h"
+#include "profiler.h"
+
+using namespace std;
+
+// Threads that did not create the JobSystem and are not one of its workers
+// (e.g., the update thread) get one of these extra slots on first use
+static const int MAX_EXTERNAL_THREADS = 4;
+
+static thread_local const JobSystem *t_owner = NULL;
+static thread_local int t_threadIndex = -1;
+
+JobSystem::JobSystem(int numWorkers)
+  : quit_(false)
+  , numQueued_(0)
+  , numExternal_(0) {
+  if (numWorkers < 0) {
+    const int hw = thread::hardware_concurrency();
+    numWorkers = hw > 1 ? hw - 1 : 0;
+  }
+  numThreads_ = numWorkers + 1;
+
+  for (int i = 0; i < numThreads_ + MAX_EXTERNAL_THREADS; ++i)
+    threads_.push_back(new ThreadState());
+
+  // the creating thread is thread 0
+  t_owner = this;
+  t_threadIndex = 0;
+
+  for (int i = 1; i < numThreads_; ++i)
+    workers_.push_back(thread(&JobSystem::workerMain, this, i));
+}
+
+JobSystem::~JobSystem() {
+  {
+    lock_guard<mutex> lock(sleepMutex_);
+    quit_ = true;
+  }
+  sleepCv_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i)
+    workers_[i].join();
+  for (size_t i = 0; i < threads_.size(); ++i)
+    delete threads_[i];
+}
+
+int JobSystem::getThreadIndex() {
+  if (t_owner != this) {
+    const int slot = numExternal_++;
+    if (slot >= MAX_EXTERNAL_THREADS)
+      throw runtime_error("JobSystem: too many external threads");
+    t_owner = this;
+    t_threadIndex = numThreads_ + slot;
+  }
+  return t_threadIndex;
+}
+
+JobSystem::Job* JobSystem::createJob(JobFunction function, const void *data, Job *parent) {
+  ThreadState& ts = *threads_[getThreadIndex()];
+  Job *job = &ts.jobPool[ts.nextJob];
+  if (job->unfinished > 0)
+    throw runtime_error("JobSystem: too many jobs in flight");
+  ts.nextJob = (ts.nextJob + 1) % MAX_JOBS_PER_THREAD;
+
+  job->function = function;
+  job->data = data;
+  job->begin = job->end = 0;
+  job->parent = parent;
+  job->unfinished = 1;
+  job->numContinuations = 0;
+
+  if (parent)
+    ++parent->unfinished;
+  return job;
+}
+
+bool JobSystem::hasRoomForJobs(int numJobs) {
+  if (numJobs > MAX_JOBS_PER_THREAD)
+    return false;
+  const ThreadState& ts = *threads_[getThreadIndex()];
+  for (int i = 0; i < numJobs; ++i) {
+    if (ts.jobPool[(ts.nextJob + i) % MAX_JOBS_PER_THREAD].unfinished > 0)
+      return false;
+  }
+  return true;
+}
+
+void JobSystem::addContinuation(Job *job, Job *continuation) {
+  const int i = job->numContinuations++;
+  if (i >= Job::MAX_CONTINUATIONS)
+    throw runtime_error("JobSystem: too many continuations");
+  job->continuations[i] = continuation;
+}
+
+void JobSystem::run(Job *job) {
+  WorkQueue& q = threads_[getThreadIndex()]->queue;
+  {
+    lock_guard<mutex> lock(q.mutex);
+    q.jobs.push_back(job);
+  }
+  // counted under the sleep mutex, so that no worker can check the count
+  // and then miss the notification before it starts waiting
+  {
+    lock_guard<mutex> lock(sleepMutex_);
+    ++numQueued_;
+  }
+  sleepCv_.notify_one();
+}
+
+void JobSystem::wait(const Job *job) {
+  const int threadIndex = getThreadIndex();
+  while (job->unfinished > 0) {
+    Job *next = getJob(threadIndex);
+    if (next)
+      execute(next);
+    else
+      this_thread::yield();
+  }
+}
+
+JobSystem::Job* JobSystem::getJob(int threadIndex) {
+  ThreadState& ts = *threads_[threadIndex];
+  {
+    lock_guard<mutex> lock(ts.queue.mutex);
+    if (!ts.queue.jobs.empty()) {
+      Job *job = ts.queue.jobs.back();
+      ts.queue.jobs.pop_back();
+      --numQueued_;
+      return job;
+    }
+  }
+
+  if (numQueued_ <= 0)
+    return NULL;
+
+  // steal the oldest job of some other thread, starting at a random victim
+  const int n = threads_.size();
+  ts.stealSeed = ts.stealSeed * 1103515245 + 12345;
+  const int start = (ts.stealSeed >> 16) % n;
+  for (int i = 0; i < n; ++i) {
+    const int victim = (start + i) % n;
+    if (victim == threadIndex)
+      continue;
+    WorkQueue& q = threads_[victim]->queue;
+    lock_guard<mutex> lock(q.mutex);
+    if (!q.jobs.empty()) {
+      Job *job = q.jobs.front();
+      q.jobs.pop_front();
+      --numQueued_;
+      return job;
+    }
+  }
+  return NULL;
+}
+
+void JobSystem::execute(Job *job) {
+  PROFILE_ZONE("job");
+  if (job->function)
+    job->function(*job);
+  finish(job);
+}
+
+void JobSystem::finish(Job *job) {
+  // once unfinished drops to 0 the entry may be reused, so read it first
+  Job *parent = job->parent;
+  const int n = job->numContinuations;
+  Job *continuations[Job::MAX_CONTINUATIONS];
+  for (int i = 0; i < n; ++i)
+    continuations[i] = job->continuations[i];
+  if (--job->unfinished > 0)
+    return;
+
+  if (parent)
+    finish(parent);
+  for (int i = 0; i < n; ++i)
+    run(continuations[i]);
+}
+
+void JobSystem::workerMain(int threadIndex) {
+  t_owner = this;
+  t_threadIndex = threadIndex;
+  threads_[threadIndex]->stealSeed = threadIndex;
+  Profiler::setThreadName("worker");
+
+  while (!quit_) {
+    Job *job = getJob(threadIndex);
+    if (job) {
+      execute(job);
+      continue;
+    }
+    // nothing to do: sleep until a job gets pushed
+    unique_lock<mutex> lock(sleepMutex_);
+    while (numQueued_ <= 0 && !quit_)
+      sleepCv_.wait(lock);
+  }
+}
+
+JobSystem& getJobSystem() {
+  static JobSystem jobSystem;
+  return jobSystem;
+}
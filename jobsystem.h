@@ -0,0 +1,149 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <stdexcept>
+
+#include "glsupport.h" // for Noncopyable
+
+// A small work-stealing job scheduler.
+//
+// Every thread (the workers and the thread that created the JobSystem) owns a
+// deque of jobs. A thread pushes and pops jobs at the back of its own deque,
+// and when that runs dry it steals from the front of somebody else's.
+//
+// Jobs form a tree: a job only counts as finished once all of its children
+// have finished, so waiting on a parent waits for the whole tree. A job can
+// also have continuations, which are scheduled once it finishes; this is how
+// dependencies between jobs are expressed.
+//
+// Jobs live in a per-thread ring of MAX_JOBS_PER_THREAD entries, so a thread
+// must not have more than that many jobs in flight at any time: createJob()
+// throws rather than reuse the entry of a job that has not finished.
+// parallelFor() runs the range inline if the ring has no room for it.
+class JobSystem : Noncopyable {
+public:
+  struct Job;
+  typedef void (*JobFunction)(Job& job);
+
+  struct Job {
+    JobFunction function;
+    const void *data;
+    int begin, end;
+
+    Job *parent;
+    std::atomic<int> unfinished;
+
+    static const int MAX_CONTINUATIONS = 8;
+    Job *continuations[MAX_CONTINUATIONS];
+    std::atomic<int> numContinuations;
+  };
+
+  // numWorkers < 0 means one worker per hardware thread beyond the calling one
+  explicit JobSystem(int numWorkers = -1);
+  ~JobSystem();
+
+  // Total number of threads executing jobs, including the creating thread
+  int getNumThreads() const {
+    return numThreads_;
+  }
+
+  // Creates a job that is not yet scheduled. If `parent' is given, the parent
+  // will not finish before this job does. Throws if the calling thread has
+  // MAX_JOBS_PER_THREAD jobs in flight already.
+  Job* createJob(JobFunction function, const void *data = NULL, Job *parent = NULL);
+
+  // Whether the calling thread can create numJobs more jobs right now
+  bool hasRoomForJobs(int numJobs);
+
+  // Schedules `continuation' to run once `job' has finished. Must be called
+  // before `job' is run.
+  void addContinuation(Job *job, Job *continuation);
+
+  // Pushes the job onto the calling thread's deque
+  void run(Job *job);
+
+  // Executes other jobs until `job' has finished
+  void wait(const Job *job);
+
+  // Calls body(b, e) for consecutive sub ranges [b, e) of [begin, end) that
+  // are at most grainSize long, in parallel, and returns when all are done.
+  // Body needs to be callable as `void operator()(int begin, int end) const'.
+  template<typename Body>
+  void parallelFor(int begin, int end, int grainSize, const Body& body);
+
+  // Used by parallelFor. Jobs with a NULL function only group their children.
+  template<typename Body>
+  static void runRange(Job& job) {
+    (*static_cast<const Body*>(job.data))(job.begin, job.end);
+  }
+
+  static const int MAX_JOBS_PER_THREAD = 4096;
+
+private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Job*> jobs;
+  };
+
+  struct ThreadState {
+    WorkQueue queue;
+    std::vector<Job> jobPool;
+    int nextJob;
+    unsigned int stealSeed;
+
+    ThreadState() : jobPool(MAX_JOBS_PER_THREAD), nextJob(0), stealSeed(1) {
+      for (int i = 0; i < MAX_JOBS_PER_THREAD; ++i)
+        jobPool[i].unfinished = 0;
+    }
+  };
+
+  int getThreadIndex();
+  Job* getJob(int threadIndex);
+  void execute(Job *job);
+  void finish(Job *job);
+  void workerMain(int threadIndex);
+
+  int numThreads_;
+  std::vector<ThreadState*> threads_;
+  std::vector<std::thread> workers_;
+
+  std::atomic<bool> quit_;
+  std::atomic<int> numQueued_;
+  std::atomic<int> numExternal_;
+  std::mutex sleepMutex_;
+  std::condition_variable sleepCv_;
+};
+
+template<typename Body>
+void JobSystem::parallelFor(int begin, int end, int grainSize, const Body& body) {
+  if (grainSize < 1)
+    grainSize = 1;
+  // one job per grain, and the root
+  const int numJobs = (end - begin + grainSize - 1) / grainSize + 1;
+  if (end - begin <= grainSize || numThreads_ == 1 || !hasRoomForJobs(numJobs)) {
+    if (begin < end)
+      body(begin, end);
+    return;
+  }
+
+  Job *root = createJob(NULL);
+  for (int b = begin; b < end; b += grainSize) {
+    Job *job = createJob(&JobSystem::runRange<Body>, &body, root);
+    job->begin = b;
+    job->end = b + grainSize < end ? b + grainSize : end;
+    run(job);
+  }
+  run(root);
+  wait(root);
+}
+
+// The JobSystem shared by the whole program, created on first use
+JobSystem& getJobSystem();
+
+#endif
@@ -0,0 +1,24 @@
+#include <algorithm>
+
+#include "lod.h"
+
+using namespace std;
+
+const double LodGeometry::HYSTERESIS = 1.2;
+
+void LodGeometry::addLevel(shared_ptr<Geometry> geometry, double minPixelRadius) {
+  Level level;
+  level.geometry = geometry;
+  level.minPixelRadius = minPixelRadius;
+  levels_.push_back(level);
+}
+
+int LodGeometry::selectLevel(double pixelRadius, int currentLevel) const {
+  const int n = levels_.size();
+  int level = max(0, min(n - 1, currentLevel));
+  while (level > 0 && pixelRadius >= levels_[level - 1].minPixelRadius * HYSTERESIS)
+    --level;
+  while (level + 1 < n && pixelRadius < levels_[level].minPixelRadius / HYSTERESIS)
+    ++level;
+  return level;
+}
@@ -0,0 +1,54 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <vector>
+#include <memory>
+
+#include "geometry.h"
+
+// One object at several levels of detail, finest first.
+//
+// A level is used while the object's bounding sphere covers at least the
+// level's minimum radius in pixels. To keep objects near a threshold from
+// popping back and forth, a shape only moves to a finer level once it is
+// HYSTERESIS times larger than the threshold, and to a coarser one once it
+// is HYSTERESIS times smaller.
+class LodGeometry {
+public:
+  static const double HYSTERESIS;
+
+  // boundingRadius: radius of a sphere around the origin containing the
+  // object, in object coordinates
+  explicit LodGeometry(double boundingRadius) : boundingRadius_(boundingRadius) {}
+
+  // Levels must be added finest first, with decreasing minPixelRadius. The
+  // last level is used for anything smaller regardless.
+  void addLevel(std::shared_ptr<Geometry> geometry, double minPixelRadius);
+
+  int getNumLevels() const {
+    return levels_.size();
+  }
+
+  const std::shared_ptr<Geometry>& getGeometry(int level) const {
+    return levels_[level].geometry;
+  }
+
+  double getBoundingRadius() const {
+    return boundingRadius_;
+  }
+
+  // Level to draw the object at, given its projected radius in pixels and
+  // the level it was drawn at last
+  int selectLevel(double pixelRadius, int currentLevel) const;
+
+private:
+  struct Level {
+    std::shared_ptr<Geometry> geometry;
+    double minPixelRadius;
+  };
+
+  double boundingRadius_;
+  std::vector<Level> levels_;
+};
+
+#endif
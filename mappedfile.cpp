@@ -0,0 +1,92 @@
+#include <string>
+#include <stdexcept>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# define NOMINMAX
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+#include "mappedfile.h"
+
+using namespace std;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const char* filename)
+  : data_(NULL)
+  , size_(0)
+  , file_(INVALID_HANDLE_VALUE)
+  , mapping_(NULL) {
+  file_ = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                      FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file_ == INVALID_HANDLE_VALUE)
+    throw runtime_error(string("MappedFile: Cannot open file ") + filename);
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_, &size)) {
+    CloseHandle(file_);
+    throw runtime_error(string("MappedFile: Cannot get the size of ") + filename);
+  }
+  size_ = size_t(size.QuadPart);
+  if (size_ == 0)
+    return; // empty files cannot be mapped
+
+  mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping_)
+    data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (!data_) {
+    if (mapping_)
+      CloseHandle(mapping_);
+    CloseHandle(file_);
+    throw runtime_error(string("MappedFile: Cannot map file ") + filename);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    UnmapViewOfFile(data_);
+  if (mapping_)
+    CloseHandle(mapping_);
+  CloseHandle(file_);
+}
+
+#else
+
+MappedFile::MappedFile(const char* filename)
+  : data_(NULL)
+  , size_(0) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    throw runtime_error(string("MappedFile: Cannot open file ") + filename);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw runtime_error(string("MappedFile: Cannot get the size of ") + filename);
+  }
+  size_ = size_t(st.st_size);
+  if (size_ > 0) {
+    void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw runtime_error(string("MappedFile: Cannot map file ") + filename);
+    }
+    madvise(data, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(data);
+  }
+  // the mapping stays valid without the descriptor
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+
+// A whole file mapped read only into memory (mmap, or MapViewOfFile on
+// Windows), so that it can be parsed in place without reading it into a
+// buffer first. Throws runtime_error if the file cannot be opened or mapped.
+class MappedFile {
+public:
+  explicit MappedFile(const char* filename);
+  ~MappedFile();
+
+  // NULL for an empty file
+  const char* getData() const {
+    return data_;
+  }
+
+  size_t getSize() const {
+    return size_;
+  }
+
+private:
+  const char* data_;
+  size_t size_;
+#ifdef _WIN32
+  void* file_;    // HANDLE
+  void* mapping_; // HANDLE
+#endif
+
+  MappedFile(const MappedFile&);
+  MappedFile& operator = (const MappedFile&);
+};
+
+#endif
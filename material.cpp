@@ -7,9 +7,9 @@
 #include "glsupport.h"
 #include "asstcommon.h"
 #include "material.h"
+#include "profiler.h"
 
 using namespace std;
-using namespace tr1;
 
 struct GlProgramDesc {
   struct UniformDesc {
@@ -196,6 +196,7 @@ static const char * getGlConstantName(GLenum c) {
 }
 
 void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
+  PROFILE_ZONE("Material::draw");
   static GLint maxTextureImageUnits = 0;
 
   // Initialize maxTextureImageUnits if this is called for the first time
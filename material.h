@@ -6,9 +6,6 @@
 #include <map>
 #include <memory>
 #include <stdexcept>
-#if __GNUG__
-#   include <tr1/memory>
-#endif
 
 
 #include "cvec.h"
@@ -17,6 +14,7 @@
 #include "uniforms.h"
 #include "renderstates.h"
 #include "geometry.h"
+#include "changetracker.h"
 
 struct GlProgramDesc;
 
@@ -26,7 +24,8 @@ public:
 
   void draw(Geometry& geometry, const Uniforms& extraUniforms);
 
-  Uniforms& getUniforms() { return uniforms_; }
+  // for changing them, which counts as a change to what is drawn
+  Uniforms& getUniforms() { markDirty(); return uniforms_; }
   const Uniforms& getUniforms() const { return uniforms_; }
 
   RenderStates& getRenderStates() { return renderStates_; }
@@ -38,7 +37,7 @@ public:
   static void removeInlineSource(const std::string& filename);
 
 protected:
-  std::tr1::shared_ptr<GlProgramDesc> programDesc_;
+  std::shared_ptr<GlProgramDesc> programDesc_;
 
   Uniforms uniforms_;
 
@@ -5,6 +5,7 @@
 #include <cmath>
 
 #include "cvec.h"
+#include "simdmath.h"
 
 // Forward declaration of Matrix4 and transpose since those are used below
 class Matrix4;
@@ -101,24 +102,14 @@ public:
   }
 
   Cvec4 operator * (const Cvec4& v) const {
-    Cvec4 r(0);
-    for (int i = 0; i < 4; ++i) {
-      for (int j = 0; j < 4; ++j) {
-        r[i] += (*this)(i,j) * v(j);
-      }
-    }
+    Cvec4 r;
+    simdmath::multiplyMatrixVector(d_, &v[0], &r[0]);
     return r;
   }
 
   Matrix4 operator * (const Matrix4& m) const {
     Matrix4 r(0);
-    for (int i = 0; i < 4; ++i) {
-      for (int j = 0; j < 4; ++j) {
-        for (int k = 0; k < 4; ++k) {
-          r(i,k) += (*this)(i,j) * m(j,k);
-        }
-      }
-    }
+    simdmath::multiplyMatrices(d_, m.d_, r.d_);
     return r;
   }
 
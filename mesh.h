@@ -139,6 +139,27 @@ class Mesh {
       vertex_[i].normal_[0] = -5e37;
     }
   }
+  void build__(const std::vector <Cvec3>& positions, const std::vector <Cvec <int, 4> >& faces) {
+    vertex_.resize(positions.size());
+    face_.resize(faces.size());
+    edge_.clear();
+    not_manifold_ = false;
+    with_boundary_ = false;
+    for (std::size_t i = 0; i < vertex_.size(); ++i) {
+      vertex_[i].position_ = positions[i];
+      vertex_[i].normal_[0] = -5e37;
+      vertex_[i].halfedge_ = -1;
+    }
+    for (std::size_t i = 0; i < face_.size(); ++i) {
+      face_[i].vertex_ = faces[i];
+      const int n = fn__(i);
+      for (int j = 0; j < n; ++j) {
+        vertex_[face_[i].vertex_[j]].halfedge_ = i | (j<<28);
+      }
+    }
+    init_topology__();
+    resize__();
+  }
   void subdivide__() {
     if (not_manifold_)
       throw std::runtime_error("Subdivision does not support non manifold mesh yet.");
@@ -384,6 +405,12 @@ public:
   void load(const char filename[]) {
     load__(filename);
   }
+  // Replaces the mesh with the given vertices and faces. Each face lists 3 or
+  // 4 vertex indices, with faces[i][3] == -1 for a triangle. Every vertex
+  // must be used by some face.
+  void build(const std::vector <Cvec3>& positions, const std::vector <Cvec <int, 4> >& faces) {
+    build__(positions, faces);
+  }
 };
 
 
@@ -0,0 +1,280 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+# include <process.h>
+# define getpid _getpid
+#else
+# include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define MIPCHAIN_SSE2
+# include <emmintrin.h>
+#endif
+
+#include "mipchain.h"
+
+using namespace std;
+
+// Linear values are quantized to this many steps before looking up their
+// SRGB encoding, fine enough for the darkest of the 8 bit SRGB levels
+static const int LINEAR_STEPS = 1 << 16;
+
+struct SrgbTables {
+  float toLinear[256];
+  unsigned char fromLinear[LINEAR_STEPS + 1];
+
+  SrgbTables() {
+    for (int i = 0; i < 256; ++i) {
+      const double c = i / 255.0;
+      toLinear[i] = float(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+    }
+    for (int i = 0; i <= LINEAR_STEPS; ++i) {
+      const double l = double(i) / LINEAR_STEPS;
+      const double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055;
+      fromLinear[i] = static_cast<unsigned char>(c * 255 + .5);
+    }
+  }
+};
+
+static const SrgbTables& getSrgbTables() {
+  static const SrgbTables tables;
+  return tables;
+}
+
+// Splits the rows [0, height) into jobs of about 16K pixels each
+template<typename Body>
+static void forEachRow(JobSystem* jobs, int width, int height, const Body& body) {
+  if (jobs)
+    jobs->parallelFor(0, height, max(1, (1 << 14) / width), body);
+  else
+    body(0, height);
+}
+
+// Converts the top level, which the image stores top row first, to linear
+// RGBX floats and copies its pixels, both bottom row first
+struct ConvertTopLevel {
+  const PpmImage *image;
+  bool srgb;
+  float *linear;
+  unsigned char *pixels;
+
+  void operator()(int begin, int end) const {
+    const int width = image->getWidth(), height = image->getHeight();
+    const float *toLinear = getSrgbTables().toLinear;
+    for (int y = begin; y < end; ++y) {
+      const unsigned char *src = image->getRow(height - 1 - y);
+      memcpy(pixels + 3 * width * y, src, 3 * width);
+      float *dest = linear + 4 * width * y;
+      for (int x = 0; x < width; ++x) {
+        for (int c = 0; c < 3; ++c)
+          dest[4 * x + c] = srgb ? toLinear[src[3 * x + c]] : src[3 * x + c] / 255.f;
+        dest[4 * x + 3] = 0;
+      }
+    }
+  }
+};
+
+// Averages 2x2 blocks of the linear source level into the linear
+// destination level, and quantizes the result. An odd last row or column
+// of the source is left out, as with a plain 2x2 reduction.
+struct Downsample {
+  const float *src;
+  int srcWidth, srcHeight;
+  float *linear;
+  unsigned char *pixels;
+  int width;
+  bool srgb;
+
+  void operator()(int begin, int end) const {
+    const unsigned char *fromLinear = getSrgbTables().fromLinear;
+    for (int y = begin; y < end; ++y) {
+      const float *row0 = src + 4 * srcWidth * min(2 * y, srcHeight - 1);
+      const float *row1 = src + 4 * srcWidth * min(2 * y + 1, srcHeight - 1);
+      float *dest = linear + 4 * width * y;
+      unsigned char *destPixels = pixels + 3 * width * y;
+
+      for (int x = 0; x < width; ++x) {
+        const int x0 = 4 * min(2 * x, srcWidth - 1), x1 = 4 * min(2 * x + 1, srcWidth - 1);
+#ifdef MIPCHAIN_SSE2
+        const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+                                      _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+        _mm_storeu_ps(dest + 4 * x, _mm_mul_ps(sum, _mm_set1_ps(.25f)));
+#else
+        for (int c = 0; c < 4; ++c)
+          dest[4 * x + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * .25f;
+#endif
+        for (int c = 0; c < 3; ++c) {
+          const float v = min(max(dest[4 * x + c], 0.f), 1.f);
+          destPixels[3 * x + c] = srgb ? fromLinear[int(v * LINEAR_STEPS + .5f)]
+                                       : static_cast<unsigned char>(v * 255 + .5f);
+        }
+      }
+    }
+  }
+};
+
+MipChain::MipChain(const PpmImage& image, bool srgb, JobSystem* jobs)
+  : srgb_(srgb) {
+  if (image.getBytesPerChannel() != 1)
+    throw runtime_error("MipChain: only 8 bit images are supported");
+
+  size_t size = 0;
+  for (int width = image.getWidth(), height = image.getHeight();; ) {
+    Level level = { width, height, NULL };
+    levels_.push_back(level);
+    size += size_t(3) * width * height;
+    if (width == 1 && height == 1)
+      break;
+    width = max(1, width / 2);
+    height = max(1, height / 2);
+  }
+  storage_.resize(size);
+  size_t offset = 0;
+  for (size_t i = 0; i < levels_.size(); ++i) {
+    levels_[i].pixels = &storage_[offset];
+    offset += size_t(3) * levels_[i].width * levels_[i].height;
+  }
+
+  vector<float> linear(size_t(4) * image.getWidth() * image.getHeight()), nextLinear;
+  const ConvertTopLevel convert = { &image, srgb, &linear[0], &storage_[0] };
+  forEachRow(jobs, image.getWidth(), image.getHeight(), convert);
+
+  for (size_t i = 1; i < levels_.size(); ++i) {
+    const Level& src = levels_[i - 1];
+    const Level& level = levels_[i];
+    nextLinear.resize(size_t(4) * level.width * level.height);
+    const Downsample downsample = {
+      &linear[0], src.width, src.height, &nextLinear[0],
+      const_cast<unsigned char*>(level.pixels), level.width, srgb
+    };
+    forEachRow(jobs, level.width, level.height, downsample);
+    linear.swap(nextLinear);
+  }
+}
+
+// ---------- cache files
+
+// Followed by the width and height of each level, and then their pixels
+struct MipCacheHeader {
+  char magic[4];
+  int version;
+  int srgb;
+  int numLevels;
+  long long sourceSize, sourceTime;
+};
+
+static const char MIP_CACHE_MAGIC[4] = { 'M', 'I', 'P', 'C' };
+static const int MIP_CACHE_VERSION = 1;
+
+static bool getFileStamp(const string& fileName, long long& size, long long& time) {
+  struct stat st;
+  if (stat(fileName.c_str(), &st) != 0)
+    return false;
+  size = st.st_size;
+  time = st.st_mtime;
+  return true;
+}
+
+string MipChain::getCacheFileName(const string& sourceFileName, bool srgb) {
+  return sourceFileName + (srgb ? ".srgb.mips" : ".linear.mips");
+}
+
+shared_ptr<MipChain> MipChain::loadCached(const string& cacheFileName, const string& sourceFileName,
+                                          bool srgb) {
+  long long sourceSize, sourceTime;
+  if (!getFileStamp(sourceFileName, sourceSize, sourceTime))
+    return shared_ptr<MipChain>();
+
+  shared_ptr<MappedFile> file;
+  try {
+    file.reset(new MappedFile(cacheFileName.c_str()));
+  }
+  catch (const runtime_error&) {
+    return shared_ptr<MipChain>(); // not cached yet
+  }
+
+  MipCacheHeader header;
+  if (file->getSize() < sizeof(header))
+    return shared_ptr<MipChain>();
+  memcpy(&header, file->getData(), sizeof(header));
+  if (memcmp(header.magic, MIP_CACHE_MAGIC, 4) != 0 || header.version != MIP_CACHE_VERSION ||
+      header.srgb != int(srgb) || header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+      header.numLevels < 1 || header.numLevels > 32)
+    return shared_ptr<MipChain>();
+
+  const size_t dimensionsSize = sizeof(int) * 2 * header.numLevels;
+  if (file->getSize() < sizeof(header) + dimensionsSize)
+    return shared_ptr<MipChain>();
+  vector<int> dimensions(2 * header.numLevels);
+  memcpy(&dimensions[0], file->getData() + sizeof(header), dimensionsSize);
+
+  shared_ptr<MipChain> chain(new MipChain());
+  chain->srgb_ = srgb;
+  chain->cacheFile_ = file;
+  size_t offset = sizeof(header) + dimensionsSize;
+  for (int i = 0; i < header.numLevels; ++i) {
+    const Level level = {
+      dimensions[2 * i], dimensions[2 * i + 1],
+      reinterpret_cast<const unsigned char*>(file->getData()) + offset
+    };
+    const bool expected = i == 0 ? level.width > 0 && level.height > 0
+                          : level.width == max(1, chain->levels_.back().width / 2) &&
+                            level.height == max(1, chain->levels_.back().height / 2);
+    if (!expected)
+      return shared_ptr<MipChain>();
+    offset += size_t(3) * level.width * level.height;
+    chain->levels_.push_back(level);
+  }
+  if (file->getSize() != offset)
+    return shared_ptr<MipChain>();
+  return chain;
+}
+
+bool MipChain::saveCached(const string& cacheFileName, const string& sourceFileName) const {
+  MipCacheHeader header;
+  memcpy(header.magic, MIP_CACHE_MAGIC, 4);
+  header.version = MIP_CACHE_VERSION;
+  header.srgb = srgb_;
+  header.numLevels = getNumLevels();
+  if (!getFileStamp(sourceFileName, header.sourceSize, header.sourceTime))
+    return false;
+
+  // written aside and renamed, so that nobody maps a half written file. The
+  // temporary name is unique to this writer, as several loads of the same
+  // image may save it at once, in this process or another.
+  static atomic<unsigned> numSaved(0);
+  ostringstream tempName;
+  tempName << cacheFileName << "." << getpid() << "." << numSaved++ << ".tmp";
+  const string tempFileName = tempName.str();
+  FILE *f = fopen(tempFileName.c_str(), "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  for (int i = 0; ok && i < getNumLevels(); ++i) {
+    const int dimensions[2] = { levels_[i].width, levels_[i].height };
+    ok = fwrite(dimensions, sizeof(dimensions), 1, f) == 1;
+  }
+  for (int i = 0; ok && i < getNumLevels(); ++i)
+    ok = fwrite(levels_[i].pixels, 3 * levels_[i].width, levels_[i].height, f) == size_t(levels_[i].height);
+  ok = fclose(f) == 0 && ok;
+
+#ifdef _WIN32
+  // rename does not replace files on Windows. Elsewhere it replaces them
+  // atomically, so that a reader never finds the cache missing.
+  if (ok)
+    remove(cacheFileName.c_str());
+#endif
+  if (!ok || rename(tempFileName.c_str(), cacheFileName.c_str()) != 0) {
+    remove(tempFileName.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,77 @@
+#ifndef MIPCHAIN_H
+#define MIPCHAIN_H
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "ppm.h"
+#include "mappedfile.h"
+#include "jobsystem.h"
+
+// All mipmap levels of an 8 bit RGB image, each stored bottom row first
+// with tightly packed rows, ready for glTexImage2D.
+//
+// The levels are built on the CPU with a 2x2 box filter. For an SRGB image
+// the averaging is done in linear space, and each level is filtered from
+// the unquantized linear values of the one above, so that rounding does
+// not accumulate down the chain.
+//
+// A chain can be saved to a cache file and loaded back from it, which
+// checks the size and modification time of the source image recorded in
+// the file.
+class MipChain : Noncopyable {
+public:
+  // Builds the chain from an 8 bits per channel image, splitting the rows
+  // of each level into jobs if `jobs' is not NULL
+  MipChain(const PpmImage& image, bool srgb, JobSystem* jobs);
+
+  // The cache file for the chain of sourceFileName in the given color
+  // space, since the levels of an image differ between the two
+  static std::string getCacheFileName(const std::string& sourceFileName, bool srgb);
+
+  // The chain stored in cacheFileName for sourceFileName, or NULL if the
+  // cache file is missing, stale, or not a mip chain of the right kind
+  static std::shared_ptr<MipChain> loadCached(const std::string& cacheFileName,
+                                              const std::string& sourceFileName, bool srgb);
+
+  // Writes the chain to cacheFileName, stamped with sourceFileName. Returns
+  // false if the file could not be written.
+  bool saveCached(const std::string& cacheFileName, const std::string& sourceFileName) const;
+
+  int getNumLevels() const {
+    return int(levels_.size());
+  }
+
+  int getWidth(int level) const {
+    return levels_[level].width;
+  }
+
+  int getHeight(int level) const {
+    return levels_[level].height;
+  }
+
+  // Bottom row first
+  const unsigned char* getPixels(int level) const {
+    return levels_[level].pixels;
+  }
+
+  bool isSrgb() const {
+    return srgb_;
+  }
+
+private:
+  struct Level {
+    int width, height;
+    const unsigned char* pixels;
+  };
+
+  bool srgb_;
+  std::vector<Level> levels_;
+  std::vector<unsigned char> storage_;    // levels built here, or
+  std::shared_ptr<MappedFile> cacheFile_; // levels loaded from here
+
+  MipChain() {}
+};
+
+#endif
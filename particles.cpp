@@ -0,0 +1,104 @@
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+
+#include "particles.h"
+#include "asstcommon.h"
+
+using namespace std;
+
+const VertexFormat ParticleSystem::Vertex::FORMAT = VertexFormat(sizeof(ParticleSystem::Vertex), "particle")
+    .put("aState", 4, GL_FLOAT, GL_FALSE, offsetof(ParticleSystem::Vertex, state));
+
+static float randomFloat(float lo, float hi) {
+  return lo + (hi - lo) * (rand() / float(RAND_MAX));
+}
+
+bool ParticleSystem::isSupported() {
+#ifdef __MAC__
+  return !g_Gl2Compatible;
+#else
+  return !g_Gl2Compatible && GLEW_VERSION_3_0;
+#endif
+}
+
+ParticleSystem::ParticleSystem(int numParticles, float halfSize, float groundY, float top)
+  : numParticles_(numParticles)
+  , halfSize_(halfSize)
+  , groundY_(groundY)
+  , top_(top)
+  , time_(0)
+  , current_(0) {
+  {
+    GlShader vs(GL_VERTEX_SHADER);
+    GlShader fs(GL_FRAGMENT_SHADER);
+    readAndCompileSingleShader(vs, "./shaders/particle-update-gl3.vshader");
+    readAndCompileSingleShader(fs, "./shaders/particle-update-gl3.fshader");
+
+    // must be declared before linking
+    const char *varyings[] = { "vState" };
+    glTransformFeedbackVaryings(updateProgram_, 1, varyings, GL_INTERLEAVED_ATTRIBS);
+    linkShader(updateProgram_, vs, fs);
+  }
+
+  stateAttrib_ = glGetAttribLocation(updateProgram_, "aState");
+  uTime_ = glGetUniformLocation(updateProgram_, "uTime");
+  uDt_ = glGetUniformLocation(updateProgram_, "uDt");
+  uFallSpeed_ = glGetUniformLocation(updateProgram_, "uFallSpeed");
+  uSway_ = glGetUniformLocation(updateProgram_, "uSway");
+  uGroundY_ = glGetUniformLocation(updateProgram_, "uGroundY");
+  uTop_ = glGetUniformLocation(updateProgram_, "uTop");
+  uHalfSize_ = glGetUniformLocation(updateProgram_, "uHalfSize");
+
+  // the only time particles are generated on the CPU
+  vector<Vertex> vertices(numParticles);
+  for (int i = 0; i < numParticles; ++i) {
+    vertices[i].state = Cvec4f(randomFloat(-halfSize, halfSize),
+                               randomFloat(groundY, top),
+                               randomFloat(-halfSize, halfSize),
+                               randomFloat(0.5, 1.5));
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    vbos_[i].reset(new FormattedVbo(Vertex::FORMAT));
+    vbos_[i]->upload(&vertices[0], numParticles, true);
+
+    shared_ptr<BufferObjectGeometry> geometry(new BufferObjectGeometry());
+    geometry->wire(vbos_[i]).primitiveType(GL_POINTS);
+    geometries_[i] = geometry;
+  }
+
+  checkGlErrors();
+}
+
+void ParticleSystem::update(float dt, float fallSpeed, float sway) {
+  time_ += dt;
+  const int next = 1 - current_;
+
+  glUseProgram(updateProgram_);
+  glUniform1f(uTime_, time_);
+  glUniform1f(uDt_, dt);
+  glUniform1f(uFallSpeed_, fallSpeed);
+  glUniform1f(uSway_, sway);
+  glUniform1f(uGroundY_, groundY_);
+  glUniform1f(uTop_, top_);
+  glUniform1f(uHalfSize_, halfSize_);
+
+  glBindVertexArray(vao_);
+  glBindBuffer(GL_ARRAY_BUFFER, *vbos_[current_]);
+  glEnableVertexAttribArray(stateAttrib_);
+  Vertex::FORMAT.setGlVertexAttribPointer(0, stateAttrib_);
+
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, *vbos_[next]);
+  glEnable(GL_RASTERIZER_DISCARD);
+  glBeginTransformFeedback(GL_POINTS);
+  glDrawArrays(GL_POINTS, 0, numParticles_);
+  glEndTransformFeedback();
+  glDisable(GL_RASTERIZER_DISCARD);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+  glDisableVertexAttribArray(stateAttrib_);
+  glBindVertexArray(0);
+
+  current_ = next;
+}
@@ -0,0 +1,69 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <memory>
+
+#include "cvec.h"
+#include "glsupport.h"
+#include "geometry.h"
+
+// Falling rain or snow simulated entirely on the GPU.
+//
+// The particle states live in two vertex buffers. Every update() runs a
+// vertex shader over one buffer and captures its output into the other with
+// transform feedback, then the two swap roles. Particles falling below the
+// ground are respawned at the top at a random spot by the shader itself, so
+// the CPU never touches a particle after initialization.
+//
+// The current buffer doubles as a point geometry for drawing, with the
+// attribute aState = (x, y, z, speed factor) in world coordinates.
+//
+// Requires GL 3.0 (transform feedback); see isSupported().
+class ParticleSystem : Noncopyable {
+public:
+  struct Vertex {
+    Cvec4f state;
+
+    static const VertexFormat FORMAT;
+  };
+
+  // Particles fill the box [-halfSize, halfSize] x [groundY, top] x [-halfSize, halfSize]
+  ParticleSystem(int numParticles, float halfSize, float groundY, float top);
+
+  static bool isSupported();
+
+  // Advances the particles by dt seconds. Particles fall at fallSpeed times
+  // their own speed factor (which averages to 1) and drift sideways by up to
+  // `sway' units per second.
+  void update(float dt, float fallSpeed, float sway);
+
+  // Points at the current particle positions
+  std::shared_ptr<Geometry> getGeometry() const {
+    return geometries_[current_];
+  }
+
+  int getNumParticles() const {
+    return numParticles_;
+  }
+
+  // Average number of particles hitting the ground per second
+  double getLandingRate(float fallSpeed) const {
+    return numParticles_ * fallSpeed / (top_ - groundY_);
+  }
+
+private:
+  const int numParticles_;
+  const float halfSize_, groundY_, top_;
+  float time_;
+
+  std::shared_ptr<FormattedVbo> vbos_[2];
+  std::shared_ptr<Geometry> geometries_[2];
+  int current_;
+
+  GlProgram updateProgram_;
+  GlArrayObject vao_;
+  GLint stateAttrib_;
+  GLint uTime_, uDt_, uFallSpeed_, uSway_, uGroundY_, uTop_, uHalfSize_;
+};
+
+#endif
@@ -2,100 +2,179 @@
 # include <GL/glew.h>
 #endif
 
+#include <algorithm>
+#include <map>
+
 #include "uniforms.h"
 #include "picker.h"
 
 using namespace std;
-using namespace std::tr1;
 
 Picker::Picker(const RigTForm& initialRbt, Uniforms& uniforms)
-  : drawer_(initialRbt, uniforms)
-  , idCounter_(0)
-  , srgbFrameBuffer_(!g_Gl2Compatible) {}
+  : rbtNodeStack_(1)
+  , idToRbtNode_(1) // id 0 is the background
+  , drawer_(initialRbt, uniforms) {}
 
 bool Picker::visit(SgTransformNode& node) {
-  nodeStack_.push_back(node.shared_from_this());
+  shared_ptr<SgRbtNode> asRbtNode = dynamic_pointer_cast<SgRbtNode>(node.shared_from_this());
+  rbtNodeStack_.push_back(asRbtNode ? asRbtNode : rbtNodeStack_.back());
   return drawer_.visit(node);
 }
 
 bool Picker::postVisit(SgTransformNode& node) {
-  nodeStack_.pop_back();
+  rbtNodeStack_.pop_back();
   return drawer_.postVisit(node);
 }
 
 bool Picker::visit(SgShapeNode& node) {
-  idCounter_++;
-  for (int i = nodeStack_.size() - 1; i >= 0; --i) {
-    shared_ptr<SgRbtNode> asRbtNode = dynamic_pointer_cast<SgRbtNode>(nodeStack_[i]);
-    if (asRbtNode) {
-      addToMap(idCounter_, asRbtNode);
-      break;
-    }
-  }
-  const Cvec3 idColor = idToColor(idCounter_);
-
-  // DEBUG OUTPUT
-  cerr << idCounter_ << " => " << idColor[0] << ' ' << idColor[1] << ' ' << idColor[2] << endl;
-
-  drawer_.getUniforms().put("uIdColor", idColor);
+  if (find(skippedShapes_.begin(), skippedShapes_.end(), &node) != skippedShapes_.end())
+    return true;
+  const int id = idToRbtNode_.size();
+  idToRbtNode_.push_back(rbtNodeStack_.back());
+  drawer_.getUniforms().put("uId", id);
   return drawer_.visit(node);
 }
 
 bool Picker::postVisit(SgShapeNode& node) {
+  if (find(skippedShapes_.begin(), skippedShapes_.end(), &node) != skippedShapes_.end())
+    return true;
   return drawer_.postVisit(node);
 }
 
-shared_ptr<SgRbtNode> Picker::getRbtNodeAtXY(int x, int y) {
-  PackedPixel query;
-  glReadPixels(x, y, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, &query);
-  const int id = colorToId(query);
+// ---------- PickBuffer
 
-  // DEBUG OUTPUT
-  cerr << int(query.r) << ' ' << int(query.g) << ' ' << int(query.b) << " => " << id << endl;
+struct PickBuffer::MorePixels {
+  bool operator () (const Hit& a, const Hit& b) const {
+    return a.numPixels > b.numPixels;
+  }
+};
+
+PickBuffer::PickBuffer(int width, int height)
+  : width_(0)
+  , height_(0)
+  , fence_(0)
+  , rectX_(0)
+  , rectY_(0)
+  , rectWidth_(0)
+  , rectHeight_(0) {
+  glGenFramebuffers(1, &fbo_);
+  glGenRenderbuffers(1, &colorBuffer_);
+  glGenRenderbuffers(1, &depthBuffer_);
+  resize(width, height);
+}
 
-  return find(id);
+PickBuffer::~PickBuffer() {
+  cancel();
+  glDeleteRenderbuffers(1, &depthBuffer_);
+  glDeleteRenderbuffers(1, &colorBuffer_);
+  glDeleteFramebuffers(1, &fbo_);
 }
 
-//------------------
-// Helper functions
-//------------------
-//
-void Picker::addToMap(int id, shared_ptr<SgRbtNode> node) {
-  idToRbtNode_[id] = node;
+void PickBuffer::cancel() {
+  if (fence_)
+    glDeleteSync(fence_);
+  fence_ = 0;
+  nodes_.clear();
 }
 
-shared_ptr<SgRbtNode> Picker::find(int id) {
-  IdToRbtNodeMap::iterator it = idToRbtNode_.find(id);
-  if (it != idToRbtNode_.end())
-    return it->second;
-  else
-    return shared_ptr<SgRbtNode>(); // set to null
+void PickBuffer::resize(int width, int height) {
+  cancel();
+  width_ = max(1, width);
+  height_ = max(1, height);
+
+  glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, width_, height_);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width_, height_);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer_);
+  const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+    throw runtime_error("PickBuffer: incomplete framebuffer");
+  checkGlErrors();
 }
 
-// encode 2^4 = 16 IDs in each of R, G, B channel, for a total of 16^3 number of objects
-static const int NBITS = 4, N = 1 << NBITS, MASK = N-1;
-
-Cvec3 Picker::idToColor(int id) {
-  assert(id > 0 && id < N * N * N);
-  Cvec3 framebufferColor = Cvec3(id & MASK, (id >> NBITS) & MASK, (id >> (NBITS+NBITS)) & MASK);
-  framebufferColor = framebufferColor / N + Cvec3(0.5/N);
-
-  if (!srgbFrameBuffer_)
-    return framebufferColor;
-  else {
-    // if GL3 is used, the framebuffer will be in SRGB format, and the color we supply needs to be in linear space
-    Cvec3 linearColor;
-    for (int i = 0; i < 3; ++i) {
-      linearColor[i] = framebufferColor[i] <= 0.04045 ? framebufferColor[i]/12.92 : pow((framebufferColor[i] + 0.055)/1.055, 2.4);
-    }
-    return linearColor;
+void PickBuffer::begin(int x, int y, int width, int height) {
+  rectX_ = max(0, x);
+  rectY_ = max(0, y);
+  rectWidth_ = max(0, min(width_, x + width) - rectX_);
+  rectHeight_ = max(0, min(height_, y + height) - rectY_);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+  // only the rectangle is cleared, drawn and read
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(rectX_, rectY_, rectWidth_, rectHeight_);
+  const GLuint background[4] = { 0, 0, 0, 0 };
+  glClearBufferuiv(GL_COLOR, 0, background);
+  glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void PickBuffer::end(vector<shared_ptr<SgRbtNode> >& nodes) {
+  cancel();
+  nodes_.swap(nodes);
+
+  if (rectWidth_ > 0 && rectHeight_ > 0) {
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_);
+    // orphaned, so that a read still in flight does not hold this one up
+    glBufferData(GL_PIXEL_PACK_BUFFER, rectWidth_ * rectHeight_ * sizeof(GLuint), NULL, GL_STREAM_READ);
+    glReadPixels(rectX_, rectY_, rectWidth_, rectHeight_, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
   }
+  fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  glDisable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  checkGlErrors();
 }
 
-int Picker::colorToId(const PackedPixel& p) {
-  const int UNUSED_BITS = 8 - NBITS;
-  int id = p.r >> UNUSED_BITS;
-  id |= ((p.g >> UNUSED_BITS) << NBITS);
-  id |= ((p.b >> UNUSED_BITS) << (NBITS+NBITS));
-  return id;
+bool PickBuffer::poll(vector<Hit>& hits) {
+  if (!fence_)
+    return false;
+  const GLenum status = glClientWaitSync(fence_, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  if (status == GL_TIMEOUT_EXPIRED)
+    return false;
+  if (status == GL_WAIT_FAILED)
+    throw runtime_error("PickBuffer: waiting for a fence failed");
+
+  hits.clear();
+  const int numPixels = rectWidth_ * rectHeight_;
+  if (numPixels > 0) {
+    vector<int> idPixels(nodes_.size());
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo_);
+    const GLuint *ids = static_cast<const GLuint*>(
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, numPixels * sizeof(GLuint), GL_MAP_READ_BIT));
+    if (ids) {
+      for (int i = 0; i < numPixels; ++i) {
+        if (ids[i] < idPixels.size())
+          ++idPixels[ids[i]];
+      }
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // shapes under the same node count together
+    map<SgRbtNode*, int> hitIndices;
+    for (size_t id = 1; id < idPixels.size(); ++id) {
+      if (idPixels[id] == 0 || !nodes_[id])
+        continue;
+      map<SgRbtNode*, int>::iterator it = hitIndices.find(nodes_[id].get());
+      if (it == hitIndices.end()) {
+        hitIndices[nodes_[id].get()] = hits.size();
+        Hit hit = { nodes_[id], idPixels[id] };
+        hits.push_back(hit);
+      }
+      else
+        hits[it->second].numPixels += idPixels[id];
+    }
+    sort(hits.begin(), hits.end(), MorePixels());
+  }
+
+  cancel();
+  checkGlErrors();
+  return true;
 }
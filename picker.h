@@ -2,36 +2,32 @@
 #define PICKER_H
 
 #include <vector>
-#include <map>
 #include <memory>
 #include <stdexcept>
-#if __GNUG__
-#   include <tr1/memory>
-#endif
 
 #include "cvec.h"
 #include "scenegraph.h"
 #include "asstcommon.h"
-#include "ppm.h"
 #include "drawer.h"
 
+// Draws the scene for picking: every shape gets the next integer id, from
+// 1 on (0 is the background), sent as the uniform int uId, and the id maps
+// back to the closest SgRbtNode above the shape. Draw with a material that
+// writes uId to an integer color buffer, such as a PickBuffer. Shapes
+// passed to skipShape() are not drawn, for those whose shader does more
+// than the picking material can stand in for.
 class Picker : public SgNodeVisitor {
-  std::vector<std::tr1::shared_ptr<SgNode> > nodeStack_;
+  // closest SgRbtNode above each transform node on the path, or null
+  std::vector<std::shared_ptr<SgRbtNode> > rbtNodeStack_;
 
-  typedef std::map<int, std::tr1::shared_ptr<SgRbtNode> > IdToRbtNodeMap;
-  IdToRbtNodeMap idToRbtNode_;
+  // indexed by id
+  std::vector<std::shared_ptr<SgRbtNode> > idToRbtNode_;
 
-  int idCounter_;
-  bool srgbFrameBuffer_;
+  // shapes not drawn; only ever a handful
+  std::vector<const SgShapeNode*> skippedShapes_;
 
   Drawer drawer_;
 
-  void addToMap(int id, std::tr1::shared_ptr<SgRbtNode> node);
-  std::tr1::shared_ptr<SgRbtNode> find(int id);
-
-  Cvec3 idToColor(int id);
-  int colorToId(const PackedPixel& p);
-
 public:
   Picker(const RigTForm& initialRbt, Uniforms& uniforms);
 
@@ -40,8 +36,64 @@ public:
   virtual bool visit(SgShapeNode& node);
   virtual bool postVisit(SgShapeNode& node);
 
-  std::tr1::shared_ptr<SgRbtNode> getRbtNodeAtXY(int x, int y);
+  void skipShape(const SgShapeNode& node) {
+    skippedShapes_.push_back(&node);
+  }
+
+  // The node each id stands for, null for the background and for shapes
+  // with no SgRbtNode above them
+  std::vector<std::shared_ptr<SgRbtNode> >& getRbtNodes() {
+    return idToRbtNode_;
+  }
 };
 
+// An offscreen R32UI color buffer, with depth, that a Picker draws ids into,
+// and that is read back without stalling: end() copies the rectangle drawn
+// into a pixel buffer object and sets a fence, and poll() hands out the
+// nodes found there once the GPU is done, usually a frame later. Requires a
+// current GL 3 context throughout.
+class PickBuffer : Noncopyable {
+public:
+  struct Hit {
+    std::shared_ptr<SgRbtNode> node;
+    int numPixels; // covered by the node's shapes within the rectangle
+  };
+
+  PickBuffer(int width, int height);
+  ~PickBuffer();
+
+  // To follow the size of the window; drops a pending request
+  void resize(int width, int height);
+
+  // Redirects rendering into the buffer, and clears and limits drawing to
+  // the rectangle, clamped to the buffer. The viewport is left as it is.
+  void begin(int x, int y, int width, int height);
 
-#endif
\ No newline at end of file
+  // Restores the window framebuffer and starts reading the rectangle back.
+  // The ids drawn are resolved with nodes, which is taken over (see
+  // Picker::getRbtNodes()). Replaces a request still pending.
+  void end(std::vector<std::shared_ptr<SgRbtNode> >& nodes);
+
+  bool isPending() const {
+    return fence_ != 0;
+  }
+
+  // Returns false while the GPU has not caught up with the last request
+  // (or there is none). Otherwise stores the nodes seen in its rectangle
+  // into hits, most pixels first, and returns true.
+  bool poll(std::vector<Hit>& hits);
+
+private:
+  struct MorePixels;
+
+  int width_, height_;
+  GLuint fbo_, colorBuffer_, depthBuffer_;
+  GlBufferObject pbo_;
+  GLsync fence_; // 0 unless a request is pending
+  int rectX_, rectY_, rectWidth_, rectHeight_;
+  std::vector<std::shared_ptr<SgRbtNode> > nodes_;
+
+  void cancel();
+};
+
+#endif
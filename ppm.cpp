@@ -7,6 +7,14 @@
 #include <string>
 #include <stdexcept>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define PPM_SSE2
+# include <emmintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
+
 #ifdef __MAC__
 # include <GLUT/glut.h>
 #else
@@ -30,86 +38,245 @@ void writePpmScreenshot(const int width, const int height, const char *filename)
   }
 }
 
-// Read one positive integer from a (text) file. Line beginning with
-// "#" are ignored as comments.
-static int ppmReadInteger(istream& is) {
-  unsigned char ch;
-  int got = 0, done = 0, accum = 0, inComment = 0;
-  while (!done) {
-    ch = is.get();
-
-    if (inComment) {
-      if (ch=='\n')
-        inComment=0;
-      continue;
-    }
+static inline bool isPpmSpace(char ch) {
+  return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
 
-    if (isdigit(ch)) {
-      accum = accum*10 + ch-'0';
-      got = 1;
-    }
-    else if (ch=='#')
-      inComment=1;
-    else if (!ch || !strchr(" \t\r\n", ch))
-      throw runtime_error("ppmRead: invalid character");
-    else if (got)
-      done = 1;
-    else
-      ; // nothing
-  }
-  return accum;
+static inline bool isPpmDigit(char ch) {
+  return ch >= '0' && ch <= '9';
 }
 
-// Read the PPM header from the input stream and initialize the width and height
-// to the appropriate values, and throws rumtime_error on invalid width/height
-static void ppmReadHeader(istream& is, int &width, int &height) {
-  if ((width = ppmReadInteger(is)) < 0) {
-    throw runtime_error("ppmRead: invalid width");
+// Reads one positive integer starting at p, after any whitespace and
+// comments, and returns where it ends. Lines beginning with "#" are
+// ignored as comments.
+static const char* ppmReadInteger(const char* p, const char* end, unsigned& value) {
+  for (;;) {
+    while (p != end && isPpmSpace(*p))
+      ++p;
+    if (p == end || *p != '#')
+      break;
+    while (p != end && *p != '\n')
+      ++p;
   }
-  if ((height = ppmReadInteger(is)) < 0) {
-    throw runtime_error("ppmRead: invalid height");
+  if (p == end)
+    throw runtime_error("ppmRead: unexpected end of file");
+  if (!isPpmDigit(*p))
+    throw runtime_error("ppmRead: invalid character");
+
+  value = 0;
+  for (; p != end && isPpmDigit(*p); ++p) {
+    value = value * 10 + (*p - '0');
+    if (value > 0xffff)
+      throw runtime_error("ppmRead: value out of range");
   }
-  if (ppmReadInteger(is) != 255) {
-    cerr << "Warning: maxcolor not 255 : won't work well" << endl;
+  return p;
+}
+
+#ifdef PPM_SSE2
+static inline int countTrailingZeros(unsigned x) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i, x);
+  return int(i);
+#else
+  return __builtin_ctz(x);
+#endif
+}
+#endif
+
+// Parses count decimal values from the raster of a plain PPM file into
+// values, and returns where the last one ends.
+//
+// Sixteen characters at a time are classified with SSE2 into digits and
+// whitespace, and the digit runs walked with bit scans. A block with
+// anything else in it (a comment) is left to ppmReadInteger. A value that
+// runs over the end of a block is carried into the next one.
+static const char* ppmReadPlainValues(const char* p, const char* end, int count, unsigned maxValue,
+                                      unsigned short* values) {
+  int n = 0;
+  unsigned accum = 0;
+  bool inValue = false; // whether the digits before p start values[n]
+
+  while (n < count) {
+#ifdef PPM_SSE2
+    const __m128i beforeZero = _mm_set1_epi8('0' - 1), afterNine = _mm_set1_epi8('9' + 1);
+    const __m128i beforeTab = _mm_set1_epi8('\t' - 1), afterReturn = _mm_set1_epi8('\r' + 1);
+    const __m128i space = _mm_set1_epi8(' ');
+
+    while (n < count && end - p >= 16) {
+      const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const unsigned digits = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpgt_epi8(c, beforeZero), _mm_cmplt_epi8(c, afterNine)));
+      const unsigned spaces = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(c, space),
+                     _mm_and_si128(_mm_cmpgt_epi8(c, beforeTab), _mm_cmplt_epi8(c, afterReturn))));
+      if ((digits | spaces) != 0xffff)
+        break;
+
+      int pos = 0;
+      while (pos < 16) {
+        const unsigned rest = digits >> pos;
+        if (inValue) {
+          const int length = countTrailingZeros(~rest);
+          for (int i = pos; i < pos + length; ++i)
+            accum = min(accum * 10 + (p[i] - '0'), 0x10000u); // no wrapping around on long runs
+          if (accum > maxValue)
+            throw runtime_error("ppmRead: value above the maximum");
+          pos += length;
+          if (pos == 16)
+            break;
+          values[n++] = static_cast<unsigned short>(accum);
+          inValue = false;
+          if (n == count)
+            return p + pos;
+        }
+        else {
+          if (!rest)
+            break;
+          pos += countTrailingZeros(rest);
+          accum = 0;
+          inValue = true;
+        }
+      }
+      p += 16;
+    }
+    if (n == count)
+      break;
+#endif
+
+    // the end of the file, a comment or an invalid character
+    unsigned value;
+    if (inValue) {
+      value = accum;
+      for (; p != end && isPpmDigit(*p); ++p)
+        value = min(value * 10 + (*p - '0'), 0x10000u);
+      inValue = false;
+    }
+    else {
+      p = ppmReadInteger(p, end, value);
+    }
+    if (value > maxValue)
+      throw runtime_error("ppmRead: value above the maximum");
+    values[n++] = static_cast<unsigned short>(value);
   }
+  return p;
 }
 
-//Reads the actual PPM data and stores returns in in a pixels.
-void ppmRead(const char *filename, int& width, int& height, std::vector<PackedPixel>& pixels) {
-  ifstream is(filename, ios::binary);
-  if (!is.is_open())
-    throw runtime_error(string("ppmRead: Cannot open file ") + filename + " for read");
+// Scales values in [0, maxValue] to [0, fullValue], rounding to nearest
+static inline unsigned scaleValue(unsigned value, unsigned maxValue, unsigned fullValue) {
+  return (value * fullValue + maxValue / 2) / maxValue;
+}
 
-  // Sets bits to report IO error using exception
-  is.exceptions(ios::eofbit | ios::failbit | ios::badbit);
+PpmImage::PpmImage(const char* filename)
+  : file_(filename)
+  , width_(0)
+  , height_(0)
+  , maxValue_(0)
+  , bytesPerChannel_(1)
+  , pixels_(NULL) {
+  const char* p = file_.getData();
+  const char* end = p + file_.getSize();
 
-  char buf[2];
-  is.read(buf, 2);
+  if (end - p < 2 || p[0] != 'P' || (p[1] != '3' && p[1] != '6'))
+    throw runtime_error(string("ppmRead: bad file format in ") + filename);
+  const bool isBinary = p[1] == '6';
+  p += 2;
 
-  bool isbinary = false;
-  if (!memcmp(buf, "P3", 2))
-    isbinary = false;
-  else if (!memcmp(buf, "P6", 2))
-    isbinary = true;
-  else
-    throw runtime_error("ppmRead: bad file format");
+  unsigned width, height, maxValue;
+  p = ppmReadInteger(p, end, width);
+  p = ppmReadInteger(p, end, height);
+  p = ppmReadInteger(p, end, maxValue);
+  if (width == 0 || height == 0)
+    throw runtime_error("ppmRead: invalid width or height");
+  if (maxValue == 0)
+    throw runtime_error("ppmRead: invalid maximum value");
+  width_ = width;
+  height_ = height;
+  maxValue_ = maxValue;
+  bytesPerChannel_ = maxValue > 255 ? 2 : 1;
 
-  ppmReadHeader(is, width, height);
+  // a single whitespace character separates the header from the raster
+  if (p == end || !isPpmSpace(*p))
+    throw runtime_error("ppmRead: invalid header");
+  ++p;
 
-  pixels.resize(width * height);
+  if (isBinary) {
+    if (size_t(end - p) < size_t(getRowSize()) * height_)
+      throw runtime_error("ppmRead: unexpected end of file");
+    decodeBinary(reinterpret_cast<const unsigned char*>(p));
+  }
+  else {
+    decodePlain(p, end);
+  }
+}
 
-  if (isbinary) {
-    for (int row = height - 1; row >= 0; row--) {
-      is.read(reinterpret_cast<char*>(&pixels[row * width]), width * sizeof(PackedPixel));
+void PpmImage::decodeBinary(const unsigned char* raster) {
+  if (maxValue_ == 255) {
+    pixels_ = raster;
+    return;
+  }
+
+  const size_t numValues = size_t(3) * width_ * height_;
+  decoded_.resize(numValues * bytesPerChannel_);
+  if (bytesPerChannel_ == 1) {
+    for (size_t i = 0; i < numValues; ++i) {
+      if (raster[i] > maxValue_)
+        throw runtime_error("ppmRead: value above the maximum");
+      decoded_[i] = scaleValue(raster[i], maxValue_, 255);
     }
   }
   else {
-    for (int row = height - 1; row >= 0; row--) {
-      for (int l = 0; l < width; l++) {
-        PackedPixel &p = pixels[row * width + l];
-        p.r = ppmReadInteger(is);
-        p.g = ppmReadInteger(is);
-        p.b = ppmReadInteger(is);
+    // the file is big endian
+    unsigned short* values = reinterpret_cast<unsigned short*>(&decoded_[0]);
+    for (size_t i = 0; i < numValues; ++i) {
+      const unsigned value = (unsigned(raster[2 * i]) << 8) | raster[2 * i + 1];
+      if (value > unsigned(maxValue_))
+        throw runtime_error("ppmRead: value above the maximum");
+      values[i] = scaleValue(value, maxValue_, 65535);
+    }
+  }
+  pixels_ = &decoded_[0];
+}
+
+void PpmImage::decodePlain(const char* raster, const char* end) {
+  const int numValues = 3 * width_ * height_;
+  decoded_.resize(size_t(numValues) * bytesPerChannel_);
+
+  if (bytesPerChannel_ == 2) {
+    unsigned short* values = reinterpret_cast<unsigned short*>(&decoded_[0]);
+    ppmReadPlainValues(raster, end, numValues, maxValue_, values);
+    if (maxValue_ != 65535) {
+      for (int i = 0; i < numValues; ++i)
+        values[i] = scaleValue(values[i], maxValue_, 65535);
+    }
+  }
+  else {
+    vector<unsigned short> values(numValues);
+    ppmReadPlainValues(raster, end, numValues, maxValue_, &values[0]);
+    for (int i = 0; i < numValues; ++i)
+      decoded_[i] = scaleValue(values[i], maxValue_, 255);
+  }
+  pixels_ = &decoded_[0];
+}
+
+void ppmRead(const char *filename, int& width, int& height, std::vector<PackedPixel>& pixels) {
+  PpmImage image(filename);
+  width = image.getWidth();
+  height = image.getHeight();
+  pixels.resize(width * height);
+
+  for (int row = 0; row < height; ++row) {
+    PackedPixel* dest = &pixels[(height - 1 - row) * width];
+    const unsigned char* src = image.getRow(row);
+    if (image.getBytesPerChannel() == 1) {
+      memcpy(dest, src, width * sizeof(PackedPixel));
+    }
+    else {
+      const unsigned short* values = reinterpret_cast<const unsigned short*>(src);
+      for (int i = 0; i < width; ++i) {
+        dest[i].r = values[3 * i] >> 8;
+        dest[i].g = values[3 * i + 1] >> 8;
+        dest[i].b = values[3 * i + 2] >> 8;
       }
     }
   }
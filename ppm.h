@@ -3,6 +3,8 @@
 
 #include <vector>
 
+#include "mappedfile.h"
+
 void writePpmScreenshot(const int width, const int height, const char *filename);
 
 
@@ -11,8 +13,58 @@ struct PackedPixel {
   unsigned char r,g,b;
 };
 
-// The image file is read into `pixels' and its dimension stored into `width'
-// and `height'. Throws an exception on error.
+// A PPM image, binary (P6) or plain text (P3), parsed straight from the
+// mapped file. Throws runtime_error on error.
+//
+// Channels are 8 bit if the maximum value of the file is at most 255, and
+// 16 bit in native byte order otherwise, scaled up to the full range. An 8
+// bit binary image with a maximum value of 255 is not copied at all:
+// getRow() points into the mapped file.
+//
+// Rows are kept in file order, top row first. GL wants the bottom row
+// first, so flip them when uploading (ImageTexture does it row by row).
+class PpmImage {
+public:
+  explicit PpmImage(const char* filename);
+
+  int getWidth() const {
+    return width_;
+  }
+
+  int getHeight() const {
+    return height_;
+  }
+
+  // 1 or 2
+  int getBytesPerChannel() const {
+    return bytesPerChannel_;
+  }
+
+  int getRowSize() const {
+    return 3 * width_ * bytesPerChannel_;
+  }
+
+  // Row `row' of the image, counting from the top
+  const unsigned char* getRow(int row) const {
+    return pixels_ + row * getRowSize();
+  }
+
+private:
+  MappedFile file_;
+  int width_, height_, maxValue_, bytesPerChannel_;
+  std::vector<unsigned char> decoded_; // unless pixels_ points into file_
+  const unsigned char* pixels_;
+
+  void decodeBinary(const unsigned char* raster);
+  void decodePlain(const char* raster, const char* end);
+
+  PpmImage(const PpmImage&);
+  PpmImage& operator = (const PpmImage&);
+};
+
+// The image file is read into `pixels', bottom row first, 8 bits per
+// channel, and its dimension stored into `width' and `height'. Throws an
+// exception on error.
 void ppmRead(const char *filename, int& width, int& height, std::vector<PackedPixel>& pixels);
 
 #endif
@@ -0,0 +1,140 @@
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "profiler.h"
+
+using namespace std;
+
+// Single producer ring of zones. Only the owning thread writes; the writer
+// fills a slot before publishing it by advancing `head'.
+struct Profiler::ThreadBuffer {
+  vector<Zone> zones;
+  atomic<long long> head;
+  int id;
+  string name;
+
+  explicit ThreadBuffer(int threadId)
+    : zones(ZONES_PER_THREAD)
+    , head(0)
+    , id(threadId) {}
+};
+
+atomic<bool> Profiler::enabled_(false);
+
+// Thread buffers are never freed: their zones stay around for the dump even
+// after the thread exits. Registration is the only place taking a lock.
+static mutex g_registryMutex;
+vector<Profiler::ThreadBuffer*>& Profiler::getRegistry() {
+  static vector<ThreadBuffer*> registry;
+  return registry;
+}
+
+static const chrono::steady_clock::time_point g_epoch = chrono::steady_clock::now();
+
+// Frame start times, written by the frame loop thread only
+static long long g_frameStartNs[Profiler::MAX_FRAMES];
+static atomic<long long> g_numFrames(0);
+
+long long Profiler::now() {
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - g_epoch).count();
+}
+
+void Profiler::setEnabled(bool enabled) {
+  enabled_.store(enabled);
+}
+
+Profiler::ThreadBuffer& Profiler::getThreadBuffer() {
+  static thread_local ThreadBuffer *buffer = NULL;
+  if (!buffer) {
+    lock_guard<mutex> lock(g_registryMutex);
+    buffer = new ThreadBuffer(getRegistry().size());
+    getRegistry().push_back(buffer);
+  }
+  return *buffer;
+}
+
+void Profiler::setThreadName(const char *name) {
+  ThreadBuffer& buffer = getThreadBuffer();
+  lock_guard<mutex> lock(g_registryMutex);
+  buffer.name = name;
+}
+
+void Profiler::markFrame() {
+  if (!isEnabled())
+    return;
+  const long long n = g_numFrames.load(memory_order_relaxed);
+  g_frameStartNs[n % MAX_FRAMES] = now();
+  g_numFrames.store(n + 1, memory_order_release);
+}
+
+void Profiler::record(const char *name, long long startNs, long long endNs) {
+  ThreadBuffer& buffer = getThreadBuffer();
+  const long long h = buffer.head.load(memory_order_relaxed);
+  Zone& zone = buffer.zones[h % ZONES_PER_THREAD];
+  zone.name = name;
+  zone.startNs = startNs;
+  zone.endNs = endNs;
+  buffer.head.store(h + 1, memory_order_release);
+}
+
+// Minimal escaping for zone and thread names
+static void writeJsonString(ostream& os, const string& s) {
+  os << '"';
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\')
+      os << '\\';
+    os << s[i];
+  }
+  os << '"';
+}
+
+void Profiler::writeChromeTrace(ostream& os, int numFrames) {
+  const long long frames = g_numFrames.load(memory_order_acquire);
+  if (numFrames > MAX_FRAMES - 1)
+    numFrames = MAX_FRAMES - 1;
+  if (numFrames > frames)
+    numFrames = frames;
+  const long long sinceNs = numFrames > 0 ? g_frameStartNs[(frames - numFrames) % MAX_FRAMES] : 0;
+
+  vector<ThreadBuffer*> buffers;
+  {
+    lock_guard<mutex> lock(g_registryMutex);
+    buffers = getRegistry();
+  }
+
+  const ios::fmtflags flags = os.flags(ios::fixed);
+  const streamsize precision = os.precision(3);
+
+  os << "{\"traceEvents\":[\n";
+  bool first = true;
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    const ThreadBuffer& buffer = *buffers[i];
+    if (!buffer.name.empty()) {
+      os << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer.id
+         << ",\"args\":{\"name\":";
+      writeJsonString(os, buffer.name);
+      os << "}}";
+      first = false;
+    }
+
+    const long long head = buffer.head.load(memory_order_acquire);
+    const long long tail = head > ZONES_PER_THREAD ? head - ZONES_PER_THREAD : 0;
+    for (long long j = tail; j < head; ++j) {
+      const Zone& zone = buffer.zones[j % ZONES_PER_THREAD];
+      if (zone.startNs < sinceNs)
+        continue;
+      // timestamps are in microseconds
+      os << (first ? "" : ",\n") << "{\"name\":";
+      writeJsonString(os, zone.name);
+      os << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer.id
+         << ",\"ts\":" << zone.startNs / 1000.0
+         << ",\"dur\":" << (zone.endNs - zone.startNs) / 1000.0 << '}';
+      first = false;
+    }
+  }
+  os << "\n]}\n";
+
+  os.flags(flags);
+  os.precision(precision);
+}
@@ -0,0 +1,84 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// A tiny instrumenting frame profiler.
+//
+// Place PROFILE_ZONE("name") at the top of a scope to time it. Every thread
+// records its zones into its own ring buffer, so recording never takes a lock.
+// The thread owning the frame loop calls Profiler::markFrame() once per frame,
+// and Profiler::writeChromeTrace() dumps the zones of the last few frames in
+// the Chrome trace event format (load it in chrome://tracing or Perfetto).
+//
+// While the profiler is disabled a zone costs one relaxed atomic load. Define
+// NO_PROFILER to compile the zones out altogether.
+class Profiler {
+public:
+  // Zone names must be string literals (or otherwise outlive the profiler)
+  struct Zone {
+    const char *name;
+    long long startNs, endNs;
+  };
+
+  static bool isEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  static void setEnabled(bool enabled);
+
+  // Names the calling thread in the trace
+  static void setThreadName(const char *name);
+
+  // Nanoseconds since the profiler was first used
+  static long long now();
+
+  static void markFrame();
+
+  static void record(const char *name, long long startNs, long long endNs);
+
+  // Writes the zones of the last numFrames frames as Chrome trace JSON.
+  // Zones recorded while the dump runs may show up torn, so pause the
+  // profiler first if that matters.
+  static void writeChromeTrace(std::ostream& os, int numFrames);
+
+  static const int ZONES_PER_THREAD = 1 << 16;
+  static const int MAX_FRAMES = 256;
+
+private:
+  struct ThreadBuffer;
+  static ThreadBuffer& getThreadBuffer();
+  static std::vector<ThreadBuffer*>& getRegistry();
+
+  static std::atomic<bool> enabled_;
+};
+
+// Records the time between its construction and destruction as a zone
+class ProfileZone {
+  const char *name_;
+  long long startNs_;
+
+public:
+  explicit ProfileZone(const char *name)
+    : name_(name)
+    , startNs_(Profiler::isEnabled() ? Profiler::now() : -1) {}
+
+  ~ProfileZone() {
+    if (startNs_ >= 0)
+      Profiler::record(name_, startNs_, Profiler::now());
+  }
+};
+
+#define PROFILE_ZONE_CAT2(a, b) a##b
+#define PROFILE_ZONE_CAT(a, b) PROFILE_ZONE_CAT2(a, b)
+
+#ifdef NO_PROFILER
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_ZONE(name) ProfileZone PROFILE_ZONE_CAT(profileZone_, __LINE__)(name)
+#endif
+
+#endif
@@ -7,6 +7,7 @@
 
 #include "cvec.h"
 #include "matrix4.h"
+#include "simdmath.h"
 
 // Forward declarations used in the definition of Quat;
 class Quat;
@@ -81,13 +82,23 @@ public:
   }
 
   Quat operator * (const Quat& a) const {
-    const Cvec3 u(q_[1], q_[2], q_[3]), v(a.q_[1], a.q_[2], a.q_[3]);
-    return Quat(q_[0]*a.q_[0] - dot(u, v), (v*q_[0] + u*a.q_[0]) + cross(u, v));
+    Quat r;
+    simdmath::multiplyQuats(&q_[0], &a.q_[0], &r.q_[0]);
+    return r;
   }
 
+  // Rotates the x, y, z part of a, same as the vector part of
+  // q * (0, a[0], a[1], a[2]) * inv(q), and keeps a[3]
   Cvec4 operator * (const Cvec4& a) const {
-    const Quat r = *this * (Quat(0, a[0], a[1], a[2]) * inv(*this));
-    return Cvec4(r[1], r[2], r[3], a[3]);
+    Cvec4 r(0, 0, 0, a[3]);
+    simdmath::rotateByQuat(&q_[0], &a[0], &r[0]);
+    return r;
+  }
+
+  Cvec3 operator * (const Cvec3& a) const {
+    Cvec3 r;
+    simdmath::rotateByQuat(&q_[0], &a[0], &r[0]);
+    return r;
   }
 
   static Quat makeXRotation(const double ang) {
@@ -138,21 +149,29 @@ inline Quat normalize(const Quat& q) {
 }
 
 inline Matrix4 quatToMatrix(const Quat& q) {
-  Matrix4 r;
+  // one return value throughout, so that it is built in place
+  Matrix4 r(0);
   const double n = norm2(q);
   if (n < CS175_EPS2)
-    return Matrix4(0);
+    return r;
 
+  // each product once, with 2/n folded in
   const double two_over_n = 2/n;
-  r(0, 0) -= (q(2)*q(2) + q(3)*q(3)) * two_over_n;
-  r(0, 1) += (q(1)*q(2) - q(0)*q(3)) * two_over_n;
-  r(0, 2) += (q(1)*q(3) + q(2)*q(0)) * two_over_n;
-  r(1, 0) += (q(1)*q(2) + q(0)*q(3)) * two_over_n;
-  r(1, 1) -= (q(1)*q(1) + q(3)*q(3)) * two_over_n;
-  r(1, 2) += (q(2)*q(3) - q(1)*q(0)) * two_over_n;
-  r(2, 0) += (q(1)*q(3) - q(2)*q(0)) * two_over_n;
-  r(2, 1) += (q(2)*q(3) + q(1)*q(0)) * two_over_n;
-  r(2, 2) -= (q(1)*q(1) + q(2)*q(2)) * two_over_n;
+  const double xs = q(1) * two_over_n, ys = q(2) * two_over_n, zs = q(3) * two_over_n;
+  const double wx = q(0) * xs, wy = q(0) * ys, wz = q(0) * zs;
+  const double xx = q(1) * xs, xy = q(1) * ys, xz = q(1) * zs;
+  const double yy = q(2) * ys, yz = q(2) * zs, zz = q(3) * zs;
+
+  r(0, 0) = 1 - (yy + zz);
+  r(0, 1) = xy - wz;
+  r(0, 2) = xz + wy;
+  r(1, 0) = xy + wz;
+  r(1, 1) = 1 - (xx + zz);
+  r(1, 2) = yz - wx;
+  r(2, 0) = xz - wy;
+  r(2, 1) = yz + wx;
+  r(2, 2) = 1 - (xx + yy);
+  r(3, 3) = 1;
 
   assert(isAffine(r));
   return r;
@@ -6,14 +6,15 @@
 using namespace std;
 
 static const unsigned int kBlendBit = 1,
-                          kCullFaceBit = 2;
+                          kCullFaceBit = 2,
+                          kDepthMaskBit = 4;
 
 RenderStates::RenderStates()
   : glFrontAndBack(GL_FILL)
   , glBlendSrcFactor(GL_ONE)
   , glBlendDstFactor(GL_ZERO)
   , glCullFaceMode(GL_BACK)
-  , flags(kCullFaceBit) {}
+  , flags(kCullFaceBit | kDepthMaskBit) {}
 
 RenderStates& RenderStates::polygonMode(GLenum face, GLenum mode) {
   switch (mode) {
@@ -46,6 +47,14 @@ RenderStates& RenderStates::cullFace(GLenum mode) {
   return *this;
 }
 
+RenderStates& RenderStates::depthMask(bool write) {
+  if (write)
+    flags |= kDepthMaskBit;
+  else
+    flags &= ~kDepthMaskBit;
+  return *this;
+}
+
 RenderStates& RenderStates::enable(GLenum target) {
   switch (target) {
   case GL_BLEND:
@@ -112,6 +121,11 @@ void RenderStates::apply() const {
       ::glDisable(GL_CULL_FACE);
     currentRs.flags = (currentRs.flags & (~kCullFaceBit)) | (flags & kCullFaceBit);
   }
+
+  if ((flags & kDepthMaskBit) != (currentRs.flags & kDepthMaskBit)) {
+    ::glDepthMask((flags & kDepthMaskBit) ? GL_TRUE : GL_FALSE);
+    currentRs.flags = (currentRs.flags & (~kDepthMaskBit)) | (flags & kDepthMaskBit);
+  }
 }
 
 void RenderStates::captureFromGl() {
@@ -136,6 +150,11 @@ void RenderStates::captureFromGl() {
   if (::glIsEnabled(GL_CULL_FACE))
     flags |= kCullFaceBit;
 
+  GLboolean depthWrite;
+  ::glGetBooleanv(GL_DEPTH_WRITEMASK, &depthWrite);
+  if (depthWrite)
+    flags |= kDepthMaskBit;
+
   checkGlErrors();
 }
 
@@ -8,6 +8,7 @@
 // - glPolygonMode  (Default: GL_FRONT_AND_BACK, GL_FILL)
 // - glBlendFunc    (Default: GL_ONE, GL_ZERO)
 // - glCullFace     (Default: GL_BACK)
+// - glDepthMask    (Default: GL_TRUE)
 //
 // The following flags for glEnable/glDisable are supported
 //
@@ -26,6 +27,7 @@ public:
   RenderStates& polygonMode(GLenum face, GLenum mode);
   RenderStates& blendFunc(GLenum sfactor, GLenum dfactor);
   RenderStates& cullFace(GLenum mode);
+  RenderStates& depthMask(bool write);
 
   RenderStates& enable(GLenum target);
   RenderStates& disable(GLenum target);
@@ -44,7 +44,7 @@ public:
   }
 
   RigTForm operator * (const RigTForm& a) const {
-    return RigTForm(t_ + Cvec3(r_ * Cvec4(a.t_, 0)), r_*a.r_);
+    return RigTForm(t_ + r_ * a.t_, r_*a.r_);
   }
   Cvec3 operator * (const Cvec3& a) const {
     return Cvec3(operator*(Cvec4(a, 1)));
@@ -52,9 +52,21 @@ public:
 
 };
 
+// Exact comparison, to tell whether setting a RigTForm changes anything
+inline bool operator == (const RigTForm& a, const RigTForm& b) {
+  const Cvec3 at = a.getTranslation(), bt = b.getTranslation();
+  const Quat ar = a.getRotation(), br = b.getRotation();
+  return at[0] == bt[0] && at[1] == bt[1] && at[2] == bt[2] &&
+         ar[0] == br[0] && ar[1] == br[1] && ar[2] == br[2] && ar[3] == br[3];
+}
+
+inline bool operator != (const RigTForm& a, const RigTForm& b) {
+  return !(a == b);
+}
+
 inline RigTForm inv(const RigTForm& tform) {
   Quat invRot = inv(tform.getRotation());
-  return RigTForm(Cvec3(invRot * Cvec4(-tform.getTranslation(), 1)), invRot);
+  return RigTForm(invRot * -tform.getTranslation(), invRot);
 }
 
 inline RigTForm transFact(const RigTForm& tform) {
@@ -74,6 +86,25 @@ inline Matrix4 rigTFormToMatrix(const RigTForm& tform) {
   return m;
 }
 
+// The matrix of tform followed by scaling by scales, that is T R S, and its
+// normal matrix. The latter is R S^-1, since R is orthogonal, so it takes
+// no inverse. scales must not have zeros.
+inline void rigTFormScaleToMatrices(const RigTForm& tform, const Cvec3& scales, Matrix4& m, Matrix4& normalM) {
+  const Matrix4 rot = quatToMatrix(tform.getRotation());
+  const Cvec3 t = tform.getTranslation();
+  const double sx = scales[0], sy = scales[1], sz = scales[2];
+  const double isx = 1 / sx, isy = 1 / sy, isz = 1 / sz;
+  // written out, since -O2 leaves the loops in and goes through memory
+  m(0, 0) = rot(0, 0) * sx, m(0, 1) = rot(0, 1) * sy, m(0, 2) = rot(0, 2) * sz, m(0, 3) = t[0];
+  m(1, 0) = rot(1, 0) * sx, m(1, 1) = rot(1, 1) * sy, m(1, 2) = rot(1, 2) * sz, m(1, 3) = t[1];
+  m(2, 0) = rot(2, 0) * sx, m(2, 1) = rot(2, 1) * sy, m(2, 2) = rot(2, 2) * sz, m(2, 3) = t[2];
+  m(3, 0) = m(3, 1) = m(3, 2) = 0, m(3, 3) = 1;
+  normalM(0, 0) = rot(0, 0) * isx, normalM(0, 1) = rot(0, 1) * isy, normalM(0, 2) = rot(0, 2) * isz, normalM(0, 3) = 0;
+  normalM(1, 0) = rot(1, 0) * isx, normalM(1, 1) = rot(1, 1) * isy, normalM(1, 2) = rot(1, 2) * isz, normalM(1, 3) = 0;
+  normalM(2, 0) = rot(2, 0) * isx, normalM(2, 1) = rot(2, 1) * isy, normalM(2, 2) = rot(2, 2) * isz, normalM(2, 3) = 0;
+  normalM(3, 0) = normalM(3, 1) = normalM(3, 2) = 0, normalM(3, 3) = 1;
+}
+
 inline RigTForm lerp(const RigTForm& tform0, const RigTForm& tform1, double t) {
   return RigTForm(lerp(tform0.getTranslation(), tform1.getTranslation(), t),
                   slerp(tform0.getRotation(), tform1.getRotation(), t));
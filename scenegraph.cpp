@@ -1,26 +1,104 @@
 #include <algorithm>
+#include <unordered_set>
 
 #include "scenegraph.h"
 
 using namespace std;
-using namespace std::tr1;
+
+unsigned SgTransformNode::structureVersion_ = 0;
 
 bool SgTransformNode::accept(SgNodeVisitor& visitor) {
   if (!visitor.visit(*this))
     return false;
   for (int i = 0, n = children_.size(); i < n; ++i) {
-    if (!children_[i]->accept(visitor))
+    if (children_[i] && !children_[i]->accept(visitor))
       return false;
   }
   return visitor.postVisit(*this);
 }
 
 void SgTransformNode::addChild(shared_ptr<SgNode> child) {
+  if (!childIndices_.insert(make_pair(child.get(), int(children_.size()))).second)
+    throw runtime_error("SgTransformNode::addChild: already a child");
   children_.push_back(child);
+  ++structureVersion_;
+  markDirty();
 }
 
 void SgTransformNode::removeChild(shared_ptr<SgNode> child) {
-  children_.erase(find(children_.begin(), children_.end(), child));
+  unordered_map<const SgNode*, int>::iterator i = childIndices_.find(child.get());
+  if (i == childIndices_.end())
+    throw runtime_error("SgTransformNode::removeChild: not a child");
+  children_[i->second].reset();
+  childIndices_.erase(i);
+  ++numHoles_;
+  ++structureVersion_;
+  markDirty();
+
+  // keeps the cost of compaction amortized constant per removal even if
+  // nobody ever calls compactChildren()
+  if (numHoles_ > 64 && numHoles_ > getNumChildren())
+    compactChildren();
+}
+
+void SgTransformNode::addChildren(const vector<shared_ptr<SgNode> >& children) {
+  children_.reserve(children_.size() + children.size());
+  childIndices_.reserve(childIndices_.size() + children.size());
+  for (size_t i = 0; i < children.size(); ++i)
+    addChild(children[i]);
+}
+
+void SgTransformNode::removeChildren(const vector<shared_ptr<SgNode> >& children) {
+  // look everything up first so that a bad entry leaves this node untouched
+  unordered_set<const SgNode*> seen;
+  seen.reserve(children.size());
+  for (size_t i = 0; i < children.size(); ++i) {
+    if (!hasChild(children[i]))
+      throw runtime_error("SgTransformNode::removeChildren: not a child");
+    if (!seen.insert(children[i].get()).second)
+      throw runtime_error("SgTransformNode::removeChildren: listed twice");
+  }
+  for (size_t i = 0; i < children.size(); ++i) {
+    unordered_map<const SgNode*, int>::iterator j = childIndices_.find(children[i].get());
+    children_[j->second].reset();
+    childIndices_.erase(j);
+    ++numHoles_;
+  }
+  ++structureVersion_;
+  markDirty();
+
+  // as in removeChild()
+  if (numHoles_ > 64 && numHoles_ > getNumChildren())
+    compactChildren();
+}
+
+shared_ptr<SgNode> SgTransformNode::getChild(int i) const {
+  if (numHoles_ == 0)
+    return children_[i];
+  // skip the holes rather than compact, so that looking does not change
+  // the node
+  for (int j = 0, size = children_.size(); j < size; ++j) {
+    if (children_[j] && i-- == 0)
+      return children_[j];
+  }
+  throw out_of_range("SgTransformNode::getChild: no such child");
+}
+
+void SgTransformNode::compactChildren() {
+  if (numHoles_ == 0)
+    return;
+  int n = 0;
+  for (int i = 0, size = children_.size(); i < size; ++i) {
+    if (!children_[i])
+      continue;
+    if (n != i) {
+      childIndices_[children_[i].get()] = n;
+      children_[n].swap(children_[i]);
+    }
+    ++n;
+  }
+  children_.resize(n);
+  numHoles_ = 0;
 }
 
 bool SgShapeNode::accept(SgNodeVisitor& visitor) {
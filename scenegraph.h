@@ -2,11 +2,9 @@
 #define SCENEGRAPH_H
 
 #include <vector>
+#include <unordered_map>
 #include <memory>
 #include <stdexcept>
-#if __GNUG__
-#   include <tr1/memory>
-#endif
 
 #include "matrix4.h"
 #include "rigtform.h"
@@ -14,10 +12,11 @@
 #include "uniforms.h"
 #include "geometry.h"
 #include "asstcommon.h"
+#include "changetracker.h"
 
 class SgNodeVisitor;
 
-class SgNode : public std::tr1::enable_shared_from_this<SgNode>, Noncopyable {
+class SgNode : public std::enable_shared_from_this<SgNode>, Noncopyable {
 public:
   virtual bool accept(SgNodeVisitor& vistor) = 0;
   virtual ~SgNode() {}
@@ -41,24 +40,60 @@ protected:
 // rigid body transform to represent its frame with respect to
 // the parent frame
 //
+// Children are kept in the order they were added. Removing a child takes
+// constant time: it leaves a hole behind, and the holes are squeezed out by
+// compactChildren(), or automatically once they outnumber the children. Code
+// that adds and removes many children per frame should call
+// compactChildren() once it is done.
+//
 class SgTransformNode : public SgNode {
 public:
   virtual bool accept(SgNodeVisitor& visitor);
   virtual RigTForm getRbt() = 0;
 
-  void addChild(std::tr1::shared_ptr<SgNode> child);
-  void removeChild(std::tr1::shared_ptr<SgNode> child);
+  // Throws if child is already a child of this node
+  void addChild(std::shared_ptr<SgNode> child);
+
+  // Throws if child is not a child of this node
+  void removeChild(std::shared_ptr<SgNode> child);
+
+  void addChildren(const std::vector<std::shared_ptr<SgNode> >& children);
+
+  // Throws, leaving this node untouched, if an entry is not a child of this
+  // node or appears twice
+  void removeChildren(const std::vector<std::shared_ptr<SgNode> >& children);
+
+  // Removes the holes left by removed children
+  void compactChildren();
+
+  bool hasChild(const std::shared_ptr<SgNode>& child) const {
+    return childIndices_.count(child.get()) != 0;
+  }
 
   int getNumChildren() const {
-    return children_.size();
+    return children_.size() - numHoles_;
   }
 
-  std::tr1::shared_ptr<SgNode> getChild(int i) {
-    return children_[i];
+  // The i-th child, in the order they were added. Takes constant time
+  // unless there are holes left to compact.
+  std::shared_ptr<SgNode> getChild(int i) const;
+
+  // Changes whenever a child is added to or removed from any transform
+  // node, so that code caching the shape of a graph knows to rebuild
+  static unsigned getStructureVersion() {
+    return structureVersion_;
   }
 
+protected:
+  SgTransformNode() : numHoles_(0) {}
+
 private:
-  std::vector<std::tr1::shared_ptr<SgNode> > children_;
+  // removed children are null until the next compaction
+  std::vector<std::shared_ptr<SgNode> > children_;
+  std::unordered_map<const SgNode*, int> childIndices_; // child -> index into children_
+  int numHoles_;
+
+  static unsigned structureVersion_;
 };
 
 //
@@ -71,6 +106,14 @@ public:
 
   virtual Matrix4 getAffineMatrix() = 0;
   virtual void draw(const Uniforms& uniforms) = 0;
+
+  // The model view matrix of the shape below a node with eye-relative
+  // frame eyeRbt, and its normal matrix. This takes a general inverse;
+  // shapes that know more about their affine matrix do better.
+  virtual void getModelViewMatrices(const RigTForm& eyeRbt, Matrix4& MVM, Matrix4& NMVM) {
+    MVM = rigTFormToMatrix(eyeRbt) * getAffineMatrix();
+    NMVM = normalMatrix(MVM);
+  }
 };
 
 
@@ -88,8 +131,8 @@ public:
 
 
 RigTForm getPathAccumRbt(
-  std::tr1::shared_ptr<SgTransformNode> source,
-  std::tr1::shared_ptr<SgTransformNode> destination,
+  std::shared_ptr<SgTransformNode> source,
+  std::shared_ptr<SgTransformNode> destination,
   int offsetFromDestination = 0);
 
 
@@ -118,6 +161,8 @@ public:
   }
 
   void setRbt(const RigTForm& rbt) {
+    if (rbt != rbt_)
+      markDirty();
     rbt_ = rbt;
   }
 
@@ -125,37 +170,61 @@ private:
   RigTForm rbt_;
 };
 
+// A shape node whose affine matrix is a translation, then rotations about
+// x, y and z by eulerAngles (in degrees), then a scaling. The parts are kept
+// apart, so that the model view matrix is a RigTForm composition and the
+// normal matrix comes without an inverse.
 class SgGeometryShapeNode : public SgShapeNode {
 public:
-  std::tr1::shared_ptr<Geometry> geometry;
-  std::tr1::shared_ptr<Material> material;
-  Matrix4 affineMatrix;
+  std::shared_ptr<Geometry> geometry;
+  std::shared_ptr<Material> material;
+
+  // Level of detail the shape was last drawn at, if its geometry has levels
+  int lodLevel;
 
-  SgGeometryShapeNode(std::tr1::shared_ptr<Geometry> _geometry,
-                      std::tr1::shared_ptr<Material> _material,
+  SgGeometryShapeNode(std::shared_ptr<Geometry> _geometry,
+                      std::shared_ptr<Material> _material,
                       const Cvec3& translation = Cvec3(0, 0, 0),
                       const Cvec3& eulerAngles = Cvec3(0, 0, 0),
                       const Cvec3& scales = Cvec3(1, 1, 1))
     : geometry(_geometry)
     , material(_material)
-    , affineMatrix(Matrix4::makeTranslation(translation) *
-                   Matrix4::makeXRotation(eulerAngles[0]) *
-                   Matrix4::makeYRotation(eulerAngles[1]) *
-                   Matrix4::makeZRotation(eulerAngles[2]) *
-                   Matrix4::makeScale(scales)) {}
+    , lodLevel(0)
+    , affineMatrix_(Matrix4::makeScale(scales_)) { // consistent with the zero scales_
+    setAffineMatrix(translation, eulerAngles, scales);
+  }
 
   virtual Matrix4 getAffineMatrix() {
-    return affineMatrix;
+    return affineMatrix_;
+  }
+
+  // The translation and rotation part of the affine matrix
+  const RigTForm& getAffineRbt() const {
+    return affineRbt_;
+  }
+
+  const Cvec3& getScales() const {
+    return scales_;
   }
 
   void setAffineMatrix(const Cvec3& translation = Cvec3(0, 0, 0),
                        const Cvec3& eulerAngles = Cvec3(0, 0, 0),
                        const Cvec3& scales = Cvec3(1, 1, 1)) {
-    affineMatrix = Matrix4::makeTranslation(translation) *
-                   Matrix4::makeXRotation(eulerAngles[0]) *
-                   Matrix4::makeYRotation(eulerAngles[1]) *
-                   Matrix4::makeZRotation(eulerAngles[2]) *
-                   Matrix4::makeScale(scales);
+    const RigTForm affineRbt(translation, Quat::makeXRotation(eulerAngles[0]) *
+                                          Quat::makeYRotation(eulerAngles[1]) *
+                                          Quat::makeZRotation(eulerAngles[2]));
+    // many shapes get set every frame to where they already are
+    if (affineRbt == affineRbt_ && scales[0] == scales_[0] &&
+        scales[1] == scales_[1] && scales[2] == scales_[2])
+      return;
+    affineRbt_ = affineRbt;
+    scales_ = scales;
+    affineMatrix_ = rigTFormToMatrix(affineRbt_) * Matrix4::makeScale(scales);
+    markDirty();
+  }
+
+  virtual void getModelViewMatrices(const RigTForm& eyeRbt, Matrix4& MVM, Matrix4& NMVM) {
+    rigTFormScaleToMatrices(eyeRbt * affineRbt_, scales_, MVM, NMVM);
   }
 
   virtual void draw(const Uniforms& uniforms) {
@@ -164,6 +233,11 @@ public:
     else
       material->draw(*geometry, uniforms);
   }
+
+private:
+  RigTForm affineRbt_;
+  Cvec3 scales_;
+  Matrix4 affineMatrix_; // affineRbt_ times the scaling
 };
 
 #endif
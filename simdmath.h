@@ -0,0 +1,131 @@
+#ifndef SIMDMATH_H
+#define SIMDMATH_H
+
+// Kernels behind the products of Matrix4 and Quat, on arrays of doubles.
+//
+// The backend is picked at compile time: AVX (four doubles per register)
+// when the compiler targets it (-mavx, /arch:AVX), else SSE2 (two doubles
+// per register, always there on x86-64), else plain loops. Define
+// CS175_MATH_SCALAR to force the plain loops. Every backend gives the same
+// results up to rounding.
+
+#if !defined(CS175_MATH_SCALAR) && defined(__AVX__)
+#   define CS175_MATH_AVX
+#   include <immintrin.h>
+#elif !defined(CS175_MATH_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#   define CS175_MATH_SSE2
+#   include <emmintrin.h>
+#endif
+
+namespace simdmath {
+
+// Name of the backend compiled in
+inline const char* getBackendName() {
+#if defined(CS175_MATH_AVX)
+  return "AVX";
+#elif defined(CS175_MATH_SSE2)
+  return "SSE2";
+#else
+  return "scalar";
+#endif
+}
+
+// r = a * b for row-major 4x4 matrices; r must not alias a or b
+inline void multiplyMatrices(const double* a, const double* b, double* r) {
+#if defined(CS175_MATH_AVX)
+  const __m256d b0 = _mm256_loadu_pd(b), b1 = _mm256_loadu_pd(b + 4);
+  const __m256d b2 = _mm256_loadu_pd(b + 8), b3 = _mm256_loadu_pd(b + 12);
+  for (int i = 0; i < 4; ++i) {
+    const double *ai = a + 4 * i;
+    const __m256d r01 = _mm256_add_pd(_mm256_mul_pd(_mm256_broadcast_sd(ai), b0), _mm256_mul_pd(_mm256_broadcast_sd(ai + 1), b1));
+    const __m256d r23 = _mm256_add_pd(_mm256_mul_pd(_mm256_broadcast_sd(ai + 2), b2), _mm256_mul_pd(_mm256_broadcast_sd(ai + 3), b3));
+    _mm256_storeu_pd(r + 4 * i, _mm256_add_pd(r01, r23));
+  }
+#elif defined(CS175_MATH_SSE2)
+  __m128d bLo[4], bHi[4];
+  for (int j = 0; j < 4; ++j) {
+    bLo[j] = _mm_loadu_pd(b + 4 * j);
+    bHi[j] = _mm_loadu_pd(b + 4 * j + 2);
+  }
+  for (int i = 0; i < 4; ++i) {
+    const __m128d a0 = _mm_set1_pd(a[4 * i]), a1 = _mm_set1_pd(a[4 * i + 1]);
+    const __m128d a2 = _mm_set1_pd(a[4 * i + 2]), a3 = _mm_set1_pd(a[4 * i + 3]);
+    _mm_storeu_pd(r + 4 * i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(a0, bLo[0]), _mm_mul_pd(a1, bLo[1])),
+                                        _mm_add_pd(_mm_mul_pd(a2, bLo[2]), _mm_mul_pd(a3, bLo[3]))));
+    _mm_storeu_pd(r + 4 * i + 2, _mm_add_pd(_mm_add_pd(_mm_mul_pd(a0, bHi[0]), _mm_mul_pd(a1, bHi[1])),
+                                            _mm_add_pd(_mm_mul_pd(a2, bHi[2]), _mm_mul_pd(a3, bHi[3]))));
+  }
+#else
+  for (int i = 0; i < 4; ++i) {
+    for (int k = 0; k < 4; ++k) {
+      r[4 * i + k] = a[4 * i] * b[k] + a[4 * i + 1] * b[4 + k] + a[4 * i + 2] * b[8 + k] + a[4 * i + 3] * b[12 + k];
+    }
+  }
+#endif
+}
+
+// r = m * v for a row-major 4x4 matrix; r must not alias v
+inline void multiplyMatrixVector(const double* m, const double* v, double* r) {
+#if defined(CS175_MATH_AVX)
+  const __m256d x = _mm256_loadu_pd(v);
+  const __m256d p0 = _mm256_mul_pd(_mm256_loadu_pd(m), x), p1 = _mm256_mul_pd(_mm256_loadu_pd(m + 4), x);
+  const __m256d p2 = _mm256_mul_pd(_mm256_loadu_pd(m + 8), x), p3 = _mm256_mul_pd(_mm256_loadu_pd(m + 12), x);
+  // (p0[0]+p0[1], p1[0]+p1[1], p0[2]+p0[3], p1[2]+p1[3]) and likewise for p2, p3
+  const __m256d h01 = _mm256_hadd_pd(p0, p1), h23 = _mm256_hadd_pd(p2, p3);
+  _mm256_storeu_pd(r, _mm256_add_pd(_mm256_permute2f128_pd(h01, h23, 0x20),
+                                    _mm256_permute2f128_pd(h01, h23, 0x31)));
+#elif defined(CS175_MATH_SSE2)
+  const __m128d xLo = _mm_loadu_pd(v), xHi = _mm_loadu_pd(v + 2);
+  __m128d s[4];
+  for (int i = 0; i < 4; ++i)
+    s[i] = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(m + 4 * i), xLo), _mm_mul_pd(_mm_loadu_pd(m + 4 * i + 2), xHi));
+  _mm_storeu_pd(r, _mm_add_pd(_mm_unpacklo_pd(s[0], s[1]), _mm_unpackhi_pd(s[0], s[1])));
+  _mm_storeu_pd(r + 2, _mm_add_pd(_mm_unpacklo_pd(s[2], s[3]), _mm_unpackhi_pd(s[2], s[3])));
+#else
+  for (int i = 0; i < 4; ++i)
+    r[i] = m[4 * i] * v[0] + m[4 * i + 1] * v[1] + m[4 * i + 2] * v[2] + m[4 * i + 3] * v[3];
+#endif
+}
+
+// r = a * b for quaternions laid out as w, x, y, z; r may alias a or b.
+// SSE2 has no version: on two lanes the sign flips and shuffles made it
+// slower than the plain expressions, which the compiler schedules well.
+inline void multiplyQuats(const double* a, const double* b, double* r) {
+#if defined(CS175_MATH_AVX)
+  // r = aw (bw, bx, by, bz) + ax (-bx, bw, -bz, by) + ay (-by, bz, bw, -bx) + az (-bz, -by, bx, bw)
+  const __m256d bv = _mm256_loadu_pd(b);
+  const __m256d bHalves = _mm256_permute2f128_pd(bv, bv, 0x01); // by bz bw bx
+  const __m256d tx = _mm256_xor_pd(_mm256_permute_pd(bv, 0x5), _mm256_set_pd(0., -0., 0., -0.));
+  const __m256d ty = _mm256_xor_pd(bHalves, _mm256_set_pd(-0., 0., 0., -0.));
+  const __m256d tz = _mm256_xor_pd(_mm256_permute_pd(bHalves, 0x5), _mm256_set_pd(0., 0., -0., -0.));
+  // summed pairwise, which shortens the dependency chain
+  const __m256d rwx = _mm256_add_pd(_mm256_mul_pd(_mm256_broadcast_sd(a), bv), _mm256_mul_pd(_mm256_broadcast_sd(a + 1), tx));
+  const __m256d ryz = _mm256_add_pd(_mm256_mul_pd(_mm256_broadcast_sd(a + 2), ty), _mm256_mul_pd(_mm256_broadcast_sd(a + 3), tz));
+  _mm256_storeu_pd(r, _mm256_add_pd(rwx, ryz));
+#else
+  const double w = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+  const double x = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+  const double y = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+  const double z = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+  r[0] = w, r[1] = x, r[2] = y, r[3] = z;
+#endif
+}
+
+// r = v rotated by the (not necessarily unit) quaternion q, that is the
+// vector part of q (0, v) inv(q), as v + 2/|q|^2 (w (u x v) + u x (u x v))
+// with u the vector part of q. Three doubles leave little to vectorize, so
+// every backend uses this closed form, which replaces two quaternion
+// products. r may alias v.
+inline void rotateByQuat(const double* q, const double* v, double* r) {
+  const double s = 2 / (q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  const double cx = q[2] * v[2] - q[3] * v[1], cy = q[3] * v[0] - q[1] * v[2], cz = q[1] * v[1] - q[2] * v[0];
+  const double dx = q[2] * cz - q[3] * cy, dy = q[3] * cx - q[1] * cz, dz = q[1] * cy - q[2] * cx;
+  const double x = v[0] + s * (q[0] * cx + dx);
+  const double y = v[1] + s * (q[0] * cy + dy);
+  const double z = v[2] + s * (q[0] * cz + dz);
+  r[0] = x, r[1] = y, r[2] = z;
+}
+
+}
+
+#endif
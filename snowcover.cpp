@@ -0,0 +1,100 @@
+#include <cmath>
+#include <algorithm>
+
+#include "snowcover.h"
+#include "asstcommon.h"
+#include "changetracker.h"
+
+using namespace std;
+
+const double SnowCover::MAX_DEPTH = 0.2;
+
+SnowCover::SnowCover(double halfSize)
+  : halfSize_(halfSize)
+  , depth_(RESOLUTION * RESOLUTION, 0)
+  , dirty_(true)
+  , uploadBuffer_(RESOLUTION * RESOLUTION, 0) {
+  glBindTexture(GL_TEXTURE_2D, tex_);
+  glTexImage2D(GL_TEXTURE_2D, 0, g_Gl2Compatible ? GL_LUMINANCE : GL_R8, RESOLUTION, RESOLUTION,
+               0, g_Gl2Compatible ? GL_LUMINANCE : GL_RED, GL_UNSIGNED_BYTE, &uploadBuffer_[0]);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  checkGlErrors();
+}
+
+void SnowCover::splat(double x, double z, double radius, double depth) {
+  const double texelsPerUnit = RESOLUTION / (2 * halfSize_);
+  const double cx = (x + halfSize_) * texelsPerUnit - 0.5;
+  const double cy = (z + halfSize_) * texelsPerUnit - 0.5;
+  const double r = max(radius * texelsPerUnit, 1.0);
+  const double amount = depth / MAX_DEPTH;
+
+  const int x0 = max(0, int(floor(cx - r))), x1 = min(RESOLUTION - 1, int(ceil(cx + r)));
+  const int y0 = max(0, int(floor(cy - r))), y1 = min(RESOLUTION - 1, int(ceil(cy + r)));
+  if (x0 > x1 || y0 > y1)
+    return;
+
+  lock_guard<mutex> lock(mutex_);
+  for (int y = y0; y <= y1; ++y) {
+    for (int x = x0; x <= x1; ++x) {
+      const double d2 = ((x - cx) * (x - cx) + (y - cy) * (y - cy)) / (r * r);
+      if (d2 >= 1)
+        continue;
+      // smooth falloff towards the rim of the disk
+      const double w = (1 - d2) * (1 - d2);
+      float& t = depth_[y * RESOLUTION + x];
+      t = float(min(1.0, t + amount * w));
+    }
+  }
+  dirty_ = true;
+  markDirty();
+}
+
+void SnowCover::melt(double depth) {
+  const float amount = float(depth / MAX_DEPTH);
+  lock_guard<mutex> lock(mutex_);
+  bool changed = false;
+  for (size_t i = 0; i < depth_.size(); ++i) {
+    if (depth_[i] > 0) {
+      depth_[i] = max(0.f, depth_[i] - amount);
+      changed = true;
+    }
+  }
+  dirty_ = dirty_ || changed;
+  if (changed)
+    markDirty();
+}
+
+void SnowCover::clear() {
+  lock_guard<mutex> lock(mutex_);
+  fill(depth_.begin(), depth_.end(), 0.f);
+  dirty_ = true;
+  markDirty();
+}
+
+double SnowCover::getCoverage() const {
+  lock_guard<mutex> lock(mutex_);
+  int n = 0;
+  for (size_t i = 0; i < depth_.size(); ++i)
+    n += depth_[i] > 0;
+  return double(n) / depth_.size();
+}
+
+void SnowCover::bind() const {
+  glBindTexture(GL_TEXTURE_2D, tex_);
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (!dirty_)
+      return;
+    for (size_t i = 0; i < depth_.size(); ++i)
+      uploadBuffer_[i] = (unsigned char)(depth_[i] * 255 + 0.5f);
+    dirty_ = false;
+  }
+
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, RESOLUTION, RESOLUTION,
+                  g_Gl2Compatible ? GL_LUMINANCE : GL_RED, GL_UNSIGNED_BYTE, &uploadBuffer_[0]);
+}
@@ -0,0 +1,58 @@
+#ifndef SNOWCOVER_H
+#define SNOWCOVER_H
+
+#include <vector>
+#include <mutex>
+
+#include "glsupport.h"
+#include "texture.h"
+
+// Snow lying on a square patch of ground, kept as a fixed resolution depth
+// map. Landing flakes are splatted into the map on the CPU; as a Texture it
+// uploads the map lazily whenever it gets bound after a change, so the cost
+// of drawing the snow does not depend on how long it has been snowing.
+//
+// Texel (0, 0) is at the (-halfSize, -halfSize) corner in x and z, matching
+// the texture coordinates of makePlane(). The red channel holds the depth,
+// with 1 meaning MAX_DEPTH.
+//
+// splat() and melt() may be called from any thread, bind() only from the
+// thread owning the GL context.
+class SnowCover : public Texture {
+public:
+  static const int RESOLUTION = 256;
+  static const double MAX_DEPTH; // in world units
+
+  // Requires a current GL context
+  explicit SnowCover(double halfSize);
+
+  // Adds `depth' worth of snow at ground position (x, z), spread over a
+  // disk of the given radius
+  void splat(double x, double z, double radius, double depth);
+
+  // Removes up to `depth' of snow everywhere
+  void melt(double depth);
+
+  void clear();
+
+  // Fraction of texels with any snow on them
+  double getCoverage() const;
+
+  virtual GLenum getSamplerType() const {
+    return GL_SAMPLER_2D;
+  }
+
+  virtual void bind() const;
+
+private:
+  const double halfSize_;
+
+  mutable std::mutex mutex_;
+  std::vector<float> depth_;     // in units of MAX_DEPTH, guarded by mutex_
+  mutable bool dirty_;           // guarded by mutex_
+
+  GlTexture tex_;
+  mutable std::vector<unsigned char> uploadBuffer_;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include <stdexcept>
+
+#include "streamingbuffer.h"
+#include "changetracker.h"
+
+using namespace std;
+
+// Lets go of a span once the last shared_ptr to it is gone
+struct StreamingBuffer::Releaser {
+  StreamingBuffer* buffer;
+
+  void operator()(Span* span) const {
+    buffer->release(span->offset);
+    delete span;
+  }
+};
+
+bool StreamingBuffer::isPersistentSupported() {
+#ifdef __MAC__
+  return false;
+#else
+  return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+#endif
+}
+
+StreamingBuffer::StreamingBuffer(int size)
+  : size_(size)
+  , persistentData_(NULL)
+  , mapped_(false)
+  , head_(0)
+  , numStalls_(0) {
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+#ifndef __MAC__
+  if (isPersistentSupported()) {
+    // coherent, so that writes need no explicit flush before drawing
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+    persistentData_ = static_cast<char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+    if (!persistentData_)
+      throw runtime_error("StreamingBuffer: cannot map the buffer persistently");
+  }
+#endif
+  if (!persistentData_)
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+  checkGlErrors();
+}
+
+StreamingBuffer::~StreamingBuffer() {
+  if (persistentData_) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+  for (size_t i = 0; i < regions_.size(); ++i) {
+    if (regions_[i].fence)
+      glDeleteSync(regions_[i].fence);
+  }
+}
+
+void StreamingBuffer::release(int offset) {
+  for (size_t i = 0; i < regions_.size(); ++i) {
+    if (regions_[i].begin == offset && !regions_[i].released) {
+      regions_[i].released = true;
+      return;
+    }
+  }
+  assert(0);
+}
+
+// Everything issued so far that could read released regions is covered by
+// one new fence
+void StreamingBuffer::fenceReleased() {
+  GLsync fence = 0;
+  for (size_t i = 0; i < regions_.size(); ++i) {
+    if (regions_[i].released && !regions_[i].fence) {
+      if (!fence)
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      regions_[i].fence = fence;
+    }
+  }
+}
+
+bool StreamingBuffer::overlapsRegions(int begin, int end) const {
+  for (size_t i = 0; i < regions_.size(); ++i) {
+    if (begin < regions_[i].end && regions_[i].begin < end)
+      return true;
+  }
+  return false;
+}
+
+// Waits until the oldest region can be written over, and forgets it
+void StreamingBuffer::reuseOldest() {
+  const Region oldest = regions_.front();
+  if (!oldest.released)
+    throw runtime_error("StreamingBuffer: full of spans still in use");
+
+  GLenum status = glClientWaitSync(oldest.fence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    ++numStalls_;
+    do {
+      status = glClientWaitSync(oldest.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while (status == GL_TIMEOUT_EXPIRED);
+  }
+  if (status == GL_WAIT_FAILED)
+    throw runtime_error("StreamingBuffer: waiting for a fence failed");
+
+  regions_.pop_front();
+  // a fence is shared by the regions released together
+  bool shared = false;
+  for (size_t i = 0; i < regions_.size(); ++i)
+    shared = shared || regions_[i].fence == oldest.fence;
+  if (!shared)
+    glDeleteSync(oldest.fence);
+}
+
+shared_ptr<StreamingBuffer::Span> StreamingBuffer::allocate(int size, int alignment) {
+  assert(!mapped_);
+  if (size <= 0 || size > size_)
+    throw runtime_error("StreamingBuffer: span does not fit the buffer");
+
+  fenceReleased();
+
+  int begin;
+  for (;;) {
+    begin = (head_ + alignment - 1) / alignment * alignment;
+    if (begin + size > size_)
+      begin = 0; // wrap around, leaving the rest of the buffer unused this time
+    if (!overlapsRegions(begin, begin + size))
+      break;
+    // spans are handed out in ring order, so the oldest is in the way
+    reuseOldest();
+  }
+
+  Region region = { begin, begin + size, false, 0 };
+  regions_.push_back(region);
+  head_ = begin + size;
+
+  Span* span = new Span();
+  span->offset = begin;
+  span->size = size;
+  if (persistentData_) {
+    span->data = persistentData_ + begin;
+  } else {
+    // nothing the GPU may still read is in the range, so skip the sync
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+    span->data = glMapBufferRange(GL_ARRAY_BUFFER, begin, size,
+                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!span->data) {
+      delete span;
+      throw runtime_error("StreamingBuffer: cannot map a span");
+    }
+    mapped_ = true;
+  }
+
+  Releaser releaser = { this };
+  return shared_ptr<Span>(span, releaser);
+}
+
+void StreamingBuffer::unmap() {
+  if (!mapped_)
+    return;
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+  mapped_ = false;
+}
+
+// ---------- StreamedGeometry
+
+StreamedGeometry::StreamedGeometry(shared_ptr<StreamingBuffer> buffer, const VertexFormat& format,
+                                   GLenum primitiveType)
+  : buffer_(buffer)
+  , format_(format)
+  , primitiveType_(primitiveType)
+  , first_(0)
+  , count_(0)
+  , numInstances_(1) {
+  for (int i = 0; i < format.getNumAttribs(); ++i)
+    attribNames_.push_back(format.getAttrib(i).name);
+}
+
+void StreamedGeometry::setVertices(shared_ptr<StreamingBuffer::Span> span, int first, int count) {
+  assert(span->offset % format_.getVertexSize() == 0);
+  assert((first + count) * format_.getVertexSize() <= span->size);
+  span_ = span;
+  first_ = first;
+  count_ = count;
+  markDirty();
+}
+
+const vector<string>& StreamedGeometry::getVertexAttribNames() {
+  return attribNames_;
+}
+
+void StreamedGeometry::draw(int attribIndices[]) {
+  if (!span_ || count_ == 0)
+    return;
+
+  glBindBuffer(GL_ARRAY_BUFFER, buffer_->getBuffer());
+  for (int i = 0; i < format_.getNumAttribs(); ++i) {
+    if (attribIndices[i] >= 0)
+      format_.setGlVertexAttribPointer(i, attribIndices[i]);
+  }
+  // the attribute pointers start at the beginning of the buffer
+  const int first = span_->offset / format_.getVertexSize() + first_;
+  if (numInstances_ == 1)
+    glDrawArrays(primitiveType_, first, count_);
+  else
+    glDrawArraysInstanced(primitiveType_, first, count_, numInstances_);
+}
+
+int StreamedGeometry::getNumTriangles() {
+  return primitiveType_ == GL_TRIANGLES ? count_ / 3 * numInstances_ : 0;
+}
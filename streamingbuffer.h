@@ -0,0 +1,122 @@
+#ifndef STREAMINGBUFFER_H
+#define STREAMINGBUFFER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "glsupport.h"
+#include "geometry.h"
+
+// One large GL buffer used as a ring, to hand out spans for vertex data that
+// is rewritten often (e.g., every frame). Writing into a span goes straight
+// to mapped buffer memory, with no glBufferData/glBufferSubData copy.
+//
+// Where ARB_buffer_storage is available the buffer is mapped once,
+// persistently. Elsewhere each span is mapped unsynchronized on its own,
+// so only one span may be mapped at a time.
+//
+// A span stays untouched while anything holds on to it. Once let go, it is
+// reused after the GPU has finished the commands issued until then, which a
+// fence tells. Requires a current GL context throughout.
+class StreamingBuffer : Noncopyable {
+public:
+  struct Span {
+    int offset, size; // in bytes, within the buffer
+    void* data;       // where to write, until StreamingBuffer::unmap()
+  };
+
+  explicit StreamingBuffer(int size);
+  ~StreamingBuffer();
+
+  // Whether the buffer is persistently mapped
+  static bool isPersistentSupported();
+
+  // A span of at least size bytes, with an offset that is a multiple of
+  // alignment, mapped for writing. Waits for the GPU if the ring is full of
+  // spans it may still read, and throws if it is full of spans still held.
+  // All spans must be let go before the StreamingBuffer is destroyed.
+  std::shared_ptr<Span> allocate(int size, int alignment);
+
+  // Ends writing to the span allocate() returned last; it must be called
+  // before anything draws from the span
+  void unmap();
+
+  GLuint getBuffer() const {
+    return buffer_;
+  }
+
+  int getSize() const {
+    return size_;
+  }
+
+  bool isPersistent() const {
+    return persistentData_ != NULL;
+  }
+
+  // Number of times allocate() had to wait for the GPU
+  int getNumStalls() const {
+    return numStalls_;
+  }
+
+private:
+  struct Region {
+    int begin, end;
+    bool released;
+    GLsync fence; // 0 until a fence is set after the release
+  };
+
+  struct Releaser;
+
+  const int size_;
+  GlBufferObject buffer_;
+  char* persistentData_;
+  bool mapped_;
+  int head_; // where the next span starts looking for room
+  std::deque<Region> regions_; // allocated and not yet reused, oldest first
+  int numStalls_;
+
+  void release(int offset);
+  void fenceReleased();
+  bool overlapsRegions(int begin, int end) const;
+  void reuseOldest();
+};
+
+// Geometry drawing a run of vertices that live in a StreamingBuffer span.
+// The vertices are replaced as a whole with setVertices(), which also lets
+// go of the previous span.
+class StreamedGeometry : public Geometry {
+public:
+  // format is stored by reference, as with FormattedVbo
+  StreamedGeometry(std::shared_ptr<StreamingBuffer> buffer, const VertexFormat& format,
+                   GLenum primitiveType = GL_TRIANGLES);
+
+  // Draws vertices [first, first + count) of the span, counting from its
+  // start. The span must have been allocated from the buffer with an
+  // alignment of the vertex size, and be unmapped by the time of drawing.
+  void setVertices(std::shared_ptr<StreamingBuffer::Span> span, int first, int count);
+
+  // Draws the vertices this many times in one call, with gl_InstanceID
+  // counting the copies (default 1)
+  void setNumInstances(int numInstances) {
+    numInstances_ = numInstances;
+  }
+
+  virtual const std::vector<std::string>& getVertexAttribNames();
+  virtual void draw(int attribIndices[]);
+  virtual int getNumTriangles();
+
+private:
+  // declared before span_, so that it outlives it
+  std::shared_ptr<StreamingBuffer> buffer_;
+  const VertexFormat& format_;
+  const GLenum primitiveType_;
+  std::vector<std::string> attribNames_;
+
+  std::shared_ptr<StreamingBuffer::Span> span_;
+  int first_, count_;
+  int numInstances_;
+};
+
+#endif
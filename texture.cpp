@@ -1,6 +1,8 @@
 #include <vector>
+#include <stdexcept>
 
 #include "ppm.h"
+#include "blockcompress.h"
 #include "glsupport.h"
 #include "texture.h"
 #include "asstcommon.h"
@@ -8,16 +10,32 @@
 using namespace std;
 
 ImageTexture::ImageTexture(const char* ppmFileName, bool srgb) {
-  int width, height;
-  vector<PackedPixel> pixData;
-  ppmRead(ppmFileName, width, height, pixData);
+  const PpmImage image(ppmFileName);
+  const int width = image.getWidth(), height = image.getHeight();
+  const bool is16Bit = image.getBytesPerChannel() == 2;
 
   glBindTexture(GL_TEXTURE_2D, tex);
   if (g_Gl2Compatible)
     glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
 
-  glTexImage2D(GL_TEXTURE_2D, 0, (!srgb) || g_Gl2Compatible ? GL_RGB : GL_SRGB, width, height,
-               0, GL_RGB, GL_UNSIGNED_BYTE, &pixData[0]);
+  GLenum internalFormat = is16Bit ? GL_RGB16 : GL_RGB;
+  if (srgb && !g_Gl2Compatible)
+    internalFormat = GL_SRGB; // 8 bits per channel only
+  const GLenum type = is16Bit ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+
+  // Rows come straight out of the mapped file, top row first and tightly
+  // packed, so the image is flipped by uploading them one at a time
+  GLint unpackAlignment;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGB, type, NULL);
+  for (int row = 0; row < height; ++row) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, height - 1 - row, width, 1, GL_RGB, type,
+                    image.getRow(row));
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
 
   if (!g_Gl2Compatible)
     glGenerateMipmap(GL_TEXTURE_2D);
@@ -29,3 +47,53 @@ ImageTexture::ImageTexture(const char* ppmFileName, bool srgb) {
 
   checkGlErrors();
 }
+
+// The internal format for the block format, or 0 if the GL cannot sample it
+static GLenum getCompressedFormat(BlockFormat format, bool srgb) {
+#ifdef __MAC__
+  return 0;
+#else
+  if (format == BLOCK_FORMAT_BC5)
+    return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc ? GL_COMPRESSED_RG_RGTC2 : 0;
+  if (!GLEW_EXT_texture_compression_s3tc)
+    return 0;
+  if (srgb && !g_Gl2Compatible)
+    return GLEW_EXT_texture_sRGB ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : 0;
+  return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+#endif
+}
+
+bool CompressedTexture::isSupported(const char* ddsFileName, bool srgb) {
+  try {
+    const DdsImage image(ddsFileName);
+    return getCompressedFormat(image.getFormat(), srgb) != 0;
+  }
+  catch (const runtime_error&) {
+    return false;
+  }
+}
+
+CompressedTexture::CompressedTexture(const char* ddsFileName, bool srgb)
+  : residentBytes_(0), uncompressedBytes_(0) {
+  const DdsImage image(ddsFileName);
+  const GLenum internalFormat = getCompressedFormat(image.getFormat(), srgb);
+  if (!internalFormat)
+    throw runtime_error(string("CompressedTexture: format not supported by the GL: ") + ddsFileName);
+
+  glBindTexture(GL_TEXTURE_2D, tex);
+  for (int i = 0; i < image.getNumLevels(); ++i) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat, image.getWidth(i), image.getHeight(i),
+                           0, image.getSize(i), image.getBlocks(i));
+    residentBytes_ += image.getSize(i);
+    uncompressedBytes_ += 4 * image.getWidth(i) * image.getHeight(i);
+  }
+  // files holding only some of the levels have the rest left out
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.getNumLevels() - 1);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  checkGlErrors();
+}
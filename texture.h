@@ -38,5 +38,40 @@ public:
 };
 
 
+// A 2D texture with mipmaps, uploaded as it is with glCompressedTexImage2D
+// from a DDS file written by bcencode: BC1 for color maps, BC5 for normal
+// maps. Check isSupported() first, and fall back to the uncompressed image
+// if it says no.
+class CompressedTexture : public Texture {
+  GlTexture tex;
+  int residentBytes_, uncompressedBytes_;
+
+public:
+  // If `srgb' is true, the image is assumed to be in SRGB color space.
+  // Throws runtime_error if the file cannot be read.
+  CompressedTexture(const char* ddsFileName, bool srgb); // implemented in texture.cpp
+
+  // Whether the file can be read and the GL samples its format
+  static bool isSupported(const char* ddsFileName, bool srgb);
+
+  virtual GLenum getSamplerType() const {
+    return GL_SAMPLER_2D;
+  }
+
+  virtual void bind() const {
+    glBindTexture(GL_TEXTURE_2D, tex);
+  }
+
+  // Video memory held by the compressed levels
+  int getResidentBytes() const {
+    return residentBytes_;
+  }
+
+  // What the same levels take uncompressed, with texels padded to four
+  // channels as drivers store RGB
+  int getUncompressedBytes() const {
+    return uncompressedBytes_;
+  }
+};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "texturecache.h"
+
+using namespace std;
+
+bool TextureCache::Key::operator < (const Key& k) const {
+  if (fileName != k.fileName)
+    return fileName < k.fileName;
+  if (srgb != k.srgb)
+    return srgb < k.srgb;
+  return sampler < k.sampler;
+}
+
+const Texture* TextureCache::Entry::get() const {
+  if (texture)
+    return texture.get();
+  return compressed.get();
+}
+
+bool TextureCache::Entry::isShared() const {
+  // the loader holds on to textures still loading
+  if (texture)
+    return texture.use_count() > 1;
+  return compressed.use_count() > 1;
+}
+
+int TextureCache::Entry::getResidentBytes() const {
+  if (texture)
+    return texture->getResidentBytes();
+  return compressed->getResidentBytes();
+}
+
+TextureCache::TextureCache(shared_ptr<TextureLoader> loader, long long budgetBytes)
+  : loader_(loader)
+  , budgetBytes_(budgetBytes)
+  , useClock_(0)
+  , numHits_(0)
+  , numMisses_(0)
+  , numEvictions_(0) {}
+
+shared_ptr<AsyncTexture> TextureCache::get(const string& ppmFileName, bool srgb,
+                                           const TextureSampler& sampler, const Cvec3f& placeholderColor) {
+  Key key;
+  key.fileName = ppmFileName;
+  key.srgb = srgb;
+  key.sampler = sampler;
+
+  EntryMap::iterator i = entries_.find(key);
+  if (i != entries_.end()) {
+    ++numHits_;
+    i->second.lastUsed = ++useClock_;
+    return i->second.texture;
+  }
+
+  ++numMisses_;
+  trim();
+  Entry& entry = entries_[key];
+  entry.texture = loader_->load(ppmFileName, srgb, sampler, placeholderColor);
+  entry.lastUsed = ++useClock_;
+  return entry.texture;
+}
+
+shared_ptr<Texture> TextureCache::getCompressible(const string& baseName, bool srgb,
+                                                  const Cvec3f& placeholderColor) {
+  Key key;
+  key.fileName = baseName + ".dds";
+  key.srgb = srgb;
+
+  EntryMap::iterator i = entries_.find(key);
+  if (i != entries_.end()) {
+    ++numHits_;
+    i->second.lastUsed = ++useClock_;
+    return i->second.compressed;
+  }
+
+  if (!CompressedTexture::isSupported(key.fileName.c_str(), srgb))
+    return get(baseName + ".ppm", srgb, key.sampler, placeholderColor);
+
+  ++numMisses_;
+  trim();
+  shared_ptr<CompressedTexture> texture(new CompressedTexture(key.fileName.c_str(), srgb));
+  Entry& entry = entries_[key];
+  entry.compressed = texture;
+  entry.lastUsed = ++useClock_;
+  return texture;
+}
+
+void TextureCache::trim() {
+  long long residentBytes = getResidentBytes();
+  while (residentBytes > budgetBytes_) {
+    EntryMap::iterator victim = entries_.end();
+    for (EntryMap::iterator i = entries_.begin(); i != entries_.end(); ++i) {
+      if (!i->second.isShared() &&
+          (victim == entries_.end() || i->second.lastUsed < victim->second.lastUsed))
+        victim = i;
+    }
+    if (victim == entries_.end())
+      return;
+    residentBytes -= victim->second.getResidentBytes();
+    entries_.erase(victim);
+    ++numEvictions_;
+  }
+}
+
+long long TextureCache::getResidentBytes() const {
+  long long bytes = 0;
+  for (EntryMap::const_iterator i = entries_.begin(); i != entries_.end(); ++i)
+    bytes += i->second.getResidentBytes();
+  return bytes;
+}
+
+void TextureCache::printResidency(ostream& os, const NamedMaterials& materials) const {
+  vector<pair<string, shared_ptr<Texture> > > textures;
+  os << "Texture cache: " << entries_.size() << " textures, " << (getResidentBytes() + 512) / 1024
+     << " KB of " << budgetBytes_ / 1024 << " KB budget, " << numHits_ << " hits, " << numMisses_
+     << " misses, " << numEvictions_ << " evictions\n";
+  for (EntryMap::const_iterator i = entries_.begin(); i != entries_.end(); ++i) {
+    const Entry& entry = i->second;
+    os << "  " << i->first.fileName << (i->first.srgb ? " (srgb" : " (linear")
+       << (i->first.sampler.isMipmapped() ? ", mipmapped" : "")
+       << (i->first.sampler.wrapS == GL_REPEAT ? ", repeat" : "") << "): "
+       << (entry.getResidentBytes() + 512) / 1024 << " KB, "
+       << (entry.compressed ? "compressed" : entry.texture->isLoaded() ? "loaded" : "loading")
+       << ", last used at " << entry.lastUsed << "\n";
+
+    int numReferences = 0;
+    for (size_t j = 0; j < materials.size(); ++j) {
+      textures.clear();
+      materials[j].second->getUniforms().getTextures(textures);
+      for (size_t k = 0; k < textures.size(); ++k) {
+        if (textures[k].second.get() == entry.get()) {
+          os << "    " << materials[j].first << "." << textures[k].first << "\n";
+          ++numReferences;
+        }
+      }
+    }
+    if (numReferences == 0)
+      os << "    (no material)\n";
+  }
+  os << flush;
+}
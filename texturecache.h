@@ -0,0 +1,100 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <memory>
+
+#include "textureloader.h"
+#include "material.h"
+
+// Hands out textures loaded through a TextureLoader, one per file name,
+// color space and sampler, so that materials asking for the same image
+// share it. Block compressed DDS files are loaded and kept the same way,
+// as CompressedTextures.
+//
+// The cache keeps count of the video memory its textures hold. Once that
+// goes over the budget, textures nothing but the cache refers to any more
+// are dropped, least recently asked for first. Textures still in use are
+// never dropped, so the budget can be exceeded.
+class TextureCache : Noncopyable {
+public:
+  typedef std::vector<std::pair<std::string, std::shared_ptr<Material> > > NamedMaterials;
+
+  TextureCache(std::shared_ptr<TextureLoader> loader, long long budgetBytes);
+
+  // The texture for the image, loading it with the given placeholder color
+  // if it is not cached
+  std::shared_ptr<AsyncTexture> get(const std::string& ppmFileName, bool srgb,
+                                    const TextureSampler& sampler = TextureSampler(),
+                                    const Cvec3f& placeholderColor = Cvec3f(.5f, .5f, .5f));
+
+  // The block compressed "<baseName>.dds" if the GL can sample it, and
+  // otherwise get() of "<baseName>.ppm". Either has the default sampler,
+  // the one CompressedTexture uses.
+  std::shared_ptr<Texture> getCompressible(const std::string& baseName, bool srgb,
+                                           const Cvec3f& placeholderColor = Cvec3f(.5f, .5f, .5f));
+
+  // Drops unused textures until the cache fits the budget. get() does it
+  // before loading; call it as well after letting go of textures.
+  void trim();
+
+  void setBudget(long long budgetBytes) {
+    budgetBytes_ = budgetBytes;
+  }
+
+  long long getBudget() const {
+    return budgetBytes_;
+  }
+
+  // Sum of the getResidentBytes() of the cached textures
+  long long getResidentBytes() const;
+
+  int getNumHits() const {
+    return numHits_;
+  }
+
+  int getNumMisses() const {
+    return numMisses_;
+  }
+
+  int getNumEvictions() const {
+    return numEvictions_;
+  }
+
+  // Prints each cached texture with its size and state, and which of the
+  // given materials refer to it through which uniforms
+  void printResidency(std::ostream& os, const NamedMaterials& materials) const;
+
+private:
+  struct Key {
+    std::string fileName;
+    bool srgb;
+    TextureSampler sampler;
+
+    bool operator < (const Key& k) const;
+  };
+
+  // Exactly one of texture and compressed is set
+  struct Entry {
+    std::shared_ptr<AsyncTexture> texture;
+    std::shared_ptr<CompressedTexture> compressed;
+    unsigned lastUsed; // value of useClock_ when last asked for
+
+    const Texture* get() const;
+    bool isShared() const;
+    int getResidentBytes() const;
+  };
+
+  typedef std::map<Key, Entry> EntryMap;
+
+  std::shared_ptr<TextureLoader> loader_;
+  long long budgetBytes_;
+  EntryMap entries_;
+  unsigned useClock_;
+  int numHits_, numMisses_, numEvictions_;
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <atomic>
+
+#include "ppm.h"
+#include "mipchain.h"
+#include "textureloader.h"
+#include "frametimer.h"
+#include "asstcommon.h"
+#include "changetracker.h"
+#include "profiler.h"
+
+using namespace std;
+
+void AsyncTexture::setResidentSize(int width, int height, int bytesPerChannel) {
+  residentBytes_ = width * height * 4 * bytesPerChannel;
+  if (mipmapped_)
+    residentBytes_ += residentBytes_ / 3;
+}
+
+struct TextureLoader::Request {
+  shared_ptr<AsyncTexture> texture;
+  string fileName;
+  bool srgb;
+  bool useMipCache;
+
+  atomic<bool> decoded;
+  // set by the decode thread: the image, or all its levels if mipmapped
+  shared_ptr<PpmImage> image;
+  shared_ptr<MipChain> mips;
+  string error;
+
+  int level;           // being uploaded
+  int numRowsUploaded; // of the level, counting from the bottom
+};
+
+static void touchPages(const unsigned char* p, size_t size) {
+  volatile unsigned char sink = 0;
+  for (size_t i = 0; i < size; i += 4096)
+    sink += p[i];
+}
+
+// Runs on a decode thread: maps and parses the file, and touches every
+// page of the pixels so that the GL thread does not fault them in. The
+// levels of a mipmapped texture are read from the cache file next to the
+// image, or else built here and written there.
+void TextureLoader::decode(Request& request) {
+  try {
+    const string cacheFileName = MipChain::getCacheFileName(request.fileName, request.srgb);
+    if (request.texture->mipmapped_ && request.useMipCache)
+      request.mips = MipChain::loadCached(cacheFileName, request.fileName, request.srgb);
+
+    if (request.mips) {
+      const MipChain& mips = *request.mips;
+      for (int i = 0; i < mips.getNumLevels(); ++i)
+        touchPages(mips.getPixels(i), size_t(3) * mips.getWidth(i) * mips.getHeight(i));
+    }
+    else {
+      request.image.reset(new PpmImage(request.fileName.c_str()));
+      const PpmImage& image = *request.image;
+      if (request.texture->mipmapped_ && image.getBytesPerChannel() == 1) {
+        request.mips.reset(new MipChain(image, request.srgb, NULL));
+        request.image.reset();
+        if (request.useMipCache)
+          request.mips->saveCached(cacheFileName, request.fileName);
+      }
+      else {
+        for (int row = 0; row < image.getHeight(); ++row)
+          touchPages(image.getRow(row), image.getRowSize());
+      }
+    }
+  }
+  catch (const exception& e) {
+    request.image.reset();
+    request.mips.reset();
+    request.error = e.what();
+  }
+  request.decoded.store(true, memory_order_release);
+}
+
+TextureLoader::TextureLoader(int bandSize, bool useMipCache, int numDecoders)
+  : bandSize_(bandSize)
+  , useMipCache_(useMipCache)
+  , quit_(false) {
+  for (int i = 0; i < max(1, numDecoders); ++i)
+    decoders_.push_back(thread(&TextureLoader::decoderMain, this));
+}
+
+TextureLoader::~TextureLoader() {
+  {
+    lock_guard<mutex> lock(decodeMutex_);
+    quit_ = true;
+  }
+  decodeCv_.notify_all();
+  for (size_t i = 0; i < decoders_.size(); ++i)
+    decoders_[i].join();
+}
+
+void TextureLoader::decoderMain() {
+  Profiler::setThreadName("decode");
+  for (;;) {
+    shared_ptr<Request> request;
+    {
+      unique_lock<mutex> lock(decodeMutex_);
+      while (decodeQueue_.empty() && !quit_)
+        decodeCv_.wait(lock);
+      if (quit_)
+        return;
+      request = decodeQueue_.front();
+      decodeQueue_.pop_front();
+    }
+    decode(*request);
+  }
+}
+
+shared_ptr<AsyncTexture> TextureLoader::load(const string& ppmFileName, bool srgb,
+                                             const TextureSampler& sampler, const Cvec3f& placeholderColor) {
+  shared_ptr<AsyncTexture> texture(new AsyncTexture(ppmFileName, sampler.isMipmapped()));
+
+  glBindTexture(GL_TEXTURE_2D, texture->tex_);
+  if (g_Gl2Compatible && sampler.isMipmapped())
+    glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+  unsigned char texel[3];
+  for (int i = 0; i < 3; ++i)
+    texel[i] = static_cast<unsigned char>(max(0.f, min(1.f, placeholderColor[i])) * 255 + .5f);
+  // a single texel is a complete mipmap chain
+  glTexImage2D(GL_TEXTURE_2D, 0, (!srgb) || g_Gl2Compatible ? GL_RGB : GL_SRGB, 1, 1,
+               0, GL_RGB, GL_UNSIGNED_BYTE, texel);
+  texture->setResidentSize(1, 1, 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampler.minFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.magFilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrapS);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrapT);
+  checkGlErrors();
+
+  shared_ptr<Request> request(new Request());
+  request->texture = texture;
+  request->fileName = ppmFileName;
+  request->srgb = srgb;
+  request->useMipCache = useMipCache_;
+  request->decoded = false;
+  request->level = 0;
+  request->numRowsUploaded = -1;
+  requests_.push_back(request);
+
+  {
+    lock_guard<mutex> lock(decodeMutex_);
+    decodeQueue_.push_back(request);
+  }
+  decodeCv_.notify_one();
+  return texture;
+}
+
+// Copies the next band of rows into the PBO and from there into the
+// texture. Mip chains are stored bottom row first; images store the top
+// row first, so their rows are flipped on the way.
+void TextureLoader::uploadBand(Request& request) {
+  const MipChain *mips = request.mips.get();
+  const PpmImage *image = request.image.get();
+  const int width = mips ? mips->getWidth(request.level) : image->getWidth();
+  const int height = mips ? mips->getHeight(request.level) : image->getHeight();
+  const int bytesPerChannel = mips ? 1 : image->getBytesPerChannel();
+  const int rowSize = 3 * width * bytesPerChannel;
+  const GLenum type = bytesPerChannel == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+
+  glBindTexture(GL_TEXTURE_2D, request.texture->tex_);
+  if (request.numRowsUploaded < 0) {
+    GLenum internalFormat = bytesPerChannel == 2 ? GL_RGB16 : GL_RGB;
+    if (request.srgb && !g_Gl2Compatible)
+      internalFormat = GL_SRGB; // 8 bits per channel only
+    const int numLevels = mips ? mips->getNumLevels() : 1;
+    for (int i = 0; i < numLevels; ++i) {
+      glTexImage2D(GL_TEXTURE_2D, i, internalFormat, mips ? mips->getWidth(i) : width,
+                   mips ? mips->getHeight(i) : height, 0, GL_RGB, type, NULL);
+    }
+    // keep the texture complete until all levels are in
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    if (mips && g_Gl2Compatible)
+      glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_FALSE);
+    request.texture->setResidentSize(width, height, bytesPerChannel);
+    request.numRowsUploaded = 0;
+  }
+
+  const int numRows = min(height - request.numRowsUploaded, max(1, bandSize_ / rowSize));
+  const int size = numRows * rowSize;
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+  // orphan the previous band, which the GL may still be reading from
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+  char *dest = static_cast<char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                                   GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+  if (!dest) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    throw runtime_error("TextureLoader: cannot map the pixel buffer");
+  }
+  if (mips) {
+    memcpy(dest, mips->getPixels(request.level) + request.numRowsUploaded * rowSize, size);
+  }
+  else {
+    for (int i = 0; i < numRows; ++i)
+      memcpy(dest + i * rowSize, image->getRow(height - 1 - (request.numRowsUploaded + i)), rowSize);
+  }
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  GLint unpackAlignment;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, request.level, 0, request.numRowsUploaded, width, numRows, GL_RGB, type, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  request.numRowsUploaded += numRows;
+  markDirty(); // the band shows right away
+  if (request.numRowsUploaded == height) {
+    ++request.level;
+    request.numRowsUploaded = 0;
+  }
+  if (request.level == (mips ? mips->getNumLevels() : 1)) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+    if (!mips && request.texture->mipmapped_ && !g_Gl2Compatible)
+      glGenerateMipmap(GL_TEXTURE_2D);
+    request.texture->loaded_ = true;
+    request.image.reset();
+    request.mips.reset();
+  }
+  checkGlErrors();
+}
+
+void TextureLoader::update(double budgetMs) {
+  Stopwatch stopwatch;
+  while (!requests_.empty() && stopwatch.elapsedMs() < budgetMs) {
+    Request& request = *requests_.front();
+    if (!request.decoded.load(memory_order_acquire))
+      return;
+
+    if (!request.image && !request.mips) {
+      // keep the placeholder rather than bring the program down mid frame
+      cerr << "TextureLoader: " << request.error << endl;
+      requests_.pop_front();
+      continue;
+    }
+
+    uploadBand(request);
+    if (request.texture->isLoaded())
+      requests_.pop_front();
+  }
+}
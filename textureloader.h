@@ -0,0 +1,136 @@
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "cvec.h"
+#include "glsupport.h"
+#include "texture.h"
+
+// Sampler parameters of a 2D texture
+struct TextureSampler {
+  GLenum minFilter, magFilter, wrapS, wrapT;
+
+  explicit TextureSampler(GLenum aMinFilter = GL_LINEAR_MIPMAP_LINEAR, GLenum aMagFilter = GL_LINEAR,
+                          GLenum wrap = GL_CLAMP_TO_EDGE)
+    : minFilter(aMinFilter), magFilter(aMagFilter), wrapS(wrap), wrapT(wrap) {}
+
+  bool isMipmapped() const {
+    return minFilter != GL_LINEAR && minFilter != GL_NEAREST;
+  }
+
+  bool operator < (const TextureSampler& s) const {
+    if (minFilter != s.minFilter)
+      return minFilter < s.minFilter;
+    if (magFilter != s.magFilter)
+      return magFilter < s.magFilter;
+    if (wrapS != s.wrapS)
+      return wrapS < s.wrapS;
+    return wrapT < s.wrapT;
+  }
+};
+
+// A 2D texture loaded from a PPM file by a TextureLoader. It can be bound
+// right away: until its image is uploaded it holds a single texel of a
+// placeholder color.
+class AsyncTexture : public Texture {
+public:
+  virtual GLenum getSamplerType() const {
+    return GL_SAMPLER_2D;
+  }
+
+  virtual void bind() const {
+    glBindTexture(GL_TEXTURE_2D, tex_);
+  }
+
+  bool isLoaded() const {
+    return loaded_;
+  }
+
+  const std::string& getFileName() const {
+    return fileName_;
+  }
+
+  // Estimated video memory held, with mipmaps. Drivers pad RGB texels to
+  // four channels, so count them that way.
+  int getResidentBytes() const {
+    return residentBytes_;
+  }
+
+private:
+  friend class TextureLoader;
+
+  GlTexture tex_;
+  const std::string fileName_;
+  const bool mipmapped_;
+  bool loaded_;
+  int residentBytes_;
+
+  AsyncTexture(const std::string& fileName, bool mipmapped)
+    : fileName_(fileName), mipmapped_(mipmapped), loaded_(false), residentBytes_(0) {}
+
+  void setResidentSize(int width, int height, int bytesPerChannel);
+};
+
+// Loads textures without blocking the GL thread. PPM files are read and
+// decoded by a pool of decode threads of its own, several at a time; the GL
+// thread then uploads the decoded images in update(), a band of rows at a
+// time through a pixel buffer object, for no more than a given time per
+// frame. The decoding stays off the job system, because the GL thread runs
+// queued jobs while it waits for its own parallelFor()s.
+// Requires a current GL context throughout, except for the decoding.
+//
+// The mipmaps of 8 bit images are built on the CPU as a MipChain by the
+// decode thread, rather than by the driver, and with useMipCache kept in a "<image>.srgb.mips" or
+// "<image>.linear.mips" cache file, from which later runs upload all levels
+// directly.
+class TextureLoader : Noncopyable {
+public:
+  // Rows are uploaded in bands of up to bandSize bytes, and images are
+  // decoded on numDecoders threads
+  explicit TextureLoader(int bandSize = 1 << 20, bool useMipCache = true, int numDecoders = 2);
+
+  // Waits for the images being decoded, and drops those not started yet
+  ~TextureLoader();
+
+  // Starts loading the image. If `srgb' is true, the image is assumed to be
+  // in SRGB color space. Mipmaps are generated if the sampler uses them.
+  std::shared_ptr<AsyncTexture> load(const std::string& ppmFileName, bool srgb,
+                                     const TextureSampler& sampler, const Cvec3f& placeholderColor);
+
+  // Uploads decoded images, in the order they were asked for, until about
+  // budgetMs milliseconds have passed. Call once per frame.
+  void update(double budgetMs);
+
+  // Number of textures not yet uploaded
+  int getNumPending() const {
+    return int(requests_.size());
+  }
+
+private:
+  struct Request;
+
+  const int bandSize_;
+  const bool useMipCache_;
+  GlBufferObject pbo_;
+  std::deque<std::shared_ptr<Request> > requests_;
+
+  // requests waiting for a decode thread
+  std::deque<std::shared_ptr<Request> > decodeQueue_;
+  bool quit_;
+  std::mutex decodeMutex_;
+  std::condition_variable decodeCv_;
+  std::vector<std::thread> decoders_;
+
+  void decoderMain();
+  static void decode(Request& request);
+  void uploadBand(Request& request);
+};
+
+#endif
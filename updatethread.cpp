@@ -0,0 +1,47 @@
+#include <cassert>
+
+#include "updatethread.h"
+#include "profiler.h"
+
+using namespace std;
+
+void UpdateThread::start(Callback callback) {
+  assert(!thread_.joinable());
+  callback_ = callback;
+  requested_ = quit_ = false;
+  thread_ = thread(&UpdateThread::run, this);
+}
+
+void UpdateThread::requestFrame() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    requested_ = true;
+  }
+  cv_.notify_one();
+}
+
+void UpdateThread::stop() {
+  if (!thread_.joinable())
+    return;
+  {
+    lock_guard<mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void UpdateThread::run() {
+  Profiler::setThreadName("update");
+  for (;;) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      while (!requested_ && !quit_)
+        cv_.wait(lock);
+      if (quit_)
+        return;
+      requested_ = false;
+    }
+    callback_();
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef UPDATETHREAD_H
+#define UPDATETHREAD_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "glsupport.h" // for Noncopyable
+
+// A worker thread that runs a callback once every time a frame is requested.
+// Requests that arrive while the callback is running are coalesced into one.
+//
+// The callback must not make any GL calls: the GL context is owned by the
+// GLUT thread.
+class UpdateThread : Noncopyable {
+public:
+  typedef void (*Callback)();
+
+  UpdateThread() : callback_(NULL), requested_(false), quit_(false) {}
+  ~UpdateThread() {
+    stop();
+  }
+
+  void start(Callback callback);
+
+  // Signals the worker to run the callback once more. Never blocks.
+  void requestFrame();
+
+  // Waits for the callback to finish if it is running, then joins the worker.
+  // Must not be called while holding a lock the callback needs.
+  void stop();
+
+  bool isRunning() const {
+    return thread_.joinable();
+  }
+
+private:
+  void run();
+
+  Callback callback_;
+  bool requested_, quit_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "vertexcache.h"
+
+using namespace std;
+
+double computeAcmr(const vector<int>& indices, int numVertices) {
+  if (indices.size() < 3)
+    return 0;
+
+  // a vertex is in the FIFO while fewer than VERTEX_CACHE_SIZE misses have
+  // happened since it was loaded
+  vector<int> loadedAt(numVertices, -VERTEX_CACHE_SIZE - 1);
+  int numMisses = 0;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    const int v = indices[i];
+    if (numMisses - loadedAt[v] > VERTEX_CACHE_SIZE)
+      loadedAt[v] = numMisses++;
+  }
+  return double(numMisses) / (indices.size() / 3);
+}
+
+// ---------- Forsyth
+
+namespace {
+
+// The order is built with an LRU cache model a bit larger than the FIFO the
+// result is measured with, as in Forsyth's reference implementation
+const int SCORED_CACHE_SIZE = 32;
+
+class ForsythOptimizer {
+public:
+  ForsythOptimizer(const vector<int>& indices, int numVertices);
+
+  void run(vector<int>& order);
+
+private:
+  const vector<int>& indices_;
+  const int numTriangles_;
+
+  // live triangles of vertex v: vertexTriangles_[triangleStarts_[v] ..
+  // triangleStarts_[v] + valences_[v]]
+  vector<int> triangleStarts_, vertexTriangles_, valences_;
+  vector<int> cachePositions_; // -1 if not in the cache
+  vector<float> vertexScores_, triangleScores_;
+  vector<char> emitted_;
+  vector<int> cache_;
+
+  float getVertexScore(int v) const;
+  void updateVertex(int v);
+  void emit(int t);
+};
+
+float ForsythOptimizer::getVertexScore(int v) const {
+  if (valences_[v] == 0)
+    return -1; // nothing left to draw with it
+
+  float score = 0;
+  const int position = cachePositions_[v];
+  if (position >= 0) {
+    if (position < 3) {
+      // used by the last triangle: a fixed score, so that the next
+      // triangle does not just reuse the same two vertices in a strip
+      score = 0.75f;
+    } else {
+      score = pow(1 - float(position - 3) / (SCORED_CACHE_SIZE - 3), 1.5f);
+    }
+  }
+  // finish off vertices with few triangles left, so they don't linger
+  return score + 2 * pow(float(valences_[v]), -0.5f);
+}
+
+ForsythOptimizer::ForsythOptimizer(const vector<int>& indices, int numVertices)
+  : indices_(indices)
+  , numTriangles_(indices.size() / 3)
+  , triangleStarts_(numVertices + 1, 0)
+  , vertexTriangles_(indices.size())
+  , valences_(numVertices, 0)
+  , cachePositions_(numVertices, -1)
+  , vertexScores_(numVertices)
+  , triangleScores_(numTriangles_, 0)
+  , emitted_(numTriangles_, 0) {
+  for (size_t i = 0; i < indices.size(); ++i)
+    ++triangleStarts_[indices[i] + 1];
+  for (int v = 0; v < numVertices; ++v)
+    triangleStarts_[v + 1] += triangleStarts_[v];
+  for (size_t i = 0; i < indices.size(); ++i) {
+    const int v = indices[i];
+    vertexTriangles_[triangleStarts_[v] + valences_[v]++] = i / 3;
+  }
+
+  for (int v = 0; v < numVertices; ++v) {
+    vertexScores_[v] = getVertexScore(v);
+    for (int i = 0; i < valences_[v]; ++i)
+      triangleScores_[vertexTriangles_[triangleStarts_[v] + i]] += vertexScores_[v];
+  }
+}
+
+// Brings the score of v and of its live triangles up to date
+void ForsythOptimizer::updateVertex(int v) {
+  const float score = getVertexScore(v);
+  const float delta = score - vertexScores_[v];
+  vertexScores_[v] = score;
+  for (int i = 0; i < valences_[v]; ++i)
+    triangleScores_[vertexTriangles_[triangleStarts_[v] + i]] += delta;
+}
+
+void ForsythOptimizer::emit(int t) {
+  emitted_[t] = 1;
+
+  // the triangle is no longer live at its vertices
+  for (int j = 0; j < 3; ++j) {
+    const int v = indices_[3 * t + j];
+    int* tris = &vertexTriangles_[triangleStarts_[v]];
+    const int n = valences_[v];
+    for (int i = 0; i < n; ++i) {
+      if (tris[i] == t) {
+        tris[i] = tris[n - 1];
+        break;
+      }
+    }
+    --valences_[v];
+  }
+
+  // the triangle's vertices move to the front of the cache
+  vector<int> newCache(indices_.begin() + 3 * t, indices_.begin() + 3 * t + 3);
+  for (size_t i = 0; i < cache_.size(); ++i) {
+    const int v = cache_[i];
+    if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+      newCache.push_back(v);
+  }
+  for (size_t i = SCORED_CACHE_SIZE; i < newCache.size(); ++i)
+    cachePositions_[newCache[i]] = -1;
+  if (newCache.size() > size_t(SCORED_CACHE_SIZE))
+    newCache.resize(SCORED_CACHE_SIZE);
+  for (size_t i = 0; i < newCache.size(); ++i)
+    cachePositions_[newCache[i]] = i;
+
+  // evicted vertices have lost their cache score
+  for (size_t i = 0; i < cache_.size(); ++i) {
+    if (cachePositions_[cache_[i]] < 0)
+      updateVertex(cache_[i]);
+  }
+  cache_.swap(newCache);
+  for (size_t i = 0; i < cache_.size(); ++i)
+    updateVertex(cache_[i]);
+}
+
+void ForsythOptimizer::run(vector<int>& order) {
+  order.clear();
+  order.reserve(3 * numTriangles_);
+
+  int best = -1;
+  for (int t = 0; t < numTriangles_; ++t) {
+    if (best < 0 || triangleScores_[t] > triangleScores_[best])
+      best = t;
+  }
+
+  int nextUnemitted = 0; // no triangle before this one is left
+  while (best >= 0) {
+    for (int j = 0; j < 3; ++j)
+      order.push_back(indices_[3 * best + j]);
+    emit(best);
+
+    // the best next triangle is almost always one using a cached vertex
+    best = -1;
+    for (size_t i = 0; i < cache_.size(); ++i) {
+      const int v = cache_[i];
+      for (int k = 0; k < valences_[v]; ++k) {
+        const int t = vertexTriangles_[triangleStarts_[v] + k];
+        if (best < 0 || triangleScores_[t] > triangleScores_[best])
+          best = t;
+      }
+    }
+    if (best < 0) {
+      // the cache has run dry; start over somewhere else
+      while (nextUnemitted < numTriangles_ && emitted_[nextUnemitted])
+        ++nextUnemitted;
+      if (nextUnemitted < numTriangles_)
+        best = nextUnemitted;
+    }
+  }
+}
+
+} // namespace
+
+void optimizeVertexCache(vector<int>& indices, int numVertices) {
+  if (indices.size() < 6)
+    return;
+  vector<int> order;
+  ForsythOptimizer(indices, numVertices).run(order);
+  indices.swap(order);
+}
+
+// ---------- Overdraw
+
+namespace {
+
+struct Cluster {
+  int begin, end; // triangles
+  double sortKey;
+};
+
+struct ClusterGreater {
+  bool operator () (const Cluster& a, const Cluster& b) const {
+    return a.sortKey > b.sortKey;
+  }
+};
+
+} // namespace
+
+void optimizeOverdraw(vector<int>& indices, const vector<Cvec3>& positions) {
+  const int numTriangles = indices.size() / 3;
+  if (numTriangles < 2)
+    return;
+
+  // split the order into runs where the cache starts out cold, i.e., at
+  // triangles whose vertices all miss, so that moving whole runs around
+  // costs no more than a few misses each
+  vector<int> loadedAt(positions.size(), -VERTEX_CACHE_SIZE - 1);
+  int numMisses = 0;
+  vector<Cluster> clusters;
+  for (int t = 0; t < numTriangles; ++t) {
+    int triangleMisses = 0;
+    for (int j = 0; j < 3; ++j) {
+      const int v = indices[3 * t + j];
+      if (numMisses - loadedAt[v] > VERTEX_CACHE_SIZE) {
+        loadedAt[v] = numMisses++;
+        ++triangleMisses;
+      }
+    }
+    if (t == 0 || triangleMisses == 3) {
+      if (!clusters.empty())
+        clusters.back().end = t;
+      Cluster c = { t, numTriangles, 0 };
+      clusters.push_back(c);
+    }
+  }
+  if (clusters.size() < 2)
+    return;
+
+  Cvec3 meshCenter(0);
+  double meshArea = 0;
+  vector<Cvec3> centers(numTriangles), normals(numTriangles);
+  for (int t = 0; t < numTriangles; ++t) {
+    const Cvec3& p0 = positions[indices[3 * t]];
+    const Cvec3& p1 = positions[indices[3 * t + 1]];
+    const Cvec3& p2 = positions[indices[3 * t + 2]];
+    centers[t] = (p0 + p1 + p2) / 3;
+    normals[t] = cross(p1 - p0, p2 - p0); // length is twice the area
+    meshCenter += centers[t] * norm(normals[t]);
+    meshArea += norm(normals[t]);
+  }
+  if (meshArea > 0)
+    meshCenter /= meshArea;
+
+  // how far out the run faces, by area weighted center and normal
+  for (size_t i = 0; i < clusters.size(); ++i) {
+    Cvec3 center(0), normal(0);
+    double area = 0;
+    for (int t = clusters[i].begin; t < clusters[i].end; ++t) {
+      center += centers[t] * norm(normals[t]);
+      normal += normals[t];
+      area += norm(normals[t]);
+    }
+    if (area > 0 && norm2(normal) > 0)
+      clusters[i].sortKey = dot(center / area - meshCenter, normal.normalize());
+  }
+  stable_sort(clusters.begin(), clusters.end(), ClusterGreater());
+
+  vector<int> sorted;
+  sorted.reserve(indices.size());
+  for (size_t i = 0; i < clusters.size(); ++i)
+    sorted.insert(sorted.end(), indices.begin() + 3 * clusters[i].begin, indices.begin() + 3 * clusters[i].end);
+  indices.swap(sorted);
+}
+
+// ---------- Vertex fetch
+
+int optimizeVertexFetch(vector<int>& indices, int numVertices, vector<int>& remap) {
+  remap.assign(numVertices, -1);
+  int numUsed = 0;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    int& v = remap[indices[i]];
+    if (v < 0)
+      v = numUsed++;
+    indices[i] = v;
+  }
+  return numUsed;
+}
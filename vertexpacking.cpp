@@ -0,0 +1,82 @@
+#include <cstring>
+#include <algorithm>
+
+#include "vertexpacking.h"
+
+using namespace std;
+
+GLhalf floatToHalf(float x) {
+  unsigned bits;
+  memcpy(&bits, &x, sizeof(bits));
+  const unsigned sign = (bits >> 16) & 0x8000;
+  const int floatExponent = (bits >> 23) & 0xff;
+  unsigned mantissa = bits & 0x7fffff;
+
+  if (floatExponent == 0xff) // infinity, or NaN which must stay a NaN
+    return GLhalf(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+  const int exponent = floatExponent - 127 + 15;
+  if (exponent >= 31)
+    return GLhalf(sign | 0x7c00);
+
+  unsigned h, rest, halfway;
+  if (exponent <= 0) {
+    // denormal, with the implicit leading 1 shifted in
+    if (exponent < -10)
+      return GLhalf(sign);
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    h = mantissa >> shift;
+    rest = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  } else {
+    h = (exponent << 10) | (mantissa >> 13);
+    rest = mantissa & 0x1fff;
+    halfway = 0x1000;
+  }
+  // round to nearest even; a carry out of the mantissa correctly bumps the
+  // exponent, up to infinity
+  if (rest > halfway || (rest == halfway && (h & 1)))
+    ++h;
+  return GLhalf(sign | h);
+}
+
+float halfToFloat(GLhalf h) {
+  const unsigned sign = unsigned(h & 0x8000) << 16;
+  const int exponent = (h >> 10) & 0x1f;
+  const unsigned mantissa = h & 0x3ff;
+
+  if (exponent == 0) {
+    // zero or denormal: mantissa * 2^-24
+    const float x = mantissa * (1.0f / (1 << 24));
+    return sign ? -x : x;
+  }
+
+  const unsigned bits = exponent == 31
+                        ? sign | 0x7f800000 | (mantissa << 13)
+                        : sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  float x;
+  memcpy(&x, &bits, sizeof(x));
+  return x;
+}
+
+GLuint packSnorm3(const Cvec3f& v) {
+  GLuint packed = 0;
+  for (int i = 0; i < 3; ++i) {
+    const float c = max(-1.0f, min(1.0f, v[i]));
+    const int q = int(c * 511 + (c < 0 ? -0.5f : 0.5f));
+    packed |= GLuint(q & 0x3ff) << (10 * i);
+  }
+  return packed;
+}
+
+Cvec3f unpackSnorm3(GLuint packed) {
+  Cvec3f v;
+  for (int i = 0; i < 3; ++i) {
+    int q = (packed >> (10 * i)) & 0x3ff;
+    if (q & 0x200)
+      q -= 0x400; // sign extend
+    v[i] = max(-1.0f, q / 511.0f);
+  }
+  return v;
+}
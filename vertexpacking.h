@@ -0,0 +1,41 @@
+#ifndef VERTEXPACKING_H
+#define VERTEXPACKING_H
+
+#include "cvec.h"
+#include "glsupport.h"
+
+// Conversions to the compact attribute types GL can read directly: half
+// floats (GL_HALF_FLOAT) and 10 bit signed normalized integers
+// (GL_INT_2_10_10_10_REV with normalized = GL_TRUE).
+
+// Rounds to the nearest half float; out of range values become infinity
+GLhalf floatToHalf(float x);
+
+float halfToFloat(GLhalf h);
+
+// Packs a vector with components in [-1, 1], such as a unit normal, as x,
+// y and z in the low 10 bit fields of a 2_10_10_10_REV attribute. w is 0.
+GLuint packSnorm3(const Cvec3f& v);
+
+Cvec3f unpackSnorm3(GLuint packed);
+
+// n half floats. Reading a component gives it back as a float.
+template<int n>
+struct HalfVec {
+  GLhalf h[n];
+
+  HalfVec() {}
+
+  // the first min(n, m) components of v, then `fill'
+  template<int m>
+  explicit HalfVec(const Cvec<float, m>& v, float fill = 1) {
+    for (int i = 0; i < n; ++i)
+      h[i] = floatToHalf(i < m ? v[i] : fill);
+  }
+
+  float operator [] (int i) const {
+    return halfToFloat(h[i]);
+  }
+};
+
+#endif